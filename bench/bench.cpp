@@ -0,0 +1,447 @@
+// metoxid_bench: repeatable timings of the paths the editor and the batch modes depend on,
+// over test_images/ and generated stress files (see stress_files.hpp).
+//
+//   open       MappedFile::Open() and Metadata construction (ReadMode::Full)
+//   open_fast  the same with ReadMode::Fast
+//   fields     every category's field map built again from the parsed metadata
+//   flatten    Metadata::Flatten(), what dump and the index store
+//   search     building the editor's FieldSearch
+//   render     drawing every row of the editor, all categories expanded, on an off-screen terminal
+//   keystroke  typing a character into the file's longest field (the XMP packet, usually) and
+//              drawing it, with the cursor halfway through
+//   save       Set() on a key the samples don't have and Save(), i.e. a full rewrite, on a copy
+//   patch      Apply() shortening an existing Exif string and Save(), i.e. an in-place patch, on a copy
+//
+// Each case runs once to warm up and then --iterations times. Reported are percentiles
+// of the wall time and the operator new calls and bytes per run.
+//
+// Before timing anything it checks that values as Exiv2 prints them pass checkValue(), so
+// the editor never refuses a field the user didn't change (roundtrip).
+#include <metoxid.hpp>
+#if defined(METOXID_LINUX) || defined(METOXID_MACOS)
+#include <ncurses.h>
+#else
+#include <ncursesw/ncurses.h>
+#endif
+#include "stress_files.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::atomic<bool> counting{false};
+std::atomic<size_t> allocations{0};
+std::atomic<size_t> allocated_bytes{0};
+
+} // namespace
+
+// Counts every allocation made through operator new, including Exiv2's, while a case runs
+void* operator new(size_t size) {
+    if (counting.load(std::memory_order_relaxed)) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    if (void* memory = std::malloc(size != 0 ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+namespace {
+
+struct Options {
+    size_t iterations = 20;
+    std::string filter; // only cases or inputs containing this
+    std::filesystem::path images = std::filesystem::path(METOXID_SOURCE_DIR) / "test_images";
+    std::filesystem::path work = std::filesystem::temp_directory_path() / "metoxid_bench";
+    size_t big_tiff_mb = 256;
+    bool stress = true;
+    bool regenerate = false;
+    bool json = false;
+};
+
+struct Result {
+    std::string name;
+    std::string input;
+    std::vector<double> ms; // one per iteration
+    double allocations; // per iteration
+    double kilobytes;
+};
+
+// Runs body once to warm up, then options.iterations times, each after an untimed setup
+Result measure(const Options& options, const std::string& name, const std::filesystem::path& input,
+               const std::function<void()>& setup, const std::function<void()>& body) {
+    Result result{name, input.filename().string(), {}, 0, 0};
+
+    setup();
+    body();
+
+    size_t total_allocations = 0;
+    size_t total_bytes = 0;
+    for (size_t i = 0; i < options.iterations; ++i) {
+        setup();
+
+        const size_t allocations_before = allocations.load();
+        const size_t bytes_before = allocated_bytes.load();
+        counting = true;
+        const auto start = std::chrono::steady_clock::now();
+        body();
+        const auto end = std::chrono::steady_clock::now();
+        counting = false;
+
+        total_allocations += allocations.load() - allocations_before;
+        total_bytes += allocated_bytes.load() - bytes_before;
+        result.ms.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+
+    result.allocations = double(total_allocations) / double(options.iterations);
+    result.kilobytes = double(total_bytes) / 1024.0 / double(options.iterations);
+    return result;
+}
+
+double percentile(std::vector<double> values, double p) { // nearest rank
+    std::sort(values.begin(), values.end());
+    const size_t rank = size_t(std::ceil(p / 100.0 * double(values.size())));
+    return values[std::min(values.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+void report(const Options& options, const Result& result) {
+    const double p50 = percentile(result.ms, 50);
+    const double p90 = percentile(result.ms, 90);
+    const double p99 = percentile(result.ms, 99);
+    const double max = percentile(result.ms, 100);
+
+    if (options.json) {
+        std::string line = "{\"case\":";
+        appendJsonString(line, result.name);
+        line += ",\"input\":";
+        appendJsonString(line, result.input);
+        std::printf("%s,\"iterations\":%zu,\"p50_ms\":%.4f,\"p90_ms\":%.4f,\"p99_ms\":%.4f,\"max_ms\":%.4f,\"allocs\":%.1f,\"kb\":%.1f}\n",
+                    line.c_str(), result.ms.size(), p50, p90, p99, max, result.allocations, result.kilobytes);
+    } else {
+        std::printf("%-10s %-34.34s %5zu %10.3f %10.3f %10.3f %10.3f %11.1f %11.1f\n", result.name.c_str(), result.input.c_str(),
+                    result.ms.size(), p50, p90, p99, max, result.allocations, result.kilobytes);
+    }
+    std::fflush(stdout);
+}
+
+// A terminal that draws into the null device, so rendering costs what it would on screen
+// minus the terminal itself. null if the terminal type isn't known.
+SCREEN* openOffscreen() {
+#if defined(METOXID_WINDOWS)
+    const char* null_device = "NUL";
+#else
+    const char* null_device = "/dev/null";
+#endif
+    FILE* out = std::fopen(null_device, "w");
+    FILE* in = std::fopen(null_device, "r");
+    const char* term = std::getenv("TERM");
+    SCREEN* screen = out != nullptr && in != nullptr ? newterm(term != nullptr && *term != '\0' ? term : "xterm", out, in) : nullptr;
+    if (screen == nullptr) {
+        return nullptr;
+    }
+
+    set_term(screen);
+    resize_term(50, 160); // the same geometry whatever runs the benchmark
+    if (has_colors()) {
+        start_color();
+        init_pair(1, COLOR_RED, COLOR_BLACK);
+        init_pair(2, COLOR_BLACK, COLOR_WHITE);
+    }
+    return screen;
+}
+
+void renderAll(RowModel& rows) {
+    erase();
+    for (size_t i = 0; i < rows.Size(); ++i) {
+        const long y = long(rows.LineOf(i) % size_t(LINES));
+        if (y == 0 && i > 0) { // a screenful at a time, as if scrolling through
+            wnoutrefresh(stdscr);
+            doupdate();
+            erase();
+        }
+        drawRow(rows, i, y, LINES, COLS, i == 0, nullptr);
+    }
+    wnoutrefresh(stdscr);
+    doupdate();
+}
+
+// The field with the longest value, the one where editing costs the most
+std::pair<size_t, FieldMap::value_type*> longestField(Metadata& metadata) {
+    std::pair<size_t, FieldMap::value_type*> longest{0, nullptr};
+    size_t longest_size = 0;
+    for (size_t i = 0; i < metadata.Categories().size(); ++i) {
+        for (auto& field : metadata.Categories()[i].Fields()) {
+            const size_t size = toDisplayString(field.second).size();
+            if (longest.second == nullptr || size > longest_size) {
+                longest = {i, &field};
+                longest_size = size;
+            }
+        }
+    }
+    return longest;
+}
+
+// An Exif string that can be shortened, so saving it patches the file in place
+FieldMap::value_type* patchableField(Metadata& metadata) {
+    for (auto& category : metadata.Categories()) {
+        if (category.name != "Exif") {
+            continue;
+        }
+        for (auto& field : category.Fields()) {
+            const auto* value = std::get_if<std::reference_wrapper<const Exiv2::Value>>(&field.second);
+            if (value != nullptr && value->get().typeId() == Exiv2::asciiString && value->get().toString().size() >= 2) {
+                return &field;
+            }
+        }
+    }
+    return nullptr;
+}
+
+void benchFile(const Options& options, const std::filesystem::path& input, bool screen) {
+    auto wanted = [&](const char* name) {
+        return options.filter.empty() || std::string(name).find(options.filter) != std::string::npos ||
+               input.filename().string().find(options.filter) != std::string::npos;
+    };
+    auto none = [] {};
+
+    std::unique_ptr<Metadata> metadata;
+    for (const ReadMode mode : {ReadMode::Full, ReadMode::Fast}) {
+        const char* name = mode == ReadMode::Full ? "open" : "open_fast";
+        if (wanted(name)) {
+            report(options, measure(options, name, input, [&] { metadata.reset(); }, [&] {
+                metadata = std::make_unique<Metadata>(MappedFile::Open(input), mode);
+            }));
+        }
+    }
+
+    metadata = std::make_unique<Metadata>(MappedFile::Open(input), ReadMode::Full);
+    if (wanted("fields")) {
+        report(options, measure(options, "fields", input, none, [&] {
+            for (auto& category : metadata->Categories()) {
+                category.Reset();
+                category.Fields();
+            }
+        }));
+    }
+    if (wanted("flatten")) {
+        report(options, measure(options, "flatten", input, none, [&] { metadata->Flatten(true); }));
+    }
+    if (wanted("search")) {
+        report(options, measure(options, "search", input, none, [&] { FieldSearch search(metadata->Categories()); }));
+    }
+    if (screen && wanted("render")) {
+        for (auto& category : metadata->Categories()) {
+            category.expanded = true;
+        }
+        RowModel rows(metadata->Categories());
+        report(options, measure(options, "render", input, none, [&] { renderAll(rows); }));
+    }
+    if (screen && wanted("keystroke")) {
+        const auto [category, field] = longestField(*metadata);
+        if (field != nullptr) {
+            metadata->Categories()[category].expanded = true;
+            RowModel rows(metadata->Categories());
+            const size_t index = rows.Find(category, field);
+            TextBuffer text;
+            text.Assign(toDisplayString(field->second));
+            text.Layout(COLS, field->first.length() + 4);
+            for (size_t row = text.Rows() / 2; row > 0; --row) {
+                text.Up();
+            }
+            report(options, measure(options, "keystroke", input, none, [&] {
+                text.Insert('x');
+                rows.SetHeight(index, text.Rows());
+                drawRow(rows, index, LINES / 2 - (long)text.CursorRow(), LINES, COLS, true, &text);
+                wnoutrefresh(stdscr);
+                doupdate();
+            }));
+        }
+    }
+    metadata.reset();
+
+    // saves work on copies, and copying hundreds of MB per iteration would only measure the copy
+    const bool writable = formatInfo(sniffFormat(input)).writable;
+    if (!writable || std::filesystem::file_size(input) > (64u << 20)) {
+        return;
+    }
+    const std::filesystem::path copy = options.work / ("copy_" + input.filename().string());
+    auto fresh = [&] {
+        metadata.reset();
+        std::filesystem::copy_file(input, copy, std::filesystem::copy_options::overwrite_existing);
+        metadata = std::make_unique<Metadata>(MappedFile::Open(copy), ReadMode::Full);
+    };
+
+    if (wanted("save")) {
+        report(options, measure(options, "save", input, [&] {
+            fresh();
+            metadata->Set("Exif.Image.DocumentName", "metoxid bench");
+        }, [&] { metadata->Save(); }));
+    }
+    if (wanted("patch")) {
+        fresh();
+        if (patchableField(*metadata) != nullptr) {
+            report(options, measure(options, "patch", input, [&] {
+                fresh();
+                auto* field = patchableField(*metadata);
+                metadata->Apply(*field, toDisplayString(field->second).substr(1));
+            }, [&] { metadata->Save(); }));
+        }
+    }
+    metadata.reset();
+    std::filesystem::remove(copy);
+}
+
+// Values of the shapes files actually carry, which Exiv2 must print back in a form
+// checkValue() accepts. Returns the number that don't, each reported on stderr.
+int checkRoundTrips() {
+    struct Case {
+        const char* key;
+        Exiv2::TypeId type;
+        const char* text;
+    };
+    static const Case cases[] = {
+        {"Exif.Photo.ExifVersion", Exiv2::undefined, "48 50 51 48"},
+        {"Exif.Photo.ExposureTime", Exiv2::unsignedRational, "0/0"},
+        {"Exif.Photo.ExposureBiasValue", Exiv2::signedRational, "-1/3"},
+        {"Exif.GPSInfo.GPSLatitude", Exiv2::unsignedRational, "0/0 0/0 0/0"},
+        {"Exif.Photo.LensSpecification", Exiv2::unsignedRational, "24/1 70/1 0/0 0/0"},
+        {"Exif.Photo.DateTimeOriginal", Exiv2::asciiString, "2024:01:31 13:45:00"},
+        {"Exif.Photo.DateTimeOriginal", Exiv2::asciiString, "    :  :     :  :  "},
+        {"Exif.GPSInfo.GPSDateStamp", Exiv2::asciiString, "    :  :  "},
+        {"Exif.Photo.UserComment", Exiv2::comment, "charset=Ascii hello"},
+        {"Iptc.Application2.DateCreated", Exiv2::date, "2024-01-31"},
+        {"Iptc.Application2.TimeCreated", Exiv2::time, "13:45:00+01:00"},
+        {"Iptc.Application2.TimeCreated", Exiv2::time, "13:45:00-05:30"},
+    };
+
+    int failures = 0;
+    for (const auto& test : cases) {
+        const TagSchema* tag = findTag(test.key);
+        const auto value = Exiv2::Value::create(test.type);
+        std::string error = tag == nullptr ? "no schema" : value->read(test.text) != 0 ? "Exiv2 can't read it" : "";
+        const std::string printed = error.empty() ? value->toString() : "";
+        if (error.empty()) {
+            error = checkValue(*tag, printed);
+        }
+        if (!error.empty()) {
+            std::fprintf(stderr, "metoxid_bench: roundtrip %s \"%s\" printed as \"%s\": %s\n", test.key, test.text,
+                         printed.c_str(), error.c_str());
+            failures++;
+        }
+    }
+    return failures;
+}
+
+int usage() {
+    std::fprintf(stderr,
+        "usage: metoxid_bench [options]\n"
+        "  --iterations N    timed runs per case (default 20)\n"
+        "  --filter TEXT     only cases or inputs whose name contains TEXT\n"
+        "  --images DIR      sample files (default the source tree's test_images)\n"
+        "  --work DIR        where stress files and save copies go (default $TMPDIR/metoxid_bench)\n"
+        "  --big-mb N        size of the big TIFF stress file, under 4096 (default 256)\n"
+        "  --no-stress       only the sample files\n"
+        "  --regenerate      write the stress files again\n"
+        "  --json            one JSON object per result instead of a table\n");
+    return 2;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--iterations" && has_value) {
+            options.iterations = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--filter" && has_value) {
+            options.filter = argv[++i];
+        } else if (arg == "--images" && has_value) {
+            options.images = argv[++i];
+        } else if (arg == "--work" && has_value) {
+            options.work = argv[++i];
+        } else if (arg == "--big-mb" && has_value) {
+            options.big_tiff_mb = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--no-stress") {
+            options.stress = false;
+        } else if (arg == "--regenerate") {
+            options.regenerate = true;
+        } else if (arg == "--json") {
+            options.json = true;
+        } else {
+            return usage();
+        }
+    }
+
+    Exiv2::XmpParser::initialize();
+    Exiv2::LogMsg::setLevel(Exiv2::LogMsg::mute);
+
+    std::vector<std::filesystem::path> inputs;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(options.images, ec)) {
+        if (entry.is_regular_file()) {
+            inputs.push_back(entry.path());
+        }
+    }
+    if (ec) {
+        std::fprintf(stderr, "metoxid_bench: can't read %s: %s\n", options.images.string().c_str(), ec.message().c_str());
+    }
+    std::sort(inputs.begin(), inputs.end()); // the same order every run
+
+    try {
+        std::filesystem::create_directories(options.work);
+        if (options.stress) {
+            const auto stress = generateStressFiles(options.work / "stress", options.big_tiff_mb, options.regenerate);
+            inputs.insert(inputs.end(), stress.begin(), stress.end());
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "metoxid_bench: failed to generate the stress files: %s\n", e.what());
+        return 1;
+    }
+
+    SCREEN* screen = openOffscreen();
+    if (screen == nullptr) {
+        std::fprintf(stderr, "metoxid_bench: no terminal description, skipping render\n");
+    }
+
+    if (!options.json) {
+        std::printf("%-10s %-34s %5s %10s %10s %10s %10s %11s %11s\n", "case", "input", "n", "p50 ms", "p90 ms", "p99 ms", "max ms", "allocs/op", "KB/op");
+    }
+
+    int status = 0;
+    if (checkRoundTrips() != 0) {
+        status = 1;
+    }
+    for (const auto& input : inputs) {
+        try {
+            benchFile(options, input, screen != nullptr);
+        } catch (const std::exception& e) { // a file Exiv2 can't read is a result too, not the end of the run
+            std::fprintf(stderr, "metoxid_bench: %s: %s\n", input.filename().string().c_str(), e.what());
+            status = 1;
+        }
+    }
+
+    if (screen != nullptr) {
+        endwin();
+        delscreen(screen);
+    }
+    return status;
+}
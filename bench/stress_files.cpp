@@ -0,0 +1,153 @@
+#include "stress_files.hpp"
+#include <exiv2/exiv2.hpp>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+void put16(std::string& out, uint16_t value) {
+    out.push_back(char(value & 0xff));
+    out.push_back(char(value >> 8));
+}
+
+void put32(std::string& out, uint32_t value) {
+    put16(out, uint16_t(value & 0xffff));
+    put16(out, uint16_t(value >> 16));
+}
+
+// A little-endian, uncompressed 8-bit grayscale TIFF in one strip, written by hand so that
+// a file of several hundred MB doesn't have to pass through Exiv2. The pixels are left to
+// resize_file(), which leaves them as a hole on file systems that support it. Classic TIFF
+// offsets and counts are 32-bit, so the whole file has to stay under 4 GB.
+void writeTiff(const std::filesystem::path& path, uint64_t width, uint64_t height) {
+    struct Tag {
+        uint16_t tag;
+        uint16_t type; // 2 ASCII, 3 SHORT, 4 LONG
+        uint32_t value; // for ASCII, the index into strings
+    };
+    const std::string strings[] = {"metoxid", "bench", "2024:01:01 00:00:00"};
+    const size_t count = 12;
+    const uint32_t ifd_size = uint32_t(2 + count * 12 + 4);
+    uint32_t strings_offset = 8 + ifd_size;
+    uint32_t pixels_offset = strings_offset;
+    for (const auto& text : strings) {
+        pixels_offset += uint32_t(text.size() + 1);
+    }
+
+    if (width == 0 || height == 0 || width > UINT32_MAX || height > UINT32_MAX / width || width * height > UINT32_MAX - pixels_offset) {
+        throw std::invalid_argument("a " + std::to_string(width) + "x" + std::to_string(height) + " TIFF doesn't fit in 32-bit offsets");
+    }
+    const uint64_t pixels = width * height;
+    const Tag tags[count] = {
+        {256, 4, uint32_t(width)}, {257, 4, uint32_t(height)}, {258, 3, 8}, {259, 3, 1}, {262, 3, 1}, {271, 2, 0}, {272, 2, 1},
+        {273, 4, 0}, {277, 3, 1}, {278, 4, uint32_t(height)}, {279, 4, uint32_t(pixels)}, {306, 2, 2},
+    };
+
+    std::string out = "II*";
+    out.push_back('\0');
+    put32(out, 8);
+    put16(out, uint16_t(count));
+    for (const auto& tag : tags) {
+        put16(out, tag.tag);
+        put16(out, tag.type);
+        if (tag.type == 2) {
+            put32(out, uint32_t(strings[tag.value].size() + 1));
+            uint32_t offset = strings_offset;
+            for (uint32_t i = 0; i < tag.value; ++i) {
+                offset += uint32_t(strings[i].size() + 1);
+            }
+            put32(out, offset);
+        } else {
+            put32(out, 1);
+            put32(out, tag.tag == 273 ? pixels_offset : tag.value); // SHORTs sit in the low half either way
+        }
+    }
+    put32(out, 0); // no next IFD
+    for (const auto& text : strings) {
+        out += text;
+        out.push_back('\0');
+    }
+
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(out.data(), std::streamsize(out.size()));
+        if (!file) {
+            throw std::runtime_error("failed to write " + path.string());
+        }
+    }
+    std::filesystem::resize_file(path, uint64_t(pixels_offset) + pixels);
+}
+
+// Deterministic filler text, so values don't compress to nothing and don't vary between runs
+std::string filler(size_t size) {
+    static const char words[] = "lorem ipsum dolor sit amet consectetur adipiscing elit sed do eiusmod tempor ";
+    std::string text;
+    text.reserve(size);
+    while (text.size() < size) {
+        text.append(words, std::min(sizeof(words) - 1, size - text.size()));
+    }
+    return text;
+}
+
+void addMetadata(const std::filesystem::path& path, const std::function<void(Exiv2::Image&)>& edit) {
+    auto image = Exiv2::ImageFactory::open(path.string());
+    image->readMetadata();
+    edit(*image);
+    image->writeMetadata();
+}
+
+} // namespace
+
+std::vector<std::filesystem::path> generateStressFiles(const std::filesystem::path& dir, size_t big_tiff_mb, bool regenerate) {
+    std::filesystem::create_directories(dir);
+    if (big_tiff_mb >= 4096) {
+        throw std::invalid_argument("the big TIFF has to stay under 4096 MB, classic TIFF offsets are 32-bit");
+    }
+    Exiv2::XmpProperties::registerNs("https://metoxid.invalid/bench/", "bench");
+
+    const std::string big_name = "big_" + std::to_string(big_tiff_mb) + "mb.tif";
+    const std::pair<std::string, std::function<void(const std::filesystem::path&)>> files[] = {
+        {"many_xmp.tif", [](const std::filesystem::path& path) {
+            writeTiff(path, 64, 64);
+            addMetadata(path, [](Exiv2::Image& image) {
+                for (int i = 0; i < 5000; ++i) {
+                    image.xmpData()["Xmp.bench.Property" + std::to_string(i)] = "value " + std::to_string(i);
+                }
+            });
+        }},
+        {"huge_xmp.tif", [](const std::filesystem::path& path) {
+            writeTiff(path, 64, 64);
+            addMetadata(path, [](Exiv2::Image& image) {
+                image.xmpData()["Xmp.dc.description"] = filler(8 << 20);
+            });
+        }},
+        {"long_makernote.tif", [](const std::filesystem::path& path) {
+            writeTiff(path, 64, 64);
+            addMetadata(path, [](Exiv2::Image& image) {
+                const std::string note = filler(4 << 20);
+                Exiv2::DataValue value(Exiv2::undefined);
+                value.read(reinterpret_cast<const Exiv2::byte*>(note.data()), note.size(), Exiv2::littleEndian);
+                image.exifData().add(Exiv2::ExifKey("Exif.Photo.MakerNote"), &value); // Make is "metoxid", so Exiv2 keeps it as a blob
+            });
+        }},
+        {big_name, [big_tiff_mb](const std::filesystem::path& path) {
+            writeTiff(path, 1024, uint64_t(big_tiff_mb) * 1024);
+        }},
+    };
+
+    std::vector<std::filesystem::path> paths;
+    for (const auto& file : files) {
+        const std::filesystem::path path = dir / file.first;
+        if (regenerate || !std::filesystem::exists(path)) {
+            std::filesystem::path temporary = path;
+            temporary += ".tmp";
+            file.second(temporary);
+            std::filesystem::rename(temporary, path); // an interrupted run doesn't leave a half-written file to be reused
+        }
+        paths.push_back(path);
+    }
+    return paths;
+}
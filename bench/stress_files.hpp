@@ -0,0 +1,17 @@
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <vector>
+
+// Writes the synthetic files metoxid_bench stresses the readers and writers with into dir,
+// unless they're already there (or regenerate is set), and returns their paths. The
+// contents only depend on the arguments, so every run measures the same bytes:
+//
+//   many_xmp.tif        5000 XMP properties
+//   huge_xmp.tif        one 8 MB XMP value
+//   long_makernote.tif  a 4 MB maker note
+//   big_<N>mb.tif       big_tiff_mb MB of (sparse) pixel data behind a few Exif tags
+//
+// big_tiff_mb has to be under 4096, a classic TIFF can't address more.
+// throws std::exception
+std::vector<std::filesystem::path> generateStressFiles(const std::filesystem::path& dir, size_t big_tiff_mb, bool regenerate);
@@ -11,4 +11,26 @@
 #endif
 
 #include <metoxid/utils.hpp>
+#include <metoxid/file_io.hpp>
+#include <metoxid/native_reader.hpp>
 #include <metoxid/metadata.hpp>
+#include <metoxid/thread_pool.hpp>
+#include <metoxid/batch.hpp>
+#include <metoxid/prefetch.hpp>
+#include <metoxid/metadata_index.hpp>
+#include <metoxid/row_model.hpp>
+#include <metoxid/field_search.hpp>
+#include <metoxid/query.hpp>
+#include <metoxid/edit_session.hpp>
+#include <metoxid/save_queue.hpp>
+#include <metoxid/directory_listing.hpp>
+#include <metoxid/file_format.hpp>
+#include <metoxid/row_view.hpp>
+#include <metoxid/trace.hpp>
+#include <metoxid/text_buffer.hpp>
+#include <metoxid/xmp_tree.hpp>
+#include <metoxid/fingerprint.hpp>
+#include <metoxid/preview.hpp>
+#include <metoxid/field_map.hpp>
+#include <metoxid/tag_schema.hpp>
+#include <metoxid/server.hpp>
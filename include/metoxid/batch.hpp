@@ -0,0 +1,52 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Headless entry points. These never touch ncurses and report per-file
+// failures in their output instead of exiting; the return value is the
+// process exit status.
+
+class MetadataIndex;
+class ThreadPool;
+
+// What a long-running process (metoxid serve) shares between the runs it makes.
+struct BatchContext {
+    MetadataIndex* index = nullptr; // used by runs that weren't given --index of their own
+    ThreadPool* pool = nullptr; // every run's files are read on it, -j is ignored
+};
+
+// metoxid dump [-j N] [--stats] [--fast] [--index[=DIR]] [--xmp-packet] <dir|files...>
+// Prints one JSON object per file (JSON Lines) to stdout. --fast uses the
+// built-in reader (common Exif tags only) for the files it supports.
+int runDump(const std::vector<std::string>& args, const BatchContext& context = {});
+
+// metoxid query [-j N] [--stats] [--fast] [--index[=DIR]] [--json] '<expr>' [dir|files...]
+// Prints the path of every file matching the expression (see Query) as soon as
+// it's known, or {"path":...} lines with --json. Searches the current directory
+// when no inputs are given. Exits with 0 if anything matched, 1 if nothing did.
+int runQuery(const std::vector<std::string>& args, const BatchContext& context = {});
+
+// metoxid dupes [-j N] [--stats] [--fast] [--index[=DIR]] [--keys K1,K2,Prefix.*] [--json] <dir|files...>
+// Fingerprints the fields of every file (all of them, or the --keys selection, see
+// KeySelection) and prints the groups of files with equal fingerprints once every
+// file was read: one path per line and an empty line between groups, or one
+// {"fingerprint":...,"paths":[...]} line per group with --json. Exits with 0 if
+// any duplicates were found, 1 if none were.
+int runDupes(const std::vector<std::string>& args, const BatchContext& context = {});
+
+// metoxid previews [-j N] [--stats] [--fast] [--largest] (-o DIR | --stdout) <dir|files...>
+// Extracts the previews and thumbnails embedded in every file as they are stored, without
+// decoding them (see readPreviews): into DIR, at the file's path, as <name>.preview<N><ext>,
+// smallest first, and prints {"path":...,"previews":[...]} for every file. With --stdout
+// the images go back to back to stdout and the lines to stderr, each preview with the
+// offset of its bytes in what the run wrote to stdout. --largest keeps only the
+// largest preview of each file, --fast only asks the built-in reader where it can.
+// Exits with 1 if any file failed.
+int runPreviews(const std::vector<std::string>& args, const BatchContext& context = {});
+
+// metoxid set [-j N] [--stats] Key=Value... [--delete Key]... <dir|files...>
+// Applies the same edits to every file, keys as Metadata::Set() takes them. Values of
+// the standard tags are checked against their TagSchema before any file is opened.
+// Prints {"path":...} for every file written and an error line for every file that
+// wasn't. Exits with 1 if any file failed.
+int runSet(const std::vector<std::string>& args, const BatchContext& context = {});
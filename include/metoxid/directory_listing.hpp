@@ -0,0 +1,126 @@
+#pragma once
+#include <metoxid/file_format.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+// The entries of one directory, read a batch at a time so the browser can draw the first
+// screen before a huge directory has been read to the end. Each entry's type comes from
+// the directory read itself (d_type where the platform has it); size and mtime are only
+// stat'ed when they're needed, and cached. Formats are sniffed on a worker pool and merged in as they
+// arrive. Sorting and filtering apply to the entries read so far and to every entry read later, without
+// listing the directory again.
+class DirectoryListing {
+public:
+    enum class Type { Directory, File, Other };
+    enum class SortKey { None, Name, Size, Mtime, Type }; // None keeps the directory's own order
+
+    struct Entry {
+        std::string name; // ".." for the parent, always shown first
+        Type type;
+        bool stated = false; // size and mtime are valid
+        uint64_t size = 0;
+        int64_t mtime_ns = 0;
+        bool sniffed = false; // format is valid
+        bool queued = false; // handed to the pool, the format arrives later
+        FileFormat format = FileFormat::Unknown;
+    };
+
+    // Formats are sniffed on pool, which must outlive the listing's tasks; the listing
+    // itself may go away while they run.
+    DirectoryListing(const std::filesystem::path& dir, ThreadPool& pool);
+    ~DirectoryListing();
+
+    DirectoryListing(const DirectoryListing&) = delete;
+    DirectoryListing& operator=(const DirectoryListing&) = delete;
+
+    const std::filesystem::path& Dir() const {
+        return this->dir_;
+    }
+
+    // Reads up to max_entries more entries, false once the directory has been read to the end.
+    bool ReadMore(size_t max_entries);
+
+    bool Complete() const {
+        return this->complete_;
+    }
+
+    const std::string& Error() const { // why the directory couldn't be read to the end, if it couldn't
+        return this->error_;
+    }
+
+    // The entries that pass the filter, in sort order
+    size_t Size() const {
+        return this->view_.size();
+    }
+
+    const Entry& At(size_t index) const {
+        return this->entries_[this->view_[index]];
+    }
+
+    std::filesystem::path PathAt(size_t index) const;
+
+    // Fills in size and mtime if they weren't yet, e.g. for the rows on screen.
+    const Entry& Stat(size_t index);
+
+    // Hands files read so far to the pool, the count in view from first on ahead of the
+    // rest (e.g. the rows on screen), and merges the formats that came back. Never blocks.
+    // True if any came back, i.e. the view may have changed.
+    bool SniffMore(size_t first = 0, size_t count = 0);
+
+    bool Sniffing() const { // files left to hand to the pool, or whose format hasn't come back
+        return this->sniff_next_ < this->entries_.size() || this->sniff_pending_ > 0;
+    }
+
+    size_t Media() const { // files sniffed as a format Exiv2 reads
+        return this->media_;
+    }
+
+    size_t ReadOnly() const { // the ones it can't write back
+        return this->read_only_;
+    }
+
+    size_t Total() const { // entries read so far, without the parent
+        return this->entries_.size() - (this->has_parent_ ? 1 : 0);
+    }
+
+    SortKey Sorting() const {
+        return this->sort_;
+    }
+
+    void Sort(SortKey key); // sizes and mtimes are filled in for every entry when sorting by them, formats as they arrive
+    void Filter(const std::string& text); // case-insensitive substring of the name, empty shows everything
+private:
+    std::filesystem::path dir_;
+    std::filesystem::directory_iterator it_;
+    bool complete_ = false;
+    std::string error_;
+
+    std::vector<Entry> entries_; // in the order they were read
+    std::vector<uint32_t> view_; // indices into entries_
+    bool has_parent_ = false;
+    size_t media_ = 0;
+    size_t read_only_ = 0;
+
+    SortKey sort_ = SortKey::None;
+    std::string filter_; // lowercase
+
+    struct SniffResults; // shared with the pool's tasks
+    ThreadPool& pool_;
+    std::shared_ptr<SniffResults> results_;
+    size_t sniff_next_ = 0; // entries_ before this have been handed to the pool or need no sniffing
+    size_t sniff_pending_ = 0; // files handed to the pool whose format hasn't been merged
+
+    bool Matches(const Entry& entry) const;
+    bool Before(uint32_t a, uint32_t b) const;
+    void StatEntry(Entry& entry) const;
+    void Fill(Entry& entry); // what the sort key needs
+    bool Queue(std::vector<uint32_t> batch); // false if the pool's queue is full
+    bool Merge();
+    void Rebuild();
+};
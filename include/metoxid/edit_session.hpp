@@ -0,0 +1,64 @@
+#pragma once
+#include <metoxid/metadata.hpp>
+#include <metoxid/tag_schema.hpp>
+#include <metoxid/text_buffer.hpp>
+#include <metoxid/xmp_tree.hpp>
+#include <string>
+
+// The field being edited in the editor. Keystrokes only change the text buffer; the
+// field, and the block of the file it belongs to, only change when the edit is committed.
+class EditSession {
+public:
+    explicit EditSession(Metadata& metadata) : metadata_(metadata) {}
+
+    // Starts editing a field from metadata.Categories(), with its current value as the text.
+    void Begin(FieldMap::value_type& field);
+
+    // Starts editing a leaf of the packet's tree. Committing splices the value into the
+    // tree's packet and applies that to the packet's field.
+    void Begin(XmpTree& tree, size_t node, FieldMap::value_type& packet);
+
+    bool Active() const {
+        return this->field_ != nullptr;
+    }
+
+    FieldMap::value_type* Field() const {
+        return this->field_;
+    }
+
+    TextBuffer& Text() {
+        return this->text_;
+    }
+
+    // The edited tag's schema, null for fields it doesn't cover and for packet nodes.
+    const TagSchema* Schema() const {
+        return this->schema_;
+    }
+
+    // Types ch at the cursor, unless the tag's values can't contain it. Returns whether it was typed.
+    bool Type(char ch);
+
+    // Replaces the text with the next (delta > 0) or previous value of a number or an
+    // enumeration. False if the tag has no such steps, the text is left alone.
+    bool Step(int delta);
+
+    // Why the text isn't a valid value, checked against the schema only, so it can run
+    // after every keystroke. Empty when it's valid or there's no schema.
+    std::string Problem() const;
+
+    // Applies the text to the field through Metadata::Apply() and ends the session.
+    // Throws MetadataError if the text isn't a valid value, the session stays active and
+    // neither the field nor the packet's tree has changed.
+    void Commit();
+
+    // Ends the session, the field keeps its old value.
+    void Cancel();
+private:
+    Metadata& metadata_;
+    FieldMap::value_type* field_ = nullptr;
+    const TagSchema* schema_ = nullptr;
+    XmpTree* tree_ = nullptr; // set when a tree node is edited
+    size_t node_ = XmpTree::kRoot;
+    TextBuffer text_;
+    std::string original_; // the value as text when editing began
+};
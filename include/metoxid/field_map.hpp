@@ -0,0 +1,114 @@
+#pragma once
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+namespace Exiv2 {
+class Value;
+}
+
+// Strings are views into a StringArena (or, while a source visits them, into whatever the
+// source read them from); Exiv2 values are referenced where the image keeps them.
+using MetadataValue = std::variant<std::string_view, std::reference_wrapper<const Exiv2::Value>>;
+using FieldVisitor = std::function<void(const std::string& key, const MetadataValue& value)>;
+
+// The one copy of a metadata key for the whole process, so every file's fields point at
+// the same strings instead of allocating their own. Nothing is ever freed, so it's only
+// for the keys isKnownKey() accepts, of which there are a few thousand at most; use
+// StringArena::Key(). Thread-safe; the reference stays valid until exit.
+const std::string& internKey(std::string_view key);
+
+// Whether the key comes from a fixed table: Exif and IPTC tags Exiv2 has a name for, and
+// metoxid's own "Comment" and "XMP Packet". XMP keys
+// aren't, their array indices ("Xmp.xmpMM.History[123]/stEvt:when") and custom schemas
+// have no end, and neither are tags Exiv2 only knows by number ("Exif.Image.0x9999").
+bool isKnownKey(std::string_view key);
+
+// Bump allocator for the strings of one file: a copy is a pointer bump into the current
+// block and everything is freed at once with the arena. Small strings are never freed
+// before that, so an edit that replaces one leaves the old one behind until the file is
+// closed; large ones (the XMP packet) get a block of their own that Replace() frees.
+class StringArena {
+public:
+    StringArena() = default;
+    StringArena(const StringArena&) = delete;
+    StringArena& operator=(const StringArena&) = delete;
+
+    std::string_view Copy(std::string_view text);
+
+    // internKey() for a known key, otherwise a copy that lives as long as the arena.
+    const std::string& Key(std::string_view key);
+
+    // Copy(), and frees old if it has a block of its own. Nothing may point into old anymore.
+    std::string_view Replace(std::string_view old, std::string_view text);
+
+    // Bytes held in blocks, used or not, and in copied keys.
+    size_t Allocated() const {
+        return this->allocated_;
+    }
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+        bool shared; // bumped into, rather than holding one large string
+    };
+
+    std::vector<Block> blocks_;
+    std::deque<std::string> keys_; // the keys that aren't interned, a deque never moves them
+    char* next_ = nullptr;
+    size_t left_ = 0;
+    size_t block_size_ = 1024; // doubles with every block, up to 64 KB
+    size_t allocated_ = 0;
+};
+
+// A field: its key, interned or in the arena, and its value.
+struct Field {
+    const std::string& first;
+    MetadataValue second;
+};
+
+// The fields of one category, sorted by key in a single array. A repeated key is kept
+// once, the first one visited. Built once and then only changed in place (Metadata::Apply()),
+// so pointers to fields stay valid for as long as the map lives.
+class FieldMap {
+public:
+    using value_type = Field;
+    using iterator = std::vector<Field>::iterator;
+    using const_iterator = std::vector<Field>::const_iterator;
+
+    // Visits the source and copies its strings into arena, keys with StringArena::Key().
+    FieldMap(const std::function<void(const FieldVisitor&)>& source, StringArena& arena);
+
+    iterator begin() {
+        return this->fields_.begin();
+    }
+
+    iterator end() {
+        return this->fields_.end();
+    }
+
+    const_iterator begin() const {
+        return this->fields_.begin();
+    }
+
+    const_iterator end() const {
+        return this->fields_.end();
+    }
+
+    size_t size() const {
+        return this->fields_.size();
+    }
+
+    iterator find(std::string_view key);
+    const_iterator find(std::string_view key) const;
+
+    // throws std::out_of_range if the key isn't there
+    const MetadataValue& at(std::string_view key) const;
+private:
+    std::vector<Field> fields_;
+};
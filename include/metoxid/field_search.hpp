@@ -0,0 +1,51 @@
+#pragma once
+#include <metoxid/metadata.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Case-insensitive search over every field's key and display string, built once per
+// Metadata. Each space separated term of a query has to appear in the key or the value.
+//
+// Candidates come from a trigram index (the shortest posting list of any term's
+// trigrams) and are then checked directly. A query that extends the previous one,
+// which is what typing does, only re-checks the previous matches.
+class FieldSearch {
+public:
+    struct Entry {
+        size_t category; // index into Metadata::Categories()
+        FieldMap::value_type* field;
+        std::string display; // the value on one line, as the editor draws it
+        std::string text; // lowercase key, a newline, lowercase display
+    };
+
+    // Builds the fields of every category.
+    explicit FieldSearch(std::vector<Category>& categories);
+
+    size_t Size() const {
+        return this->entries_.size();
+    }
+
+    const Entry& At(uint32_t id) const {
+        return this->entries_[id];
+    }
+
+    // Entry ids in category then key order. The reference is valid until the next call.
+    const std::vector<uint32_t>& Find(std::string_view query);
+
+    // Indexes a field's value again after it was edited.
+    void Refresh(const FieldMap::value_type* field);
+private:
+    std::vector<Entry> entries_;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> trigrams_;
+    std::unordered_map<const FieldMap::value_type*, uint32_t> ids_;
+
+    bool searched_ = false;
+    std::string last_query_;
+    std::vector<uint32_t> last_matches_;
+
+    void Index(uint32_t id);
+};
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <string_view>
+
+// The formats Exiv2 reads metadata from, as told apart by their first bytes.
+enum class FileFormat {
+    Unknown,
+    Jpeg,
+    Tiff, // also DNG, NEF, PEF, ARW, SR2 and the other raws built on plain TIFF
+    Cr2,
+    Orf,
+    Rw2,
+    Crw,
+    Raf,
+    Mrw,
+    Png,
+    Gif,
+    WebP,
+    Psd,
+    Bmp,
+    Jp2,
+    Jxl,
+    Heif,
+    Avif,
+    Cr3,
+    QuickTime, // MP4, MOV and other ISO-BMFF files that aren't images
+    Matroska,
+    Asf,
+    Riff, // AVI
+    Eps,
+    Pgf,
+    Xmp, // sidecars
+    Exv,
+};
+
+struct FormatInfo {
+    const char* name; // short, for the browser listing
+    bool writable; // Exiv2 can write metadata back into it
+};
+
+const FormatInfo& formatInfo(FileFormat format);
+
+// Enough of the start of a file for detectFormat() to tell every format apart.
+constexpr size_t kSniffBytes = 16;
+
+FileFormat detectFormat(std::string_view header);
+
+// detectFormat() over one small read of the file, Unknown if it can't be read.
+FileFormat sniffFormat(const std::filesystem::path& path);
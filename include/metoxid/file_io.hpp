@@ -0,0 +1,108 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Identifies one version of a file: cached or indexed metadata is only valid
+// for the stamp it was read with.
+struct FileStamp {
+    uint64_t inode = 0; // 0 where the platform has none
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+
+    static std::optional<FileStamp> Of(const std::filesystem::path& path); // nullopt if it can't be stat'ed
+
+    bool operator==(const FileStamp& other) const {
+        return this->inode == other.inode && this->size == other.size && this->mtime_ns == other.mtime_ns;
+    }
+};
+
+// Read-only memory mapping of a whole file. Nothing is read up front: pages are
+// faulted in as they're touched, so parsing a few KB of metadata out of a
+// multi-hundred-MB file only costs those few KB of I/O. One mapping is shared
+// between header sniffing and metadata parsing.
+class MappedFile {
+public:
+    // throws std::system_error
+    static std::shared_ptr<const MappedFile> Open(const std::filesystem::path& path);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* Data() const {
+        return this->data_;
+    }
+
+    size_t Size() const {
+        return this->size_;
+    }
+
+    const std::filesystem::path& Path() const {
+        return this->path_;
+    }
+
+    // The file as it was when it was mapped, what in-place writes check it still is.
+    const FileStamp& Stamp() const {
+        return this->stamp_;
+    }
+
+    // Starts reading the whole file in the background, for callers that are about to
+    // touch all of it (rewriting the file) and have other work to do meanwhile.
+    void Prefetch() const;
+
+    // The first n bytes, or fewer if the file is shorter.
+    std::string_view Header(size_t n) const {
+        return std::string_view(reinterpret_cast<const char*>(this->data_), n < this->size_ ? n : this->size_);
+    }
+
+private:
+    MappedFile() = default;
+
+    std::filesystem::path path_;
+    FileStamp stamp_;
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+#if defined(_WIN32)
+    void* mapping_ = nullptr;
+#endif
+};
+
+// Writes data to a temporary file next to path, flushes it to disk and renames it
+// over path, so readers see either the old or the new file and never a torn one.
+// Symlinks are followed, so the link stays and its target is replaced; the new file
+// keeps the old one's mode, owner (where allowed) and extended attributes. A file with
+// several hard links is split off from the others, as with any atomic replace.
+// throws std::system_error
+void writeFileAtomically(const std::filesystem::path& path, const uint8_t* data, size_t size);
+
+// Creates or truncates path and writes data to it, without a temporary file or a flush:
+// for new files of our own (extracted previews), where a torn file is just written again.
+// throws std::system_error
+void writeFile(const std::filesystem::path& path, const uint8_t* data, size_t size);
+
+// Bytes to overwrite at an offset of an existing file.
+struct FilePatch {
+    uint64_t offset;
+    std::string bytes;
+};
+
+// Overwrites just the patched ranges with positioned writes and flushes them to disk, and
+// returns the file's stamp afterwards. Refuses (ESTALE) if the file isn't the expected
+// one anymore: another inode, size or mtime means another writer replaced or changed it
+// since the offsets were worked out. Not atomic: a crash mid-way can leave some patches
+// applied, so callers only patch values that are valid on their own, like a NUL-padded
+// string in its old slot.
+// throws std::system_error
+FileStamp patchFile(const std::filesystem::path& path, const FileStamp& expected, const std::vector<FilePatch>& patches);
+
+// Reads up to n bytes from the start of a file with one positioned read, without mapping
+// it; fewer if the file is shorter. For sniffing many files, where a mapping costs more
+// than the read. throws std::system_error
+std::string readFileHeader(const std::filesystem::path& path, size_t n);
@@ -0,0 +1,30 @@
+#pragma once
+#include <metoxid/metadata.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// 64-bit XXH64 of size bytes. Four independent lanes consume 32 bytes per round, so the
+// multiplies of one round overlap and hashing runs far faster than a file can be read.
+uint64_t hash64(const void* data, size_t size, uint64_t seed = 0);
+
+// Which keys a fingerprint covers: a comma separated list of keys, where a trailing *
+// matches every key with that prefix ("Exif.Photo.DateTimeOriginal,Exif.Image.Model,Xmp.*").
+// The empty list covers every key.
+class KeySelection {
+public:
+    explicit KeySelection(std::string_view list = {});
+
+    bool Matches(const std::string& key) const;
+private:
+    std::vector<std::string> keys_;
+    std::vector<std::string> prefixes_;
+};
+
+// A fingerprint of the selected fields, independent of the order Exiv2 or the file stored
+// them in: the fields are hashed in key order (Flatten() sorts them) with values trimmed of
+// trailing padding. Nullopt when none of the selected keys are there.
+std::optional<uint64_t> fingerprintFields(const FieldList& fields, const KeySelection& keys);
@@ -1,56 +1,172 @@
 #pragma once
+#include <bitset>
 #include <filesystem>
+#include <functional>
+#include <optional>
+#include <stdexcept>
 #include <variant>
 #include <unordered_map>
+#include <unordered_set>
 #include <exiv2/exiv2.hpp>
+#include <metoxid/field_map.hpp>
+#include <metoxid/file_io.hpp>
 
-using MetadataValue = std::variant<std::string, std::reference_wrapper<const Exiv2::Value>>;
+using FieldList = std::vector<std::pair<std::string, std::string>>; // key, display string
+
+std::string toDisplayString(const MetadataValue& value);
+
+// Thrown when a file can't be opened or its metadata can't be parsed.
+class MetadataError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// A named group of fields. Exiv2 values are referenced, not copied, and the field
+// map is only built the first time Fields() is called (i.e. when the category is expanded).
+// Its strings go into the file's arena.
+class Category {
+public:
+    using Source = std::function<void(const FieldVisitor&)>;
 
-struct Category {
     std::string name;
     bool expanded;
-    std::unordered_map<std::string, MetadataValue> fields;
 
-    Category(const std::string& name, const std::unordered_map<std::string, MetadataValue>& fields) {
+    Category(const std::string& name, Source source, StringArena& arena) {
         this->name = name;
         this->expanded = false;
-        this->fields = fields;
+        this->source_ = std::move(source);
+        this->arena_ = &arena;
+    }
+
+    FieldMap& Fields();
+    const FieldMap& Fields() const;
+
+    bool Loaded() const {
+        return this->fields_.has_value();
     }
+
+    // Drops the field map, it's built again from the source on the next Fields().
+    void Reset() {
+        this->fields_.reset();
+    }
+
+    // Visits every field without building the map, unless it's already built
+    // (in which case the map, with any edits made through it, is visited).
+    void ForEachField(const FieldVisitor& visit) const;
+
+private:
+    Source source_;
+    StringArena* arena_;
+    mutable std::optional<FieldMap> fields_;
+};
+
+enum class ReadMode {
+    Full, // Exiv2 readMetadata(), every tag, editable
+    Fast, // the built-in reader's common Exif tags where it handles the file, read-only; Full otherwise
 };
 
 class Metadata {
 public:
-    Metadata(const std::filesystem::path& file);
+    Metadata(const std::filesystem::path& file, ReadMode mode = ReadMode::Full); // throws MetadataError
+    Metadata(std::shared_ptr<const MappedFile> file, ReadMode mode = ReadMode::Full); // parses straight out of an existing mapping
+
+    // categories refer back into this object, so it can't be copied or moved
+    Metadata(const Metadata&) = delete;
+    Metadata& operator=(const Metadata&) = delete;
 
-    std::vector<Category> GetDict() const {
+    std::vector<Category>& Categories() {
         return this->metadata_;
     }
 
-    void SetDict(const std::vector<Category>& dict) {
-        this->metadata_ = dict;
+    const std::vector<Category>& Categories() const {
+        return this->metadata_;
     }
 
-    void Save();
+    // Every field as a display string, sorted by key, with repeated keys reported once.
+    // The XMP Packet category repeats XMP Data unparsed, so it's left out unless asked for.
+    FieldList Flatten(bool with_xmp_packet = false) const;
+
+    // False when the built-in reader was used, writes always go through Exiv2.
+    bool Editable() const {
+        return this->image_ != nullptr;
+    }
+
+    // Sets or removes a field by its Exiv2 key (Exif.*, Iptc.*, Xmp.*) or "Comment",
+    // the same keys Flatten() reports. The category the key belongs to is reset, so
+    // field references taken from it before are no longer valid. Values of the standard
+    // tags are checked against their TagSchema first. Throws MetadataError.
+    void Set(const std::string& key, const std::string& value);
+    bool Erase(const std::string& key); // false if the key wasn't there
+
+    // Replaces a field from Fields() with typed text, in place, so references into the
+    // categories stay valid. Exiv2 values are checked against their TagSchema and parsed
+    // as their own type first; text that doesn't pass throws MetadataError and leaves the
+    // value as it was.
+    void Apply(FieldMap::value_type& field, const std::string& text);
+
+    // Records that the value of an Exif, IPTC or XMP field was changed in place, through
+    // a reference from Fields(). Set(), Erase() and Apply() keep track of their own changes.
+    void MarkEdited(const std::string& key) {
+        this->edited_keys_.insert(key);
+        this->dirty_.set(BlockOf(key));
+    }
+
+    // True if anything was edited since the file was read or last written.
+    bool Dirty() const {
+        return this->dirty_.any();
+    }
+
+    // Writes the edited metadata out. When every edit still fits where the old value was
+    // stored (an Exif string no longer than before, an XMP packet within its padding) only
+    // those bytes are overwritten; otherwise the whole file is rewritten through a
+    // temporary file that replaces the original. Nothing is encoded or written if nothing
+    // is dirty.
+    void Save() {
+        this->Encode();
+        this->WriteFile();
+    }
+
+    // Save() in two steps, so batch modes can run the CPU-bound encoding and the file
+    // write on different threads. Encode() builds the new file in memory, or just the
+    // patches when they'll do.
+    void Encode();
+    void WriteFile();
 private:
+    // The separately stored parts of a file an edit can touch
+    enum Block { CommentBlock, ExifBlock, IptcBlock, XmpBlock, XmpPacketBlock, BlockCount };
+
+    std::shared_ptr<const MappedFile> file_;
+
+    // Reads through a MemIo over file_, so Exiv2 never opens the file itself.
+    // Exif, IPTC and XMP data, the comment and the XMP packet all stay in the image;
+    // categories only hold references to them.
     std::unique_ptr<Exiv2::Image> image_;
-    
-    std::string comment_;
-    Exiv2::ExifData exif_data_;
-    Exiv2::DataBuf icc_profile_;
-    Exiv2::IptcData iptc_data_;
-    Exiv2::XmpData xmp_data_;
-    std::string xmp_packet_;
+
+    // The strings of the categories, and of the built-in reader's fields, freed with the file.
+    // Declared before everything pointing into it.
+    StringArena arena_;
+
+    // Owned values for files read by the built-in reader instead of Exiv2.
+    std::vector<std::pair<const std::string*, std::string_view>> native_exif_; // key and value from arena_
+    std::string native_comment_;
+    std::string native_xmp_packet_;
+    mutable std::optional<Exiv2::XmpData> native_xmp_data_; // decoded from the packet on first use
 
     std::vector<Category> metadata_;
 
-    // og values are impractical for editing
-    // dict is not
-    // image <- og values only
-    // og values -> dict(editing) -> og values -> image file(saving)
+    std::unordered_set<std::string> edited_keys_; // values changed where they are
+    std::bitset<BlockCount> dirty_; // blocks with edits that haven't been written yet
+    bool restructured_ = false; // fields were added or removed, or the mapping no longer matches the file
+    std::optional<std::vector<FilePatch>> patches_; // planned by Encode() when the edits fit in place
+    FileStamp stamp_; // the file on disk as the patches expect it: as mapped, then as last patched
 
-    // FormatType = { Comment, ExifDataField, IccProfileField, etc. }
-    // FieldDecription { FieldType, FormatType };
-    // Dict = Dictionary<FieldName, Pair<FieldDescription, FieldValue>>
-    // Dict GetMetadata() { comment_ + exif_data_ + icc_proile_ + ... }
+    bool ReadNative();
+    void ReadWithExiv2();
+    const Exiv2::XmpData& NativeXmpData() const;
+    const Category* FindCategory(const std::string& name) const;
+    Category* CategoryForKey(const std::string& key);
+    void RequireEditable() const;
+    static void RequireValid(const std::string& key, const std::string& value);
+    static Block BlockOf(const std::string& key);
+    std::optional<std::vector<FilePatch>> PlanPatches(const std::optional<std::string>& packet) const;
 };
-
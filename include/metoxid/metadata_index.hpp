@@ -0,0 +1,75 @@
+#pragma once
+#include <metoxid/file_io.hpp>
+#include <metoxid/metadata.hpp>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// What the index remembers about one file.
+struct IndexedFile {
+    FileStamp stamp;
+    ReadMode mode = ReadMode::Full; // Full entries can also answer Fast lookups
+    std::string error; // set when the file couldn't be read
+    FieldList fields; // Metadata::Flatten(), without the XMP packet
+};
+
+// Persistent, per-directory index of extracted metadata, so warm runs don't
+// re-parse files that haven't changed. Each directory gets one compact binary
+// file in a central cache directory (nothing is written next to the photos).
+// Entries are validated by inode, size and mtime, and an index file is only
+// rewritten when one of its entries changed. An empty location keeps the index in
+// memory only. max_files bounds how many files are held in memory: past it, the least
+// recently used directories are dropped (written first when changed), though never the
+// one being looked up. Thread-safe.
+class MetadataIndex {
+public:
+    // $XDG_CACHE_HOME/metoxid, ~/.cache/metoxid or %LOCALAPPDATA%\metoxid
+    static std::filesystem::path DefaultLocation();
+
+    // A relative location is taken from the current working directory, once.
+    // max_files 0 means unbounded
+    explicit MetadataIndex(std::filesystem::path location = DefaultLocation(), size_t max_files = 0);
+    ~MetadataIndex(); // flushes
+
+    MetadataIndex(const MetadataIndex&) = delete;
+    MetadataIndex& operator=(const MetadataIndex&) = delete;
+
+    // The entry for file if it's still valid for stamp and was read with (at least) mode.
+    std::optional<IndexedFile> Lookup(const std::filesystem::path& file, const FileStamp& stamp, ReadMode mode);
+    void Store(const std::filesystem::path& file, IndexedFile entry);
+
+    // Writes every changed directory index. Failures are ignored: the index is only a cache.
+    void Flush();
+
+private:
+    struct Directory {
+        bool dirty = false;
+        std::unordered_map<std::string, IndexedFile> files; // by file name
+        std::unordered_set<std::string> seen; // known to still exist, used to prune the rest on Flush()
+        std::list<std::string>::iterator used; // its place in used_
+    };
+
+    // These expect mutex_ to be held
+    Directory& Load(const std::filesystem::path& directory); // and marks it the most recently used
+    void Read(const std::filesystem::path& directory, Directory& loaded);
+    void Write(const std::string& path, Directory& directory);
+    void Evict(); // down to max_files_, keeping the most recently used directory
+    std::filesystem::path IndexPath(const std::filesystem::path& directory) const;
+
+    std::filesystem::path location_;
+    size_t max_files_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, Directory> directories_;
+    std::list<std::string> used_; // directories_' keys, most recently used first
+    size_t files_ = 0; // in all of directories_
+};
+
+// The file's fields from the index when it's unchanged (index may be null), otherwise
+// parsed and indexed. Files that don't start with the signature of a format Exiv2 reads
+// aren't parsed, or indexed, at all and come back as nullopt. Parse failures are in the
+// entry's error.
+std::optional<IndexedFile> readFields(const std::filesystem::path& path, const std::optional<FileStamp>& stamp, ReadMode mode, MetadataIndex* index);
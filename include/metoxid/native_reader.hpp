@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+// Built-in reader for the common Exif tags (camera, capture date, exposure, GPS,
+// orientation, ...) that skips Exiv2's full readMetadata(). It walks the bytes in
+// place: no per-tag allocations, keys and values are handed out as string_views
+// into a reused buffer and are only valid for the duration of the callback.
+//
+// Keys and value strings follow Exiv2's (Exif.Image.Model, Value::toString()),
+// so the result fits the same Category/field model. Tags it doesn't know, maker
+// notes and IPTC are not read; callers that need them, and every write, go
+// through Exiv2.
+struct NativeReadSink {
+    std::function<void(std::string_view key, std::string_view value)> exif;
+    std::function<void(std::string_view comment)> comment;
+    std::function<void(std::string_view packet)> xmp_packet; // points into the data when it's stored in one piece
+
+    // Where each Exif value is stored: its TIFF type, count and first byte, inside the
+    // data passed in. Used to patch values in place.
+    std::function<void(std::string_view key, uint16_t type, uint32_t count, const uint8_t* value)> exif_slot;
+
+    // Embedded JPEG previews (JPEGInterchangeFormat of IFD0 and the thumbnail IFD), inside
+    // the data passed in.
+    std::function<void(const uint8_t* data, size_t size)> preview;
+
+    // Keep reading files that carry IPTC instead of returning Unsupported (the IPTC
+    // itself is still not reported).
+    bool skip_iptc = false;
+};
+
+enum class NativeReadResult {
+    Ok,
+    Unsupported, // not a format (or a feature, like IPTC) the native reader handles
+    Malformed,
+};
+
+// Dispatches on the file signature: JPEG, TIFF or HEIF/AVIF. For HEIF only the
+// meta box and the Exif/XMP item extents are read, never the image payload.
+NativeReadResult readNativeMetadata(const uint8_t* data, size_t size, const NativeReadSink& sink);
+
+// A bare TIFF structure, as found in a JPEG APP1 segment after "Exif\0\0".
+NativeReadResult readTiffExif(const uint8_t* data, size_t size, const NativeReadSink& sink);
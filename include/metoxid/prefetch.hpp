@@ -0,0 +1,87 @@
+#pragma once
+#include <metoxid/metadata.hpp>
+#include <metoxid/thread_pool.hpp>
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// What the browser knows about a file: metadata ready for the editor plus the
+// lines shown in the preview pane.
+struct FileMetadata {
+    std::shared_ptr<Metadata> metadata; // null when the file couldn't be read or came from the index
+    bool editable = false;
+    std::string error; // set when the file couldn't be read
+    FieldList preview;
+};
+
+// The fields worth seeing first (camera, date, exposure, ...) followed by the rest,
+// capped at limit lines. fields must be sorted by key, as Metadata::Flatten() returns them.
+FieldList previewFields(FieldList fields, size_t limit = 200);
+
+// Bounded LRU cache keyed by path and validated by FileStamp. Thread-safe.
+class MetadataCache {
+public:
+    explicit MetadataCache(size_t capacity) : capacity_(capacity) {
+    }
+
+    // null on a miss or when the file changed since it was cached
+    std::shared_ptr<const FileMetadata> Get(const std::filesystem::path& path, const FileStamp& stamp);
+    bool Contains(const std::filesystem::path& path, const FileStamp& stamp);
+    void Put(const std::filesystem::path& path, const FileStamp& stamp, std::shared_ptr<const FileMetadata> metadata);
+    void Erase(const std::filesystem::path& path);
+
+private:
+    struct Entry {
+        std::string path;
+        FileStamp stamp;
+        std::shared_ptr<const FileMetadata> metadata;
+    };
+
+    size_t capacity_;
+    std::mutex mutex_;
+    std::list<Entry> entries_; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+};
+
+// Loads files into a MetadataCache on a background pool, so the UI thread never
+// waits for Exiv2. Only the most recently requested window of paths is worked on.
+class MetadataPrefetcher {
+public:
+    using Loader = std::function<std::shared_ptr<FileMetadata>(const std::filesystem::path&)>;
+
+    MetadataPrefetcher(MetadataCache& cache, Loader loader, size_t threads = 0);
+
+    // Replaces the wanted window, most important path first. Never blocks: paths
+    // that don't fit in the queue are picked up by a later call.
+    void Prefetch(const std::vector<std::filesystem::path>& paths);
+
+    // True if a file finished loading since the last call, i.e. the UI should redraw.
+    bool TakeUpdated() {
+        return this->updated_.exchange(false);
+    }
+
+    ThreadPool& Pool() { // for the browser's other background work, e.g. sniffing formats
+        return this->pool_;
+    }
+
+private:
+    void Load(const std::filesystem::path& path);
+
+    MetadataCache& cache_;
+    Loader loader_;
+
+    std::mutex mutex_;
+    std::unordered_set<std::string> wanted_;
+    std::unordered_set<std::string> queued_;
+    std::atomic<bool> updated_{false};
+
+    ThreadPool pool_; // last, so workers are joined before the state they use goes away
+};
@@ -0,0 +1,35 @@
+#pragma once
+#include <metoxid/file_io.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A preview or thumbnail embedded in a media file, its bytes exactly as they are stored:
+// nothing is decoded or re-encoded.
+struct EmbeddedPreview {
+    std::string mime_type; // "image/jpeg"
+    std::string extension; // ".jpg"
+    size_t width = 0; // 0 when unknown
+    size_t height = 0;
+    std::string_view bytes; // into the file's mapping, or into copy
+    std::shared_ptr<const std::string> copy; // set when the bytes had to be assembled
+
+    bool Mapped() const {
+        return this->copy == nullptr;
+    }
+};
+
+// The previews embedded in a file, smallest first. The JPEG previews of its Exif IFDs
+// are found by the built-in reader and point straight into the mapping, which has to
+// outlive them. Unless fast, Exiv2's PreviewManager is asked as well, for previews
+// stored elsewhere (maker notes, raw SubIFDs, ...); Exiv2 hands those out copied.
+// throws MetadataError
+std::vector<EmbeddedPreview> readPreviews(const std::shared_ptr<const MappedFile>& file, bool fast);
+
+// Where a file's index-th preview is written: next to it when dir is empty, otherwise
+// under dir at the file's path relative to the current directory (or its absolute path
+// when it's outside), so files of the same name in different directories don't collide.
+std::filesystem::path previewPath(const std::filesystem::path& dir, const std::filesystem::path& file, size_t index, const EmbeddedPreview& preview);
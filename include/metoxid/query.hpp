@@ -0,0 +1,72 @@
+#pragma once
+#include <metoxid/metadata.hpp>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Thrown when a query expression doesn't parse.
+class QueryError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// What is known about a file before it's parsed, answers the File.* keys.
+struct FileFacts {
+    std::filesystem::path path;
+    uint64_t size;
+};
+
+// A predicate over the fields Metadata::Flatten() reports, e.g.
+//
+//   Exif.Image.Model == "PENTAX K10D" and not Exif.GPSInfo.*
+//
+//   Key                  the key exists; a trailing * matches every key with that prefix
+//   Key op value         == (or =), !=, <, <=, >, >=, ~ (contains, ignoring case); numbers
+//                        and rationals (1/200) compare as numbers, everything else as strings.
+//                        A missing key compares false, a wildcard key matches if any key does
+//   not, and, or         also !, &&, ||, with parentheses for grouping
+//
+// Values are bare words or "quoted strings". File.Name, File.Extension (lowercase, no
+// dot), File.Path and File.Size are answered from the path and a stat, without parsing.
+class Query {
+public:
+    enum class Result { False, True, Unknown };
+
+    explicit Query(std::string_view text); // throws QueryError
+
+    // With fields null only the File.* keys are known, so the result may be Unknown;
+    // a definite answer means the file doesn't have to be parsed at all.
+    Result Evaluate(const FileFacts& file, const FieldList* fields) const;
+private:
+    enum class Kind { Or, And, Not, Exists, Compare };
+    enum class Op { Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual, Contains };
+
+    struct Node {
+        Kind kind = Kind::Exists;
+        size_t left = 0; // children of Or, And and Not
+        size_t right = 0;
+        std::string key; // leaves
+        bool prefix = false; // the key ended in *
+        Op op = Op::Equal;
+        std::string value;
+        std::optional<double> number; // value as a number, if it is one
+    };
+
+    struct Lexer;
+
+    std::vector<Node> nodes_;
+    size_t root_;
+
+    size_t ParseOr(Lexer& lexer);
+    size_t ParseAnd(Lexer& lexer);
+    size_t ParseUnary(Lexer& lexer);
+    size_t ParseLeaf(Lexer& lexer);
+    size_t Add(Node node);
+
+    Result Evaluate(size_t node, const FileFacts& file, const FieldList* fields) const;
+    bool Compare(const Node& node, const std::string& value) const;
+};
@@ -0,0 +1,116 @@
+#pragma once
+#include <metoxid/metadata.hpp>
+#include <metoxid/xmp_tree.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class FieldSearch;
+
+// Control characters (newlines, tabs) would move the ncurses cursor, the editor shows them as spaces.
+std::string oneLine(std::string value);
+
+// One entry of the editor: a category header, a field of an expanded category, or a node
+// of the XMP packet's tree.
+struct Row {
+    size_t category; // index into Metadata::Categories()
+    FieldMap::value_type* field; // null for the category header, the packet's field for its tree's nodes
+    std::string display; // the value as drawn, on one line, rendered once instead of every frame
+    size_t height; // screen lines the row takes
+    size_t node = XmpTree::kRoot; // the packet tree's node, the root is never a row
+
+    bool IsCategory() const {
+        return this->field == nullptr;
+    }
+
+    bool IsNode() const {
+        return this->node != XmpTree::kRoot;
+    }
+};
+
+// The categories and the fields of the expanded ones flattened into a single list,
+// so moving the cursor is an index change and drawing only touches the rows on screen.
+// A row can span several screen lines (the field being edited wraps), so the first
+// line of every row is kept as a prefix sum and finding the row at a scroll position
+// is a binary search.
+//
+// The XMP Packet category shows the packet as a field and, below it, as an XmpTree whose
+// nodes expand and collapse like categories; the tree is only built when the category is
+// first expanded, and only the expanded nodes are ever parsed.
+class RowModel {
+public:
+    explicit RowModel(std::vector<Category>& categories);
+
+    size_t Size() const {
+        return this->rows_.size();
+    }
+
+    const Row& At(size_t index) const {
+        return this->rows_[index];
+    }
+
+    const Category& CategoryOf(size_t index) const {
+        return this->categories_[this->rows_[index].category];
+    }
+
+    // Expands or collapses the category or packet tree node at index. Field rows, tree
+    // nodes that hold a value, and every row while filtered, are left alone and return false.
+    bool Toggle(size_t index);
+
+    // The packet's tree, null until the XMP Packet category was expanded.
+    XmpTree* PacketTree() {
+        return this->packet_tree_.get();
+    }
+
+    const XmpTree* PacketTree() const {
+        return this->packet_tree_.get();
+    }
+
+    // The key a field or node row is drawn with, tree nodes are indented by their depth.
+    std::string Key(size_t index) const;
+
+    // Shows only the matched fields, under the headers of their categories.
+    void Filter(const FieldSearch& search, const std::vector<uint32_t>& matches);
+    void ClearFilter();
+
+    bool Filtered() const {
+        return this->filtered_;
+    }
+
+    // Index of the row showing a field, or the category's header when field is null.
+    // Size() when it isn't shown. The packet's field is found as itself, not as a tree node.
+    size_t Find(size_t category, const FieldMap::value_type* field) const;
+
+    // Renders a field's display string again after its value was edited. Returns true if
+    // other rows changed too: the packet was edited as a whole, so its tree was built again.
+    bool Refresh(size_t index);
+
+    // Returns true when the height changed, i.e. every row below moved.
+    bool SetHeight(size_t index, size_t height);
+
+    size_t LineOf(size_t index) const {
+        return this->line_starts_[index];
+    }
+
+    size_t Lines() const {
+        return this->line_starts_.back();
+    }
+
+    // The row covering a screen line, Size() past the last one.
+    size_t RowAtLine(size_t line) const;
+private:
+    std::vector<Category>& categories_;
+    std::vector<Row> rows_;
+    std::vector<size_t> line_starts_; // one more entry than rows_, the last is the total
+    bool filtered_ = false;
+    std::unique_ptr<XmpTree> packet_tree_;
+
+    void Rebuild();
+    void AppendFields(size_t category, std::vector<Row>& rows);
+    bool ToggleNode(size_t index);
+    void AppendNodes(size_t category, FieldMap::value_type* packet, size_t node, std::vector<Row>& rows);
+    std::string NodeDisplay(size_t node) const;
+    void UpdateLines(size_t from);
+};
@@ -0,0 +1,9 @@
+#pragma once
+#include <metoxid/row_model.hpp>
+#include <metoxid/text_buffer.hpp>
+#include <cstddef>
+
+// Draws row index of the editor at screen line y of stdscr, clipped to row lines and col
+// columns. editing is the text of the field being edited, if this is that field, laid out
+// with Layout(col, key length + 4); only the part of it on screen is drawn.
+void drawRow(const RowModel& rows, size_t index, long y, int row, int col, bool selected, const TextBuffer* editing);
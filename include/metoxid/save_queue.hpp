@@ -0,0 +1,69 @@
+#pragma once
+#include <metoxid/metadata.hpp>
+#include <metoxid/thread_pool.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Saves edited files on a background writer thread, one at a time in the order they
+// were queued, so leaving the editor never waits for Exiv2 or the disk. Thread-safe.
+class SaveQueue {
+public:
+    enum class State { Queued, Encoding, Writing, Saved, Failed };
+
+    struct Status {
+        std::filesystem::path path;
+        State state;
+        std::string error; // set when Failed
+    };
+
+    using Done = std::function<void(const std::filesystem::path&)>;
+
+    // done runs on the writer thread after every file, saved or not
+    explicit SaveQueue(Done done = nullptr);
+
+    // Takes over metadata until it's written: the caller mustn't touch it any more.
+    void Save(const std::filesystem::path& path, std::shared_ptr<Metadata> metadata);
+
+    // True while a file is queued or being written. Its contents on disk aren't final,
+    // so it shouldn't be opened for editing until Wait() returns.
+    bool Pending(const std::filesystem::path& path);
+    size_t Pending();
+
+    void Wait(const std::filesystem::path& path);
+    void WaitAll();
+
+    // The file whose save changed state most recently, for the status line
+    std::optional<Status> Latest();
+
+    // Every save that failed so far, oldest first
+    std::vector<Status> Failures();
+
+    // True if a save changed state since the last call, i.e. the UI should redraw.
+    bool TakeUpdated() {
+        return this->updated_.exchange(false);
+    }
+
+private:
+    void Write(const std::filesystem::path& path, const std::shared_ptr<Metadata>& metadata);
+    void SetState(const std::filesystem::path& path, State state, std::string error = "");
+
+    Done done_;
+
+    std::mutex mutex_;
+    std::condition_variable finished_;
+    std::unordered_map<std::string, size_t> pending_; // path, saves queued for it
+    size_t pending_total_ = 0;
+    std::optional<Status> latest_;
+    std::vector<Status> failures_;
+    std::atomic<bool> updated_{false};
+
+    ThreadPool writer_; // last, so the queue is drained before the state it uses goes away
+};
@@ -0,0 +1,35 @@
+#pragma once
+#include <metoxid/metadata_index.hpp>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+// metoxid serve [--socket PATH] [-j N] [--index[=DIR]] [--cache FILES]
+// Listens on a Unix-domain socket (0600, refused to other users) and runs the batch
+// commands of clients in a process that stays warm: Exiv2 and the XMP toolkit are set
+// up once, files are read on one pool of -j workers, and every file read is kept in an
+// index shared by all runs, in memory unless --index is given. The index holds at most
+// --cache files in memory (50000 by default, 0 for no limit) and drops the directories
+// used least recently beyond that. A client passes its
+// working directory, arguments, stdout and stderr, so a run behaves exactly as if the
+// client had run it. Runs are served one at a time on a thread of their own (they take
+// over the process's stdout and working directory), so connections are still accepted
+// and the browser's field lookups still run on the pool while one is in progress. Exits,
+// removing the socket, on SIGINT or SIGTERM. Unsupported on Windows.
+int runServe(const std::vector<std::string>& args);
+
+// $XDG_RUNTIME_DIR/metoxid.sock, or a per-user socket in the temporary directory.
+std::filesystem::path defaultSocketPath();
+
+// Whether metoxid serve runs the command for clients: dump, query, dupes, previews, set.
+bool isServedCommand(const std::string& command);
+
+// Runs a batch command (args[0] is the command) on the server listening at socket, with
+// this process's working directory, stdout and stderr. Returns its exit status, or nullopt
+// when no server is listening, so the caller can run it itself.
+std::optional<int> runRemote(const std::filesystem::path& socket, const std::vector<std::string>& args);
+
+// The file's fields as the server at socket has them, readFields() on its warm index.
+// Nullopt when no server is listening. A file that isn't media comes back with an error.
+std::optional<IndexedFile> readRemote(const std::filesystem::path& socket, const std::filesystem::path& path, ReadMode mode);
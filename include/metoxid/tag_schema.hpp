@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// How a tag's value is written as text, the way Exiv2's Value::read() takes it.
+enum class TagType : uint8_t {
+    Byte, Short, Long, SShort, SLong, // whitespace separated integers
+    Undefined, // bytes as whitespace separated integers ("48 50 51 48")
+    Rational, SRational, // whitespace separated fractions ("1/250")
+    Ascii, // any text, count is the most bytes
+    Comment, // any text, with an optional charset= prefix
+    DateTime, // "YYYY:MM:DD HH:MM:SS"
+    Date, // "YYYY:MM:DD"
+    Offset, // "+HH:MM"
+    IptcDate, // "YYYY-MM-DD" or "YYYYMMDD"
+    IptcTime, // "HH:MM:SS", "HHMMSS", with an optional "+HH:MM" or "+HHMM" zone
+    Number, // an IPTC string of digits, count is the most digits
+};
+
+// What the standard says a tag holds. The table is built at compile time, with a
+// perfect hash over the keys, so resolving a key costs one hash and one comparison
+// and never goes through Exiv2's tag tables.
+struct TagSchema {
+    std::string_view key; // "Exif.Photo.ExposureTime"
+    std::string_view label; // "Exposure Time"
+    TagType type;
+    uint16_t count; // values (bytes for Ascii and Number), 0 when any number is allowed
+    int64_t min; // range of every integer value, min > max when only the type limits it
+    int64_t max;
+    std::string_view choices; // the only values allowed, separated by spaces; empty when free
+
+    bool Ranged() const {
+        return this->min <= this->max;
+    }
+};
+
+// The schema of a standard Exif (Image, Photo, GPSInfo, Iop) or IPTC (Application2) key,
+// null for every other key (maker notes, XMP, vendor tags).
+const TagSchema* findTag(std::string_view key);
+
+// Why text isn't a valid value for the tag, empty when it is. Cheap enough to run on every
+// keystroke: nothing is allocated unless the text is wrong.
+std::string checkValue(const TagSchema& tag, std::string_view text);
+
+// Whether ch can appear in a value of the tag at all, so the editor can drop it as it's typed.
+bool acceptsChar(const TagSchema& tag, char ch);
+
+// The value one step up (delta > 0) or down from text: the next number within the range
+// for single integers, the next choice for enumerations. Nullopt for other tags, or when
+// text isn't a value the step can start from.
+std::optional<std::string> stepValue(const TagSchema& tag, std::string_view text, int delta);
+
+// What the tag expects, for the editor's prompt ("Orientation: a number from 1 to 8").
+std::string describeTag(const TagSchema& tag);
@@ -0,0 +1,112 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The text of the field being edited, sized for values like the XMP packet that run to
+// hundreds of kilobytes. The text is a gap buffer whose gap is always at the cursor, so
+// typing, deleting and moving the cursor by a character are O(1).
+//
+// The text is laid out for the screen as the editor draws it: every line ('\n' starts
+// one) wraps at the width, the first line starts after an indent (the field's key), and
+// every line keeps a cell after its last character for the cursor. Line lengths and row
+// counts are kept in Fenwick trees, so finding the screen row of the cursor, or the text
+// on a screen row, is O(log lines). Only splitting or joining lines costs O(lines).
+class TextBuffer {
+public:
+    // A screen row: length characters from position, drawn from column on.
+    struct Span {
+        size_t position;
+        size_t length;
+        size_t column;
+    };
+
+    TextBuffer() {
+        this->Assign("");
+    }
+
+    // Replaces the text, the cursor goes to its end.
+    void Assign(std::string_view text);
+
+    std::string String() const;
+
+    size_t Size() const {
+        return this->data_.size() - (this->gap_end_ - this->gap_start_);
+    }
+
+    char At(size_t position) const {
+        return this->data_[position < this->gap_start_ ? position : position + (this->gap_end_ - this->gap_start_)];
+    }
+
+    size_t Cursor() const {
+        return this->gap_start_;
+    }
+
+    // Edits at the cursor. Backspace and Delete return false at the start and end of the text.
+    void Insert(char c);
+    bool Backspace();
+    bool Delete();
+
+    // Moves the cursor. Up from the first row goes to the start of the text and Down from
+    // the last row to its end; otherwise the column is kept where the target row has one.
+    void Left();
+    void Right();
+    void Up();
+    void Down();
+    void Home(); // start and end of the screen row
+    void End();
+
+    // Wraps at width columns, with the first line starting at column indent. Nothing is
+    // recomputed if neither changed.
+    void Layout(size_t width, size_t indent);
+
+    size_t Rows() const {
+        return this->rows_.Prefix(this->lengths_.size());
+    }
+
+    size_t CursorRow() const;
+    size_t CursorColumn() const;
+
+    // The text on a screen row, row < Rows().
+    Span RowSpan(size_t row) const;
+private:
+    // Fenwick tree of per-line counts.
+    struct Sums {
+        std::vector<size_t> tree; // 1-based
+
+        void Assign(const std::vector<size_t>& values);
+        void Add(size_t index, size_t delta); // delta wraps around for decrements
+        size_t Prefix(size_t count) const; // sum of the first count values
+        size_t Find(size_t target) const; // how many leading values sum to at most target
+    };
+
+    std::vector<char> data_;
+    size_t gap_start_ = 0; // the cursor
+    size_t gap_end_ = 0;
+
+    std::vector<size_t> lengths_; // characters of every line, without its '\n'
+    Sums starts_; // length + 1 per line, the prefix is where a line starts
+    Sums rows_; // screen rows per line
+    size_t line_ = 0; // cursor line and offset in it
+    size_t offset_ = 0;
+
+    size_t width_ = std::numeric_limits<size_t>::max();
+    size_t indent_ = 0;
+
+    size_t Indent(size_t line) const {
+        return line == 0 ? this->indent_ : 0;
+    }
+
+    size_t RowsOf(size_t line) const {
+        return (this->Indent(line) + this->lengths_[line]) / this->width_ + 1;
+    }
+
+    void Reindex();
+    void Resize(size_t line, size_t length);
+    void MoveGap(size_t position);
+    void MoveTo(size_t line, size_t offset);
+    void MoveToRow(size_t row, size_t column);
+};
@@ -0,0 +1,66 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size worker pool. Submit() blocks once the queue is full so that a
+// producer walking a huge directory tree can't run ahead of the workers.
+class ThreadPool {
+public:
+    // threads 0 means one per core, max_queued 0 means four tasks per thread
+    explicit ThreadPool(size_t threads = 0, size_t max_queued = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void Submit(std::function<void()> task);
+    bool TrySubmit(std::function<void()> task); // never blocks, false if the queue is full
+    void Wait(); // blocks until every submitted task has finished
+
+    size_t Size() const {
+        return this->workers_.size();
+    }
+
+private:
+    void WorkerLoop();
+
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> queue_;
+    size_t max_queued_;
+    size_t running_ = 0;
+    bool stopping_ = false;
+
+    std::mutex mutex_;
+    std::condition_variable task_ready_;
+    std::condition_variable slot_free_;
+    std::condition_variable idle_;
+};
+
+// The tasks one caller submits to a pool that others share, so it can wait for its own
+// tasks without waiting for everyone else's as ThreadPool::Wait() would. Waits for them
+// when destroyed too.
+class TaskGroup {
+public:
+    explicit TaskGroup(ThreadPool& pool) : pool_(pool) {}
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void Submit(std::function<void()> task); // blocks like ThreadPool::Submit()
+    void Wait(); // blocks until every task submitted here has finished
+
+private:
+    void Finish();
+
+    ThreadPool& pool_;
+    size_t pending_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable idle_;
+};
@@ -0,0 +1,64 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+// Spans of time recorded into per-thread buffers and written out as Chrome trace-event
+// JSON, which chrome://tracing and ui.perfetto.dev show as one timeline per thread.
+// While tracing is off a span costs one relaxed atomic load.
+
+extern std::atomic<bool> tracingOn; // read through tracingEnabled()
+
+inline bool tracingEnabled() {
+    return tracingOn.load(std::memory_order_relaxed);
+}
+
+// Starts recording; the trace is written to path by stopTracing(), or at exit. Throws
+// std::system_error if path can't be created, before anything is recorded.
+void startTracing(const std::filesystem::path& path);
+void stopTracing();
+
+// Names the calling thread's timeline, e.g. "main" or "save writer".
+void setTraceThreadName(const char* name);
+
+// Records the time from construction to destruction as one event named name, which must
+// be a string literal or otherwise outlive the trace.
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name) {
+        if (tracingEnabled()) {
+            this->Begin(name);
+        }
+    }
+
+    ~TraceSpan() {
+        if (this->name_ != nullptr) {
+            this->End();
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    // Bytes read or written during the span
+    void Bytes(uint64_t bytes) {
+        this->bytes_ = bytes;
+    }
+
+    // What the span worked on, usually a path. Only copied while tracing.
+    void Detail(const std::string& detail) {
+        if (this->name_ != nullptr) {
+            this->detail_ = detail;
+        }
+    }
+
+private:
+    const char* name_ = nullptr; // null when tracing was off at construction
+    int64_t start_ns_ = 0;
+    uint64_t bytes_ = UINT64_MAX; // not reported unless set
+    std::string detail_;
+
+    void Begin(const char* name);
+    void End();
+};
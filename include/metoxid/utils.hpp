@@ -1,7 +1,20 @@
 #pragma once
 #include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
 #include <vector>
 
 void fatalError(const char* fmt, ...);
 void sigintHandler(int dummy);
-std::vector<std::filesystem::path> listDirectory(const std::filesystem::path& dir);
+
+// Calls visit for every regular file in inputs, descending into directories recursively.
+// Inputs that don't exist or can't be read are passed to error instead, and so are
+// directories inside them that can't be read; the walk goes on with the rest.
+void walkFiles(const std::vector<std::filesystem::path>& inputs,
+               const std::function<void(const std::filesystem::path&)>& visit,
+               const std::function<void(const std::filesystem::path&, const std::string&)>& error);
+
+// Appends value to out as a quoted JSON string. Bytes that aren't valid UTF-8 are
+// escaped as if they were Latin-1, so binary Exif values still produce valid JSON.
+void appendJsonString(std::string& out, std::string_view value);
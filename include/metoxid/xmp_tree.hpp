@@ -0,0 +1,66 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The XMP packet as a tree of elements and attributes, for browsing and editing it one
+// property at a time instead of as one string.
+//
+// Nothing is parsed up front. Children() scans a node's bytes once, the way a SAX parser
+// would, and only materialises that node's direct children; everything below them is
+// skipped over until they are expanded in turn. Nodes hold byte ranges into the packet,
+// so Set() splices the new value into the packet in place and only moves the ranges of
+// the nodes after it, the rest of the packet is never re-serialised.
+class XmpTree {
+public:
+    static constexpr size_t kRoot = 0; // the whole packet, its children are the top-level elements
+
+    struct Node {
+        std::string name; // element or attribute name as written, "dc:title"
+        std::string attributes; // a leaf element's attributes as written, e.g. xml:lang="x-default"
+        size_t parent;
+        size_t depth; // 1 for the top-level elements
+        size_t begin; // an element from its '<' to past its last '>', an attribute's value between its quotes
+        size_t end;
+        size_t content_begin; // an element's text between its tags, an attribute's value
+        size_t content_end;
+        bool attribute;
+        bool leaf; // holds a value: an attribute, or an element with text and no child elements
+        bool self_closing; // <name/>, setting a value gives it an end tag
+        bool scanned = false; // children were materialised
+        bool expanded = false; // shown expanded, for the editor
+        std::vector<size_t> children;
+    };
+
+    explicit XmpTree(std::string packet);
+
+    const std::string& Packet() const {
+        return this->packet_;
+    }
+
+    const Node& At(size_t node) const {
+        return this->nodes_[node];
+    }
+
+    void SetExpanded(size_t node, bool expanded) {
+        this->nodes_[node].expanded = expanded;
+    }
+
+    // Materialises the children of a node (attributes first, then elements) on first use.
+    // A copy, materialising more nodes moves the ones there are.
+    std::vector<size_t> Children(size_t node);
+
+    // A leaf's value, with entities and CDATA sections decoded. Empty for other nodes.
+    std::string Value(size_t node) const;
+
+    // Replaces a leaf's value with text, escaped for where it goes. Throws std::logic_error
+    // for nodes that aren't leaves.
+    void Set(size_t node, std::string_view text);
+private:
+    std::string packet_;
+    std::vector<Node> nodes_;
+
+    void Scan(size_t node);
+    void Splice(size_t begin, size_t end, const std::string& replacement);
+};
@@ -0,0 +1,697 @@
+#include <metoxid/batch.hpp>
+#include <metoxid/file_format.hpp>
+#include <metoxid/fingerprint.hpp>
+#include <metoxid/metadata.hpp>
+#include <metoxid/metadata_index.hpp>
+#include <metoxid/preview.hpp>
+#include <metoxid/query.hpp>
+#include <metoxid/tag_schema.hpp>
+#include <metoxid/thread_pool.hpp>
+#include <metoxid/trace.hpp>
+#include <metoxid/utils.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+
+namespace {
+
+// Serialises whole lines from many workers onto stdout (or stderr, when stdout carries data).
+class LineWriter {
+public:
+    explicit LineWriter(std::FILE* out = stdout) : out_(out) {}
+
+    void Write(std::string_view line) {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        std::fwrite(line.data(), 1, line.size(), this->out_);
+    }
+
+    // Several pieces that mustn't interleave with other workers' output. Returns how many
+    // bytes this writer had written before them, where the first piece starts in the stream.
+    uint64_t Write(const std::vector<std::string_view>& pieces) {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        const uint64_t offset = this->written_;
+        for (const auto& piece : pieces) {
+            std::fwrite(piece.data(), 1, piece.size(), this->out_);
+            this->written_ += piece.size();
+        }
+        return offset;
+    }
+
+private:
+    std::mutex mutex_;
+    std::FILE* out_;
+    uint64_t written_ = 0; // by Write(pieces)
+};
+
+bool parseJobs(const std::string& value, size_t& jobs) {
+    try {
+        size_t used = 0;
+        const unsigned long parsed = std::stoul(value, &used);
+        if (used != value.size() || parsed == 0) {
+            return false;
+        }
+        jobs = parsed;
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+std::string errorLine(const std::filesystem::path& path, const std::string& message) {
+    std::string line = "{\"path\":";
+    appendJsonString(line, path.string());
+    line += ",\"error\":";
+    appendJsonString(line, message);
+    line += "}\n";
+    return line;
+}
+
+std::string pathLine(const std::filesystem::path& path) {
+    std::string line = "{\"path\":";
+    appendJsonString(line, path.string());
+    line += "}\n";
+    return line;
+}
+
+std::string fieldsLine(const std::filesystem::path& path, const FieldList& fields) {
+    std::string line = "{\"path\":";
+    appendJsonString(line, path.string());
+    line += ",\"fields\":{";
+    for (size_t i = 0; i < fields.size(); ++i) {
+        if (i != 0) {
+            line.push_back(',');
+        }
+        appendJsonString(line, fields[i].first);
+        line.push_back(':');
+        appendJsonString(line, fields[i].second);
+    }
+    line += "}}\n";
+
+    return line;
+}
+
+// Serves the file from the index when it's unchanged, otherwise parses it and indexes the result.
+// The index doesn't keep XMP packets, so asking for them always means parsing.
+std::string dumpFile(const std::filesystem::path& path, ReadMode mode, bool with_packet, MetadataIndex* index, std::atomic<size_t>& failures) {
+    const auto stamp = index != nullptr && !with_packet ? FileStamp::Of(path) : std::nullopt;
+
+    if (stamp) {
+        if (const auto indexed = index->Lookup(path, *stamp, mode)) {
+            if (!indexed->error.empty()) {
+                failures++;
+                return errorLine(path, indexed->error);
+            }
+            return fieldsLine(path, indexed->fields);
+        }
+    }
+
+    IndexedFile entry;
+    entry.mode = mode;
+    try {
+        const Metadata metadata(path, mode);
+        entry.fields = metadata.Flatten(with_packet);
+    } catch (const std::exception& e) {
+        entry.error = e.what();
+    }
+
+    if (stamp) {
+        entry.stamp = *stamp;
+        index->Store(path, entry);
+    }
+
+    if (!entry.error.empty()) {
+        failures++;
+        return errorLine(path, entry.error);
+    }
+    return fieldsLine(path, entry.fields);
+}
+
+// The options every batch mode takes.
+struct BatchOptions {
+    explicit BatchOptions(const BatchContext& context) : context(context) {}
+
+    size_t jobs = 0;
+    bool stats = false;
+    ReadMode mode = ReadMode::Full;
+    std::unique_ptr<MetadataIndex> index;
+    std::vector<std::filesystem::path> inputs;
+    BatchContext context;
+
+    // --index, or the one the serving process keeps warm
+    MetadataIndex* Index() const {
+        return this->index ? this->index.get() : this->context.index;
+    }
+};
+
+// Handles args[i] if it's a shared option or an input, advancing i past its value.
+// Prints why and returns false if it's malformed or unknown.
+bool parseBatchOption(const char* command, const std::vector<std::string>& args, size_t& i, BatchOptions& options) {
+    const std::string& arg = args[i];
+
+    if (arg == "-j" || arg == "--jobs") {
+        if (i + 1 >= args.size() || !parseJobs(args[++i], options.jobs)) {
+            std::fprintf(stderr, "metoxid %s: %s expects a positive number\n", command, arg.c_str());
+            return false;
+        }
+    } else if (arg.rfind("--jobs=", 0) == 0) {
+        if (!parseJobs(arg.substr(7), options.jobs)) {
+            std::fprintf(stderr, "metoxid %s: --jobs expects a positive number\n", command);
+            return false;
+        }
+    } else if (arg == "--stats") {
+        options.stats = true;
+    } else if (arg == "--fast") {
+        options.mode = ReadMode::Fast;
+    } else if (arg == "--index") {
+        options.index = std::make_unique<MetadataIndex>();
+    } else if (arg.rfind("--index=", 0) == 0) {
+        options.index = std::make_unique<MetadataIndex>(arg.substr(8));
+    } else if (arg == "--") {
+        options.inputs.insert(options.inputs.end(), args.begin() + i + 1, args.end());
+        i = args.size();
+    } else if (arg.size() > 1 && arg[0] == '-') {
+        std::fprintf(stderr, "metoxid %s: unknown option %s\n", command, arg.c_str());
+        return false;
+    } else {
+        options.inputs.emplace_back(arg);
+    }
+    return true;
+}
+
+// Walks the inputs and runs process for every file on a worker pool, the context's or one of
+// -j workers. Returns the number of workers.
+size_t forEachFile(const BatchOptions& options, const std::function<void(const std::filesystem::path&)>& process, LineWriter& writer, std::atomic<size_t>& failures) {
+    // The XMP toolkit must be initialised once before it's used from several threads,
+    // and Exiv2 warnings would only interleave with our output.
+    Exiv2::XmpParser::initialize();
+    Exiv2::LogMsg::setLevel(Exiv2::LogMsg::mute);
+
+    std::optional<ThreadPool> own;
+    ThreadPool& pool = options.context.pool != nullptr ? *options.context.pool : own.emplace(options.jobs);
+
+    TaskGroup tasks(pool); //a shared pool also runs other clients' files, only these are waited for
+    walkFiles(options.inputs, [&](const std::filesystem::path& path) {
+        tasks.Submit([&process, path] {
+            setTraceThreadName("batch worker");
+            TraceSpan span("file");
+            span.Detail(path.string());
+            process(path);
+        });
+    }, [&](const std::filesystem::path& path, const std::string& message) {
+        writer.Write(errorLine(path, message));
+        failures++;
+    });
+
+    tasks.Wait();
+    return pool.Size();
+}
+
+void printStats(size_t files, size_t failures, size_t jobs, std::chrono::steady_clock::time_point start) {
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::fprintf(stderr, "%zu files, %zu errors, %zu threads, %.3f s, %.1f files/s\n",
+                 files, failures, jobs, elapsed.count(),
+                 elapsed.count() > 0 ? files / elapsed.count() : 0.0);
+}
+
+// Decides from the path and a stat when it can, then from the index, and only then parses.
+// Unless the File.* keys alone decide, files that aren't media never match.
+// Parse failures are reported in error.
+bool queryFile(const std::filesystem::path& path, const Query& query, ReadMode mode, MetadataIndex* index, std::string& error) {
+    const auto stamp = FileStamp::Of(path);
+    const FileFacts facts{path, stamp ? stamp->size : 0};
+
+    const Query::Result early = query.Evaluate(facts, nullptr);
+    if (early != Query::Result::Unknown) {
+        return early == Query::Result::True;
+    }
+
+    const auto entry = readFields(path, stamp, mode, index);
+    if (!entry) {
+        return false;
+    }
+    error = entry->error;
+    return error.empty() && query.Evaluate(facts, &entry->fields) == Query::Result::True;
+}
+
+// A file of metoxid dupes and the fingerprint of its selected fields.
+struct Fingerprinted {
+    uint64_t fingerprint;
+    std::filesystem::path path;
+};
+
+std::string hexFingerprint(uint64_t fingerprint) {
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)fingerprint);
+    return hex;
+}
+
+std::string groupLine(const std::vector<Fingerprinted>& files, size_t first, size_t last) {
+    std::string line = "{\"fingerprint\":\"" + hexFingerprint(files[first].fingerprint) + "\",\"paths\":[";
+    for (size_t i = first; i < last; ++i) {
+        if (i != first) {
+            line.push_back(',');
+        }
+        appendJsonString(line, files[i].path.string());
+    }
+    line += "]}\n";
+    return line;
+}
+
+// The previews of a file of metoxid previews, and where each was written: a file, or with
+// --stdout the offset of its bytes in the stream.
+std::string previewsLine(const std::filesystem::path& path, const std::vector<EmbeddedPreview>& previews, const std::vector<std::filesystem::path>& written, std::optional<uint64_t> offset) {
+    std::string line = "{\"path\":";
+    appendJsonString(line, path.string());
+    line += ",\"previews\":[";
+    for (size_t i = 0; i < previews.size(); ++i) {
+        line += i != 0 ? ",{" : "{";
+        if (i < written.size()) {
+            line += "\"file\":";
+            appendJsonString(line, written[i].string());
+            line += ",";
+        } else if (offset) {
+            line += "\"offset\":" + std::to_string(*offset) + ",";
+            *offset += previews[i].bytes.size();
+        }
+        line += "\"mime\":";
+        appendJsonString(line, previews[i].mime_type);
+        line += ",\"width\":" + std::to_string(previews[i].width);
+        line += ",\"height\":" + std::to_string(previews[i].height);
+        line += ",\"size\":" + std::to_string(previews[i].bytes.size()) + "}";
+    }
+    line += "]}\n";
+    return line;
+}
+
+// One operation of metoxid set.
+struct FieldEdit {
+    std::string key;
+    std::optional<std::string> value; // nullopt deletes the key
+};
+
+bool isMetadataKey(const std::string& key) {
+    return key == "Comment" || key.rfind("Exif.", 0) == 0 || key.rfind("Iptc.", 0) == 0 || key.rfind("Xmp.", 0) == 0;
+}
+
+// Read and modify: parses the file and applies the edits, leaving the new file encoded in memory.
+std::shared_ptr<Metadata> applyEdits(const std::filesystem::path& path, const std::vector<FieldEdit>& edits) {
+    std::shared_ptr<const MappedFile> file;
+    try {
+        file = MappedFile::Open(path);
+    } catch (const std::exception& e) {
+        throw MetadataError(e.what());
+    }
+    const FileFormat format = detectFormat(file->Header(kSniffBytes));
+    if (format == FileFormat::Unknown) { // not something Exiv2 reads, don't let it probe every format
+        throw MetadataError("Not a file format metoxid can edit");
+    }
+    if (!formatInfo(format).writable) {
+        throw MetadataError(std::string("Exiv2 can't write metadata into ") + formatInfo(format).name + " files");
+    }
+    file->Prefetch(); // the rewrite reads all of it, the disk can get going while Exiv2 parses
+
+    auto metadata = std::make_shared<Metadata>(file, ReadMode::Full);
+    for (const auto& edit : edits) {
+        if (edit.value) {
+            metadata->Set(edit.key, *edit.value);
+        } else {
+            metadata->Erase(edit.key);
+        }
+    }
+    metadata->Encode();
+    return metadata;
+}
+
+} // namespace
+
+int runDump(const std::vector<std::string>& args, const BatchContext& context) {
+    BatchOptions options(context);
+    bool with_packet = false;
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "--xmp-packet") {
+            with_packet = true;
+        } else if (!parseBatchOption("dump", args, i, options)) {
+            return 2;
+        }
+    }
+
+    if (options.inputs.empty()) {
+        std::fprintf(stderr, "usage: metoxid dump [-j N] [--stats] [--fast] [--index[=DIR]] [--xmp-packet] <dir|files...>\n");
+        return 2;
+    }
+
+    LineWriter writer;
+    std::atomic<size_t> files{0};
+    std::atomic<size_t> failures{0};
+    const auto start = std::chrono::steady_clock::now();
+
+    const size_t jobs = forEachFile(options, [&](const std::filesystem::path& path) {
+        writer.Write(dumpFile(path, options.mode, with_packet, options.Index(), failures));
+        files++;
+    }, writer, failures);
+
+    std::fflush(stdout);
+    if (options.index) {
+        options.index->Flush();
+    }
+
+    if (options.stats) {
+        printStats(files.load(), failures.load(), jobs, start);
+    }
+
+    return failures.load() == 0 ? 0 : 1;
+}
+
+int runQuery(const std::vector<std::string>& args, const BatchContext& context) {
+    BatchOptions options(context);
+    bool json = false;
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "--json") {
+            json = true;
+        } else if (!parseBatchOption("query", args, i, options)) {
+            return 2;
+        }
+    }
+
+    if (options.inputs.empty()) {
+        std::fprintf(stderr, "usage: metoxid query [-j N] [--stats] [--fast] [--index[=DIR]] [--json] '<expr>' [dir|files...]\n");
+        return 2;
+    }
+
+    std::optional<Query> query;
+    try {
+        query.emplace(options.inputs.front().string());
+    } catch (const QueryError& e) {
+        std::fprintf(stderr, "metoxid query: %s\n", e.what());
+        return 2;
+    }
+    options.inputs.erase(options.inputs.begin());
+    if (options.inputs.empty()) {
+        options.inputs.emplace_back(".");
+    }
+
+    LineWriter writer;
+    std::atomic<size_t> files{0};
+    std::atomic<size_t> failures{0};
+    std::atomic<size_t> matches{0};
+    const auto start = std::chrono::steady_clock::now();
+
+    const size_t jobs = forEachFile(options, [&](const std::filesystem::path& path) {
+        std::string error;
+        const bool matched = queryFile(path, *query, options.mode, options.Index(), error);
+        files++;
+
+        if (!error.empty()) {
+            failures++;
+            if (json) {
+                writer.Write(errorLine(path, error));
+            } else {
+                std::fprintf(stderr, "metoxid query: %s: %s\n", path.string().c_str(), error.c_str());
+            }
+        } else if (matched) { //streamed as soon as each file is decided
+            matches++;
+            writer.Write(json ? pathLine(path) : path.string() + "\n");
+        }
+    }, writer, failures);
+
+    std::fflush(stdout);
+    if (options.index) {
+        options.index->Flush();
+    }
+
+    if (options.stats) {
+        printStats(files.load(), failures.load(), jobs, start);
+    }
+
+    return matches.load() > 0 ? 0 : 1;
+}
+
+int runDupes(const std::vector<std::string>& args, const BatchContext& context) {
+    BatchOptions options(context);
+    bool json = false;
+    std::string keys;
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "--json") {
+            json = true;
+        } else if (args[i] == "--keys") {
+            if (i + 1 >= args.size()) {
+                std::fprintf(stderr, "metoxid dupes: --keys expects a list of keys\n");
+                return 2;
+            }
+            keys = args[++i];
+        } else if (args[i].rfind("--keys=", 0) == 0) {
+            keys = args[i].substr(7);
+        } else if (!parseBatchOption("dupes", args, i, options)) {
+            return 2;
+        }
+    }
+
+    if (options.inputs.empty()) {
+        std::fprintf(stderr, "usage: metoxid dupes [-j N] [--stats] [--fast] [--index[=DIR]] [--keys K1,K2,Prefix.*] [--json] <dir|files...>\n");
+        return 2;
+    }
+
+    const KeySelection selection(keys);
+    LineWriter writer;
+    std::atomic<size_t> files{0};
+    std::atomic<size_t> failures{0};
+    std::mutex fingerprinted_mutex;
+    std::vector<Fingerprinted> fingerprinted;
+    const auto start = std::chrono::steady_clock::now();
+
+    const size_t jobs = forEachFile(options, [&](const std::filesystem::path& path) {
+        const auto entry = readFields(path, FileStamp::Of(path), options.mode, options.Index());
+        files++;
+        if (!entry) {
+            return;
+        }
+        if (!entry->error.empty()) {
+            failures++;
+            std::fprintf(stderr, "metoxid dupes: %s: %s\n", path.string().c_str(), entry->error.c_str());
+            return;
+        }
+
+        const auto fingerprint = fingerprintFields(entry->fields, selection);
+        if (fingerprint) { //files without any of the keys have nothing to match on
+            std::lock_guard<std::mutex> lock(fingerprinted_mutex);
+            fingerprinted.push_back({*fingerprint, path});
+        }
+    }, writer, failures);
+
+    if (options.index) {
+        options.index->Flush();
+    }
+
+    // equal fingerprints end up next to each other, paths sorted within a group
+    std::sort(fingerprinted.begin(), fingerprinted.end(), [](const Fingerprinted& a, const Fingerprinted& b) {
+        return a.fingerprint != b.fingerprint ? a.fingerprint < b.fingerprint : a.path < b.path;
+    });
+
+    size_t groups = 0;
+    for (size_t first = 0, last = 0; first < fingerprinted.size(); first = last) {
+        for (last = first + 1; last < fingerprinted.size() && fingerprinted[last].fingerprint == fingerprinted[first].fingerprint; ++last) {
+        }
+        if (last - first < 2) {
+            continue;
+        }
+
+        if (json) {
+            writer.Write(groupLine(fingerprinted, first, last));
+        } else {
+            std::string group = groups > 0 ? "\n" : ""; //groups are separated by an empty line
+            for (size_t i = first; i < last; ++i) {
+                group += fingerprinted[i].path.string() + "\n";
+            }
+            writer.Write(group);
+        }
+        groups++;
+    }
+    std::fflush(stdout);
+
+    if (options.stats) {
+        printStats(files.load(), failures.load(), jobs, start);
+        std::fprintf(stderr, "%zu fingerprinted, %zu groups of duplicates\n", fingerprinted.size(), groups);
+    }
+
+    return groups > 0 ? 0 : 1;
+}
+
+int runPreviews(const std::vector<std::string>& args, const BatchContext& context) {
+    BatchOptions options(context);
+    std::filesystem::path out;
+    bool to_stdout = false;
+    bool largest = false;
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "-o" || args[i] == "--output") {
+            if (i + 1 >= args.size() || args[i + 1].empty()) {
+                std::fprintf(stderr, "metoxid previews: %s expects a directory\n", args[i].c_str());
+                return 2;
+            }
+            out = args[++i];
+        } else if (args[i].rfind("--output=", 0) == 0) {
+            out = args[i].substr(9);
+        } else if (args[i] == "--stdout") {
+            to_stdout = true;
+        } else if (args[i] == "--largest") {
+            largest = true;
+        } else if (!parseBatchOption("previews", args, i, options)) {
+            return 2;
+        }
+    }
+
+    if (options.index) {
+        std::fprintf(stderr, "metoxid previews: the index doesn't keep previews\n");
+        return 2;
+    }
+    if (options.inputs.empty() || out.empty() == !to_stdout) {
+        std::fprintf(stderr, "usage: metoxid previews [-j N] [--stats] [--fast] [--largest] (-o DIR | --stdout) <dir|files...>\n");
+        return 2;
+    }
+
+    LineWriter writer(to_stdout ? stderr : stdout); //with --stdout only the images go to stdout
+    LineWriter images;
+    std::atomic<size_t> files{0};
+    std::atomic<size_t> failures{0};
+    std::atomic<size_t> extracted{0};
+    const auto start = std::chrono::steady_clock::now();
+
+    const size_t jobs = forEachFile(options, [&](const std::filesystem::path& path) {
+        files++;
+        try {
+            const auto file = MappedFile::Open(path);
+            if (detectFormat(file->Header(kSniffBytes)) == FileFormat::Unknown) {
+                return;
+            }
+            auto previews = readPreviews(file, options.mode == ReadMode::Fast);
+            if (largest && previews.size() > 1) {
+                previews.erase(previews.begin(), previews.end() - 1);
+            }
+            extracted += previews.size();
+
+            std::vector<std::filesystem::path> written;
+            std::optional<uint64_t> offset;
+            if (to_stdout) { //straight from the mapping, no copy of our own
+                std::vector<std::string_view> pieces;
+                for (const auto& preview : previews) {
+                    pieces.push_back(preview.bytes);
+                }
+                offset = images.Write(pieces); //files finish in any order, the lines say where each image went
+            } else {
+                for (size_t i = 0; i < previews.size(); ++i) {
+                    written.push_back(previewPath(out, path, i, previews[i]));
+                    std::filesystem::create_directories(written.back().parent_path());
+                    writeFile(written.back(), reinterpret_cast<const uint8_t*>(previews[i].bytes.data()), previews[i].bytes.size());
+                }
+            }
+            writer.Write(previewsLine(path, previews, written, offset));
+        } catch (const std::exception& e) {
+            writer.Write(errorLine(path, e.what()));
+            failures++;
+        }
+    }, writer, failures);
+
+    std::fflush(stdout);
+
+    if (options.stats) {
+        printStats(files.load(), failures.load(), jobs, start);
+        std::fprintf(stderr, "%zu previews extracted\n", extracted.load());
+    }
+
+    return failures.load() == 0 ? 0 : 1;
+}
+
+int runSet(const std::vector<std::string>& args, const BatchContext& context) {
+    BatchOptions options(context);
+    std::vector<FieldEdit> edits;
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        const size_t equals = arg.find('=');
+
+        if (arg == "--delete" || arg.rfind("--delete=", 0) == 0) {
+            const std::string key = arg == "--delete" ? (i + 1 < args.size() ? args[++i] : "") : arg.substr(9);
+            if (!isMetadataKey(key)) {
+                std::fprintf(stderr, "metoxid set: --delete expects an Exif.*, Iptc.*, Xmp.* or Comment key\n");
+                return 2;
+            }
+            edits.push_back({key, std::nullopt});
+        } else if (equals != std::string::npos && arg[0] != '-' && isMetadataKey(arg.substr(0, equals))) {
+            edits.push_back({arg.substr(0, equals), arg.substr(equals + 1)});
+        } else if (!parseBatchOption("set", args, i, options)) {
+            return 2;
+        }
+    }
+
+    if (options.mode == ReadMode::Fast || options.index) {
+        std::fprintf(stderr, "metoxid set: --fast and --index only apply to reading\n");
+        return 2;
+    }
+    if (edits.empty() || options.inputs.empty()) {
+        std::fprintf(stderr, "usage: metoxid set [-j N] [--stats] Key=Value... [--delete Key]... <dir|files...>\n");
+        return 2;
+    }
+    for (const auto& edit : edits) { //a value that's wrong for the tag would fail every file the same way
+        const TagSchema* tag = edit.value ? findTag(edit.key) : nullptr;
+        const std::string problem = tag != nullptr ? checkValue(*tag, *edit.value) : "";
+        if (!problem.empty()) {
+            std::fprintf(stderr, "metoxid set: %s\n", problem.c_str());
+            return 2;
+        }
+    }
+
+    LineWriter writer;
+    std::atomic<size_t> files{0};
+    std::atomic<size_t> failures{0};
+    const auto start = std::chrono::steady_clock::now();
+
+    auto fail = [&](const std::filesystem::path& path, const std::string& message) {
+        writer.Write(errorLine(path, message));
+        failures++;
+        files++;
+    };
+
+    // Parsing and encoding are CPU-bound and run on one pool, the writes (and their fsyncs)
+    // on another, so one file's I/O overlaps the next file's parsing. The writers' short
+    // queue bounds how many encoded files are held in memory.
+    ThreadPool writers(options.jobs, options.jobs != 0 ? options.jobs : 1);
+
+    const size_t jobs = forEachFile(options, [&](const std::filesystem::path& path) {
+        std::shared_ptr<Metadata> metadata;
+        try {
+            metadata = applyEdits(path, edits);
+        } catch (const std::exception& e) {
+            fail(path, e.what());
+            return;
+        }
+
+        writers.Submit([&, path, metadata] {
+            try {
+                metadata->WriteFile();
+            } catch (const std::exception& e) {
+                fail(path, e.what());
+                return;
+            }
+            writer.Write(pathLine(path));
+            files++;
+        });
+    }, writer, failures);
+
+    writers.Wait();
+    std::fflush(stdout);
+
+    if (options.stats) {
+        printStats(files.load(), failures.load(), jobs, start);
+    }
+
+    return failures.load() == 0 ? 0 : 1;
+}
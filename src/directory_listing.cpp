@@ -0,0 +1,317 @@
+#include <metoxid/directory_listing.hpp>
+#include <metoxid/file_io.hpp>
+#include <metoxid/thread_pool.hpp>
+#include <metoxid/trace.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <mutex>
+#include <utility>
+
+namespace {
+
+std::string lowercase(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return text;
+}
+
+// Files per task, one small read each. A few tasks at a time leave the pool room for previews.
+constexpr size_t kSniffBatch = 256;
+
+} // namespace
+
+struct DirectoryListing::SniffResults {
+    std::atomic<bool> cancelled{false}; // the listing is gone, the remaining files needn't be read
+    std::mutex mutex;
+    std::vector<std::pair<uint32_t, FileFormat>> formats; // not merged yet
+    size_t tasks = 0; // queued or running
+};
+
+DirectoryListing::DirectoryListing(const std::filesystem::path& dir, ThreadPool& pool)
+    : pool_(pool), results_(std::make_shared<SniffResults>()) {
+    this->dir_ = dir.lexically_normal();
+    if (!this->dir_.has_filename() && this->dir_.has_relative_path()) { // "photos/" names the same directory as "photos"
+        this->dir_ = this->dir_.parent_path();
+    }
+
+    if (this->dir_.has_relative_path()) {
+        this->entries_.push_back({"..", Type::Directory});
+        this->has_parent_ = true;
+    }
+
+    std::error_code ec;
+    this->it_ = std::filesystem::directory_iterator(this->dir_, std::filesystem::directory_options::skip_permission_denied, ec);
+    if (ec) {
+        this->error_ = ec.message();
+        this->complete_ = true;
+    }
+    this->Rebuild();
+}
+
+DirectoryListing::~DirectoryListing() {
+    this->results_->cancelled = true;
+}
+
+bool DirectoryListing::ReadMore(size_t max_entries) {
+    if (this->complete_) {
+        return false;
+    }
+
+    TraceSpan span("list directory");
+    span.Detail(this->dir_.string());
+
+    const std::filesystem::directory_iterator end;
+    const size_t first = this->entries_.size();
+    std::error_code ec;
+
+    for (size_t n = 0; n < max_entries && this->it_ != end; ++n) {
+        const auto& entry = *this->it_;
+        // the type the directory read reported, only symlinks and DT_UNKNOWN file systems need a stat
+        const Type type = entry.is_directory(ec) ? Type::Directory : entry.is_regular_file(ec) ? Type::File : Type::Other;
+        this->entries_.push_back({entry.path().filename().string(), type});
+
+        this->it_.increment(ec);
+        if (ec) {
+            this->error_ = ec.message();
+            this->it_ = end;
+        }
+    }
+    this->complete_ = this->it_ == end;
+
+    // the new entries go into the view as if it had been sorted with them all along
+    std::vector<uint32_t> added;
+    for (size_t i = first; i < this->entries_.size(); ++i) {
+        this->Fill(this->entries_[i]);
+        if (this->Matches(this->entries_[i])) {
+            added.push_back((uint32_t)i);
+        }
+    }
+
+    const auto before = [this](uint32_t a, uint32_t b) { return this->Before(a, b); };
+    std::sort(added.begin(), added.end(), before);
+    const size_t middle = this->view_.size();
+    this->view_.insert(this->view_.end(), added.begin(), added.end());
+    std::inplace_merge(this->view_.begin(), this->view_.begin() + middle, this->view_.end(), before);
+
+    return !this->complete_;
+}
+
+std::filesystem::path DirectoryListing::PathAt(size_t index) const {
+    if (this->has_parent_ && this->view_[index] == 0) {
+        return this->dir_.parent_path();
+    }
+    return this->dir_ / this->At(index).name;
+}
+
+const DirectoryListing::Entry& DirectoryListing::Stat(size_t index) {
+    Entry& entry = this->entries_[this->view_[index]];
+    this->StatEntry(entry);
+    return entry;
+}
+
+void DirectoryListing::StatEntry(Entry& entry) const {
+    if (entry.stated) {
+        return;
+    }
+    if (const auto stamp = FileStamp::Of(this->dir_ / entry.name)) { // one stat for both
+        entry.size = stamp->size;
+        entry.mtime_ns = stamp->mtime_ns;
+    }
+    entry.stated = true;
+}
+
+bool DirectoryListing::SniffMore(size_t first, size_t count) {
+    // the rows asked for first, as a batch of their own
+    std::vector<uint32_t> batch;
+    for (size_t i = first; i < first + count && i < this->view_.size(); ++i) {
+        const Entry& entry = this->entries_[this->view_[i]];
+        if (entry.type == Type::File && !entry.sniffed && !entry.queued) {
+            batch.push_back(this->view_[i]);
+        }
+    }
+    if (!batch.empty()) {
+        this->Queue(std::move(batch));
+    }
+
+    // then the rest in the order they were read, while the pool has room
+    size_t room = std::max<size_t>(this->pool_.Size() / 2, 1);
+    {
+        std::lock_guard<std::mutex> lock(this->results_->mutex);
+        room -= std::min(room, this->results_->tasks);
+    }
+    for (; room > 0 && this->sniff_next_ < this->entries_.size(); --room) {
+        batch.clear();
+        size_t next = this->sniff_next_;
+        for (; next < this->entries_.size() && batch.size() < kSniffBatch; ++next) {
+            const Entry& entry = this->entries_[next];
+            if (entry.type == Type::File && !entry.sniffed && !entry.queued) {
+                batch.push_back((uint32_t)next);
+            }
+        }
+        if (!batch.empty() && !this->Queue(std::move(batch))) {
+            break; // picked up by a later call
+        }
+        this->sniff_next_ = next;
+    }
+
+    return this->Merge();
+}
+
+bool DirectoryListing::Queue(std::vector<uint32_t> batch) {
+    std::vector<std::pair<uint32_t, std::filesystem::path>> files;
+    files.reserve(batch.size());
+    for (const uint32_t index : batch) {
+        files.emplace_back(index, this->dir_ / this->entries_[index].name);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->results_->mutex);
+        this->results_->tasks++;
+    }
+    const bool queued = this->pool_.TrySubmit([results = this->results_, files = std::move(files)] {
+        TraceSpan span("sniff formats");
+        std::vector<std::pair<uint32_t, FileFormat>> formats;
+        formats.reserve(files.size());
+        for (const auto& [index, path] : files) {
+            if (results->cancelled) {
+                break;
+            }
+            formats.emplace_back(index, sniffFormat(path));
+        }
+
+        std::lock_guard<std::mutex> lock(results->mutex);
+        results->formats.insert(results->formats.end(), formats.begin(), formats.end());
+        results->tasks--;
+    });
+    if (!queued) {
+        std::lock_guard<std::mutex> lock(this->results_->mutex);
+        this->results_->tasks--;
+        return false;
+    }
+
+    for (const uint32_t index : batch) {
+        this->entries_[index].queued = true;
+    }
+    this->sniff_pending_ += batch.size();
+    return true;
+}
+
+// Takes in the formats that came back, moving the files they sort differently into place
+bool DirectoryListing::Merge() {
+    std::vector<std::pair<uint32_t, FileFormat>> formats;
+    {
+        std::lock_guard<std::mutex> lock(this->results_->mutex);
+        formats.swap(this->results_->formats);
+    }
+    if (formats.empty()) {
+        return false;
+    }
+
+    TraceSpan span("merge formats");
+    span.Detail(this->dir_.string());
+
+    std::vector<uint32_t> moved;
+    for (const auto& [index, format] : formats) {
+        Entry& entry = this->entries_[index];
+        entry.format = format;
+        entry.sniffed = true;
+        if (format != FileFormat::Unknown) {
+            this->media_++;
+            this->read_only_ += formatInfo(format).writable ? 0 : 1;
+        }
+        if (this->Matches(entry)) {
+            moved.push_back(index);
+        }
+    }
+    this->sniff_pending_ -= formats.size();
+
+    if (this->sort_ == SortKey::Type && !moved.empty()) {
+        // out of the view and merged back in where the format puts them, like newly read entries
+        std::sort(moved.begin(), moved.end());
+        this->view_.erase(std::remove_if(this->view_.begin(), this->view_.end(),
+                                         [&moved](uint32_t index) { return std::binary_search(moved.begin(), moved.end(), index); }),
+                          this->view_.end());
+
+        const auto before = [this](uint32_t a, uint32_t b) { return this->Before(a, b); };
+        std::sort(moved.begin(), moved.end(), before);
+        const size_t middle = this->view_.size();
+        this->view_.insert(this->view_.end(), moved.begin(), moved.end());
+        std::inplace_merge(this->view_.begin(), this->view_.begin() + middle, this->view_.end(), before);
+    }
+    return true;
+}
+
+void DirectoryListing::Fill(Entry& entry) {
+    if (this->sort_ == SortKey::Size || this->sort_ == SortKey::Mtime) {
+        this->StatEntry(entry);
+    }
+}
+
+void DirectoryListing::Sort(SortKey key) {
+    this->sort_ = key;
+    for (auto& entry : this->entries_) {
+        this->Fill(entry);
+    }
+    this->Rebuild();
+}
+
+void DirectoryListing::Filter(const std::string& text) {
+    this->filter_ = lowercase(text);
+    this->Rebuild();
+}
+
+bool DirectoryListing::Matches(const Entry& entry) const {
+    return this->filter_.empty() || (this->has_parent_ && &entry == &this->entries_[0]) ||
+           lowercase(entry.name).find(this->filter_) != std::string::npos;
+}
+
+// Largest and newest first, directories before files grouped by format, files whose format hasn't
+// come back last; ties by name, then read order
+bool DirectoryListing::Before(uint32_t a, uint32_t b) const {
+    if (this->has_parent_ && (a == 0 || b == 0)) {
+        return a == 0 && b != 0;
+    }
+
+    const Entry& x = this->entries_[a];
+    const Entry& y = this->entries_[b];
+    switch (this->sort_) {
+    case SortKey::None:
+        return a < b;
+    case SortKey::Size:
+        if (x.size != y.size) {
+            return x.size > y.size;
+        }
+        break;
+    case SortKey::Mtime:
+        if (x.mtime_ns != y.mtime_ns) {
+            return x.mtime_ns > y.mtime_ns;
+        }
+        break;
+    case SortKey::Type:
+        if (x.type != y.type) {
+            return x.type < y.type;
+        }
+        if (x.sniffed != y.sniffed) {
+            return x.sniffed;
+        }
+        if (x.format != y.format) {
+            return x.format < y.format;
+        }
+        break;
+    case SortKey::Name:
+        break;
+    }
+    return x.name != y.name ? x.name < y.name : a < b;
+}
+
+void DirectoryListing::Rebuild() {
+    this->view_.clear();
+    for (size_t i = 0; i < this->entries_.size(); ++i) {
+        if (this->Matches(this->entries_[i])) {
+            this->view_.push_back((uint32_t)i);
+        }
+    }
+    if (this->sort_ != SortKey::None) {
+        std::sort(this->view_.begin(), this->view_.end(), [this](uint32_t a, uint32_t b) { return this->Before(a, b); });
+    }
+}
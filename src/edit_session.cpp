@@ -0,0 +1,68 @@
+#include <metoxid/edit_session.hpp>
+
+void EditSession::Begin(FieldMap::value_type& field) {
+    this->field_ = &field;
+    this->schema_ = findTag(field.first);
+    this->original_ = toDisplayString(field.second);
+    this->text_.Assign(this->original_);
+}
+
+void EditSession::Begin(XmpTree& tree, size_t node, FieldMap::value_type& packet) {
+    this->Begin(packet);
+    this->schema_ = nullptr;
+    this->tree_ = &tree;
+    this->node_ = node;
+    this->original_ = tree.Value(node);
+    this->text_.Assign(this->original_);
+}
+
+bool EditSession::Type(char ch) {
+    if (this->schema_ != nullptr && !acceptsChar(*this->schema_, ch)) {
+        return false;
+    }
+    this->text_.Insert(ch);
+    return true;
+}
+
+bool EditSession::Step(int delta) {
+    if (this->schema_ == nullptr) {
+        return false;
+    }
+    const auto value = stepValue(*this->schema_, this->text_.String(), delta);
+    if (!value) {
+        return false;
+    }
+    this->text_.Assign(*value);
+    return true;
+}
+
+std::string EditSession::Problem() const {
+    if (this->schema_ == nullptr) {
+        return "";
+    }
+    return checkValue(*this->schema_, this->text_.String());
+}
+
+void EditSession::Commit() {
+    const std::string text = this->text_.String();
+    if (text != this->original_) { //left as it was, nothing becomes dirty
+        if (this->tree_ != nullptr) { //spliced into a copy, the tree only changes once the packet was taken
+            XmpTree updated = *this->tree_;
+            updated.Set(this->node_, text);
+            this->metadata_.Apply(*this->field_, updated.Packet());
+            *this->tree_ = std::move(updated);
+        } else {
+            this->metadata_.Apply(*this->field_, text);
+        }
+    }
+    this->Cancel();
+}
+
+void EditSession::Cancel() {
+    this->field_ = nullptr;
+    this->schema_ = nullptr;
+    this->tree_ = nullptr;
+    this->node_ = XmpTree::kRoot;
+    this->text_.Assign("");
+    this->original_.clear();
+}
@@ -0,0 +1,134 @@
+#include <metoxid/field_map.hpp>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+struct KeyTable {
+    std::shared_mutex mutex;
+    std::deque<std::string> keys; // a deque never moves what it already holds
+    std::unordered_map<std::string_view, const std::string*> index; // views into keys
+};
+
+} // namespace
+
+const std::string& internKey(std::string_view key) {
+    static KeyTable table;
+
+    {
+        std::shared_lock<std::shared_mutex> lock(table.mutex); // after the first few files every key is already there
+        const auto found = table.index.find(key);
+        if (found != table.index.end()) {
+            return *found->second;
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(table.mutex);
+    const auto found = table.index.find(key); // another thread may have added it meanwhile
+    if (found != table.index.end()) {
+        return *found->second;
+    }
+    const std::string& interned = table.keys.emplace_back(key);
+    table.index.emplace(interned, &interned);
+    return interned;
+}
+
+bool isKnownKey(std::string_view key) {
+    if (key == "Comment" || key == "XMP Packet") {
+        return true;
+    }
+    if (key.rfind("Exif.", 0) != 0 && key.rfind("Iptc.", 0) != 0) {
+        return false;
+    }
+    return key.compare(key.rfind('.') + 1, 2, "0x") != 0;
+}
+
+std::string_view StringArena::Copy(std::string_view text) {
+    if (text.empty()) {
+        return {};
+    }
+
+    if (text.size() > this->left_) {
+        if (text.size() > this->block_size_ / 2) { // a block of its own, the current one still has room for small strings
+            this->blocks_.push_back({std::make_unique<char[]>(text.size()), text.size(), false});
+            this->allocated_ += text.size();
+            std::memcpy(this->blocks_.back().data.get(), text.data(), text.size());
+            return std::string_view(this->blocks_.back().data.get(), text.size());
+        }
+
+        this->blocks_.push_back({std::make_unique<char[]>(this->block_size_), this->block_size_, true});
+        this->allocated_ += this->block_size_;
+        this->next_ = this->blocks_.back().data.get();
+        this->left_ = this->block_size_;
+        this->block_size_ = std::min<size_t>(this->block_size_ * 2, 64 * 1024);
+    }
+
+    char* copy = this->next_;
+    std::memcpy(copy, text.data(), text.size());
+    this->next_ += text.size();
+    this->left_ -= text.size();
+    return std::string_view(copy, text.size());
+}
+
+std::string_view StringArena::Replace(std::string_view old, std::string_view text) {
+    for (auto block = this->blocks_.rbegin(); block != this->blocks_.rend(); ++block) {
+        if (!block->shared && block->data.get() == old.data() && !old.empty()) {
+            this->allocated_ -= block->size;
+            this->blocks_.erase(std::next(block).base());
+            break;
+        }
+    }
+    return this->Copy(text);
+}
+
+const std::string& StringArena::Key(std::string_view key) {
+    if (isKnownKey(key)) {
+        return internKey(key);
+    }
+    this->allocated_ += key.size();
+    return this->keys_.emplace_back(key);
+}
+
+FieldMap::FieldMap(const std::function<void(const FieldVisitor&)>& source, StringArena& arena) {
+    std::vector<std::pair<const std::string*, MetadataValue>> visited;
+    source([&](const std::string& key, const MetadataValue& value) {
+        MetadataValue stored = value;
+        if (auto* text = std::get_if<std::string_view>(&stored)) {
+            *text = arena.Copy(*text); // the source's string may be a temporary
+        }
+        visited.emplace_back(&arena.Key(key), stored);
+    });
+
+    std::stable_sort(visited.begin(), visited.end(), [](const auto& a, const auto& b) { return *a.first < *b.first; });
+
+    this->fields_.reserve(visited.size());
+    for (const auto& field : visited) {
+        if (this->fields_.empty() || this->fields_.back().first != *field.first) {
+            this->fields_.push_back({*field.first, field.second});
+        }
+    }
+}
+
+FieldMap::iterator FieldMap::find(std::string_view key) {
+    const auto found = std::lower_bound(this->fields_.begin(), this->fields_.end(), key, [](const Field& field, std::string_view key) {
+        return std::string_view(field.first) < key;
+    });
+    return found != this->fields_.end() && found->first == key ? found : this->fields_.end();
+}
+
+FieldMap::const_iterator FieldMap::find(std::string_view key) const {
+    return const_cast<FieldMap*>(this)->find(key);
+}
+
+const MetadataValue& FieldMap::at(std::string_view key) const {
+    const auto found = this->find(key);
+    if (found == this->end()) {
+        throw std::out_of_range("no field " + std::string(key));
+    }
+    return found->second;
+}
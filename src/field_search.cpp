@@ -0,0 +1,131 @@
+#include <metoxid/field_search.hpp>
+#include <metoxid/row_model.hpp>
+#include <algorithm>
+#include <cctype>
+
+namespace {
+
+std::string lowercase(std::string_view text) {
+    std::string lower(text);
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return lower;
+}
+
+uint32_t trigram(const char* text) {
+    return (uint32_t)(unsigned char)text[0] << 16 | (uint32_t)(unsigned char)text[1] << 8 | (unsigned char)text[2];
+}
+
+std::vector<std::string> splitTerms(std::string_view query) {
+    std::vector<std::string> terms;
+    size_t start = 0;
+    while (start < query.size()) {
+        size_t end = query.find(' ', start);
+        if (end == std::string_view::npos) {
+            end = query.size();
+        }
+        if (end > start) {
+            terms.push_back(lowercase(query.substr(start, end - start)));
+        }
+        start = end + 1;
+    }
+    return terms;
+}
+
+bool matchesAll(const std::string& text, const std::vector<std::string>& terms) {
+    for (const auto& term : terms) {
+        if (text.find(term) == std::string::npos) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+FieldSearch::FieldSearch(std::vector<Category>& categories) {
+    for (size_t i = 0; i < categories.size(); ++i) {
+        for (auto& field : categories[i].Fields()) { //sorted by key, so the ids are in the order rows show them
+            const uint32_t id = (uint32_t)this->entries_.size();
+            this->entries_.push_back({i, &field, "", ""});
+            this->ids_[&field] = id;
+            this->Index(id);
+        }
+    }
+}
+
+void FieldSearch::Index(uint32_t id) {
+    Entry& entry = this->entries_[id];
+    entry.display = oneLine(toDisplayString(entry.field->second));
+    entry.text = lowercase(entry.field->first) + '\n' + lowercase(entry.display);
+
+    for (size_t i = 0; i + 3 <= entry.text.size(); ++i) {
+        auto& postings = this->trigrams_[trigram(entry.text.data() + i)];
+        if (postings.empty() || postings.back() != id) {
+            postings.push_back(id);
+        }
+    }
+}
+
+void FieldSearch::Refresh(const FieldMap::value_type* field) {
+    const auto id = this->ids_.find(field);
+    if (id == this->ids_.end()) {
+        return;
+    }
+
+    // the old trigrams stay in the index, candidates are always checked against the text anyway
+    this->Index(id->second);
+    this->last_query_.clear();
+    this->last_matches_.clear();
+    this->searched_ = false;
+}
+
+const std::vector<uint32_t>& FieldSearch::Find(std::string_view query) {
+    const std::vector<std::string> terms = splitTerms(query);
+
+    // the smallest posting list of any trigram in the query
+    const std::vector<uint32_t>* candidates = nullptr;
+    static const std::vector<uint32_t> no_candidates;
+    for (const auto& term : terms) {
+        for (size_t i = 0; i + 3 <= term.size(); ++i) {
+            const auto postings = this->trigrams_.find(trigram(term.data() + i));
+            if (postings == this->trigrams_.end()) {
+                candidates = &no_candidates; //a trigram nothing has can't match
+            } else if (candidates == nullptr || postings->second.size() < candidates->size()) {
+                candidates = &postings->second;
+            }
+        }
+    }
+
+    // every match of a longer query was a match of the one it extends
+    const bool refines = this->searched_ && query.substr(0, this->last_query_.size()) == this->last_query_;
+    bool from_postings = candidates != nullptr;
+    if (refines && (candidates == nullptr || this->last_matches_.size() <= candidates->size())) {
+        candidates = &this->last_matches_;
+        from_postings = false;
+    }
+
+    std::vector<uint32_t> matches;
+    if (candidates == nullptr) { //first query and only terms shorter than a trigram
+        for (uint32_t id = 0; id < this->entries_.size(); ++id) {
+            if (matchesAll(this->entries_[id].text, terms)) {
+                matches.push_back(id);
+            }
+        }
+    } else {
+        for (uint32_t id : *candidates) {
+            if (matchesAll(this->entries_[id].text, terms)) {
+                matches.push_back(id);
+            }
+        }
+    }
+
+    if (from_postings) { //refreshed entries are appended to the postings out of order, and possibly twice
+        std::sort(matches.begin(), matches.end());
+        matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+    }
+
+    this->last_query_ = std::string(query);
+    this->last_matches_ = std::move(matches);
+    this->searched_ = true;
+    return this->last_matches_;
+}
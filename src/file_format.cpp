@@ -0,0 +1,160 @@
+#include <metoxid/file_format.hpp>
+#include <metoxid/file_io.hpp>
+#include <array>
+#include <cstdint>
+#include <system_error>
+
+namespace {
+
+struct Signature {
+    size_t offset;
+    std::string_view magic;
+    FileFormat format;
+    std::string_view lead = {}; // what the file has to start with as well, for magic further in
+};
+
+using namespace std::string_view_literals;
+
+// Checked in order, so more specific signatures come before the ones they share a prefix with.
+constexpr Signature kSignatures[] = {
+    {0, "\xff\xd8\xff"sv, FileFormat::Jpeg},
+    {0, "II*\0\x10\0\0\0CR"sv, FileFormat::Cr2},
+    {0, "II*\0"sv, FileFormat::Tiff},
+    {0, "MM\0*"sv, FileFormat::Tiff},
+    {0, "IIRO"sv, FileFormat::Orf},
+    {0, "IIRS"sv, FileFormat::Orf},
+    {0, "MMOR"sv, FileFormat::Orf},
+    {0, "IIU\0"sv, FileFormat::Rw2},
+    {0, "II\x1a\0\0\0HEAPCCDR"sv, FileFormat::Crw},
+    {0, "FUJIFILM"sv, FileFormat::Raf},
+    {0, "\0MRM"sv, FileFormat::Mrw},
+    {0, "\x89PNG\r\n\x1a\n"sv, FileFormat::Png},
+    {0, "GIF87a"sv, FileFormat::Gif},
+    {0, "GIF89a"sv, FileFormat::Gif},
+    {8, "WEBP"sv, FileFormat::WebP, "RIFF"sv}, // RIFF containers, told apart by their form type
+    {8, "AVI "sv, FileFormat::Riff, "RIFF"sv},
+    {0, "8BPS"sv, FileFormat::Psd},
+    {0, "BM"sv, FileFormat::Bmp},
+    {0, "\0\0\0\x0cjP  \r\n\x87\n"sv, FileFormat::Jp2},
+    {0, "\0\0\0\x0cJXL \r\n\x87\n"sv, FileFormat::Jxl},
+    {0, "\xff\x0a"sv, FileFormat::Jxl}, // bare codestream
+    {4, "ftypheic"sv, FileFormat::Heif},
+    {4, "ftypheix"sv, FileFormat::Heif},
+    {4, "ftyphevc"sv, FileFormat::Heif},
+    {4, "ftypheim"sv, FileFormat::Heif},
+    {4, "ftypheis"sv, FileFormat::Heif},
+    {4, "ftyphevm"sv, FileFormat::Heif},
+    {4, "ftyphevs"sv, FileFormat::Heif},
+    {4, "ftypmif1"sv, FileFormat::Heif},
+    {4, "ftypmsf1"sv, FileFormat::Heif},
+    {4, "ftypavif"sv, FileFormat::Avif},
+    {4, "ftypavis"sv, FileFormat::Avif},
+    {4, "ftypcrx "sv, FileFormat::Cr3},
+    {4, "ftyp"sv, FileFormat::QuickTime},
+    {0, "\x1a\x45\xdf\xa3"sv, FileFormat::Matroska},
+    {0, "\x30\x26\xb2\x75\x8e\x66\xcf\x11"sv, FileFormat::Asf},
+    {0, "%!PS-Adobe-"sv, FileFormat::Eps},
+    {0, "\xc5\xd0\xd3\xc6"sv, FileFormat::Eps}, // DOS EPS binary header
+    {0, "PGF"sv, FileFormat::Pgf},
+    {0, "<?xpacket"sv, FileFormat::Xmp},
+    {0, "<x:xmpmeta"sv, FileFormat::Xmp},
+    {0, "\xff\x01" "Exiv2"sv, FileFormat::Exv},
+};
+
+constexpr size_t kSignatureCount = sizeof(kSignatures) / sizeof(kSignatures[0]);
+static_assert(kSignatureCount <= 64, "candidate sets are 64-bit masks");
+
+constexpr bool fitsSniff() {
+    for (const auto& signature : kSignatures) {
+        if (signature.offset + signature.magic.size() > kSniffBytes) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(fitsSniff(), "kSniffBytes must cover every signature");
+
+// For every possible first byte, the signatures that can still match: the ones starting
+// with that byte plus the ones that may start with anything (ftyp boxes). Most files rule out all but
+// one or two signatures before a single comparison.
+constexpr std::array<uint64_t, 256> buildCandidates() {
+    std::array<uint64_t, 256> candidates{};
+    for (size_t i = 0; i < kSignatureCount; ++i) {
+        for (size_t byte = 0; byte < 256; ++byte) {
+            const Signature& signature = kSignatures[i];
+            const std::string_view start = signature.offset == 0 ? signature.magic : signature.lead;
+            if (start.empty() || (uint8_t)start[0] == byte) {
+                candidates[byte] |= uint64_t(1) << i;
+            }
+        }
+    }
+    return candidates;
+}
+
+constexpr std::array<uint64_t, 256> kCandidates = buildCandidates();
+
+constexpr FormatInfo kFormats[] = {
+    {"", false}, // Unknown
+    {"JPEG", true},
+    {"TIFF", true},
+    {"CR2", true},
+    {"ORF", true},
+    {"RW2", false},
+    {"CRW", true},
+    {"RAF", false},
+    {"MRW", false},
+    {"PNG", true},
+    {"GIF", false},
+    {"WebP", true},
+    {"PSD", true},
+    {"BMP", false},
+    {"JP2", true},
+    {"JXL", false},
+    {"HEIF", false},
+    {"AVIF", false},
+    {"CR3", false},
+    {"MP4", false},
+    {"MKV", false},
+    {"ASF", false},
+    {"AVI", false},
+    {"EPS", true},
+    {"PGF", true},
+    {"XMP", true},
+    {"EXV", true},
+};
+static_assert(sizeof(kFormats) / sizeof(kFormats[0]) == size_t(FileFormat::Exv) + 1, "one entry per FileFormat");
+
+} // namespace
+
+const FormatInfo& formatInfo(FileFormat format) {
+    return kFormats[size_t(format)];
+}
+
+FileFormat detectFormat(std::string_view header) {
+    if (header.empty()) {
+        return FileFormat::Unknown;
+    }
+
+    for (uint64_t candidates = kCandidates[(uint8_t)header[0]]; candidates != 0; candidates &= candidates - 1) {
+        size_t i = 0;
+        while ((candidates & (uint64_t(1) << i)) == 0) { // lowest set bit, the earliest signature left
+            i++;
+        }
+
+        const Signature& signature = kSignatures[i];
+        if (header.size() >= signature.offset + signature.magic.size() &&
+            header.substr(signature.offset, signature.magic.size()) == signature.magic &&
+            header.substr(0, signature.lead.size()) == signature.lead) {
+            return signature.format;
+        }
+    }
+    return FileFormat::Unknown;
+}
+
+FileFormat sniffFormat(const std::filesystem::path& path) {
+    try {
+        return detectFormat(readFileHeader(path, kSniffBytes));
+    } catch (const std::system_error&) {
+        return FileFormat::Unknown;
+    }
+}
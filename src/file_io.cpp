@@ -0,0 +1,528 @@
+#include <metoxid.hpp>
+#include <metoxid/file_io.hpp>
+#include <metoxid/trace.hpp>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <system_error>
+#if defined(METOXID_WINDOWS)
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(METOXID_LINUX) || defined(METOXID_MACOS)
+#include <sys/xattr.h>
+#endif
+
+namespace {
+
+[[noreturn]] void throwErrno(const std::string& what, const std::filesystem::path& path) {
+    throw std::system_error(errno, std::generic_category(), what + " " + path.string());
+}
+
+// false with errno set if a write failed
+bool writeAll(int fd, const uint8_t* data, size_t size) {
+    size_t written = 0;
+    while (written < size) {
+#if defined(METOXID_WINDOWS)
+        const int chunk = size - written > (1u << 30) ? (1 << 30) : static_cast<int>(size - written);
+        const int result = _write(fd, data + written, chunk);
+#else
+        const ssize_t result = write(fd, data + written, size - written);
+#endif
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        written += static_cast<size_t>(result);
+    }
+    return true;
+}
+
+// The file path names once symlinks are followed, so replacing it replaces what the link
+// points at and leaves the link alone. A dangling link resolves to its missing target.
+std::filesystem::path resolveLinks(std::filesystem::path path) {
+    std::error_code ec;
+    for (int depth = 0; depth < 40 && std::filesystem::is_symlink(path, ec); ++depth) { // 40 is Linux's MAXSYMLINKS
+        const auto target = std::filesystem::read_symlink(path, ec);
+        if (ec) {
+            break;
+        }
+        path = target.is_absolute() ? target : path.parent_path() / target;
+    }
+    return path;
+}
+
+#if defined(METOXID_LINUX) || defined(METOXID_MACOS)
+// Copies the extended attributes of from (macOS Finder tags and quarantine, Linux user.* and
+// security labels) onto to. Attributes we aren't allowed to set are left out.
+void copyAttributes(const std::filesystem::path& from, int to) {
+#if defined(METOXID_MACOS)
+    const ssize_t size = listxattr(from.c_str(), nullptr, 0, 0);
+#else
+    const ssize_t size = listxattr(from.c_str(), nullptr, 0);
+#endif
+    if (size <= 0) {
+        return;
+    }
+    std::string names(static_cast<size_t>(size), '\0');
+#if defined(METOXID_MACOS)
+    const ssize_t listed = listxattr(from.c_str(), names.data(), names.size(), 0);
+#else
+    const ssize_t listed = listxattr(from.c_str(), names.data(), names.size());
+#endif
+
+    for (size_t offset = 0; listed > 0 && offset < static_cast<size_t>(listed); offset += std::strlen(names.c_str() + offset) + 1) {
+        const char* name = names.c_str() + offset;
+#if defined(METOXID_MACOS)
+        const ssize_t length = getxattr(from.c_str(), name, nullptr, 0, 0, 0);
+#else
+        const ssize_t length = getxattr(from.c_str(), name, nullptr, 0);
+#endif
+        if (length < 0) {
+            continue;
+        }
+        std::string value(static_cast<size_t>(length), '\0');
+#if defined(METOXID_MACOS)
+        if (getxattr(from.c_str(), name, value.data(), value.size(), 0, 0) == length) {
+            fsetxattr(to, name, value.data(), value.size(), 0, 0);
+        }
+#else
+        if (getxattr(from.c_str(), name, value.data(), value.size()) == length) {
+            fsetxattr(to, name, value.data(), value.size(), 0);
+        }
+#endif
+    }
+}
+#endif
+
+} // namespace
+
+#if defined(METOXID_WINDOWS)
+
+std::optional<FileStamp> FileStamp::Of(const std::filesystem::path& path) {
+    std::error_code ec;
+    FileStamp stamp;
+
+    const auto mtime = std::filesystem::last_write_time(path, ec);
+    if (ec) {
+        return std::nullopt;
+    }
+    stamp.mtime_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(mtime.time_since_epoch()).count();
+    stamp.size = std::filesystem::file_size(path, ec);
+    if (ec) {
+        stamp.size = 0; // directories have no size
+    }
+    return stamp;
+}
+
+#else
+
+namespace {
+
+FileStamp stampOf(const struct stat& st) {
+    FileStamp stamp;
+    stamp.inode = static_cast<uint64_t>(st.st_ino);
+    stamp.size = S_ISREG(st.st_mode) ? static_cast<uint64_t>(st.st_size) : 0;
+#if defined(METOXID_MACOS)
+    stamp.mtime_ns = int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    stamp.mtime_ns = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return stamp;
+}
+
+} // namespace
+
+std::optional<FileStamp> FileStamp::Of(const std::filesystem::path& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return std::nullopt;
+    }
+    return stampOf(st);
+}
+
+#endif
+
+#if defined(METOXID_WINDOWS)
+
+std::shared_ptr<const MappedFile> MappedFile::Open(const std::filesystem::path& path) {
+    TraceSpan span("map");
+    span.Detail(path.string());
+    std::shared_ptr<MappedFile> file(new MappedFile());
+    file->path_ = path;
+
+    HANDLE handle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        throw std::system_error(GetLastError(), std::system_category(), "failed to open " + path.string());
+    }
+    if (const auto stamp = FileStamp::Of(path)) { // by path, like every stamp on Windows
+        file->stamp_ = *stamp;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size)) {
+        const DWORD error = GetLastError();
+        CloseHandle(handle);
+        throw std::system_error(error, std::system_category(), "failed to stat " + path.string());
+    }
+
+    if (size.QuadPart > 0) {
+        file->mapping_ = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        const DWORD error = GetLastError();
+        CloseHandle(handle); // the mapping keeps the file open
+
+        if (file->mapping_ == nullptr) {
+            throw std::system_error(error, std::system_category(), "failed to map " + path.string());
+        }
+
+        file->data_ = static_cast<const uint8_t*>(MapViewOfFile(file->mapping_, FILE_MAP_READ, 0, 0, 0));
+        if (file->data_ == nullptr) {
+            throw std::system_error(GetLastError(), std::system_category(), "failed to map " + path.string());
+        }
+        file->size_ = static_cast<size_t>(size.QuadPart);
+        span.Bytes(file->size_);
+    } else {
+        CloseHandle(handle);
+    }
+
+    return file;
+}
+
+void MappedFile::Prefetch() const {
+    if (this->data_ != nullptr) {
+        WIN32_MEMORY_RANGE_ENTRY range{const_cast<uint8_t*>(this->data_), this->size_};
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (this->data_ != nullptr) {
+        UnmapViewOfFile(this->data_);
+    }
+    if (this->mapping_ != nullptr) {
+        CloseHandle(this->mapping_);
+    }
+}
+
+#else
+
+std::shared_ptr<const MappedFile> MappedFile::Open(const std::filesystem::path& path) {
+    TraceSpan span("map");
+    span.Detail(path.string());
+    std::shared_ptr<MappedFile> file(new MappedFile());
+    file->path_ = path;
+
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throwErrno("failed to open", path);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        const int error = errno;
+        close(fd);
+        errno = error;
+        throwErrno("failed to stat", path);
+    }
+    file->stamp_ = stampOf(st); // of the file mapped, whatever is at path by now
+
+    if (st.st_size > 0) {
+        void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        const int error = errno;
+        close(fd); // the mapping keeps the file open
+
+        if (data == MAP_FAILED) {
+            errno = error;
+            throwErrno("failed to map", path);
+        }
+
+        // Metadata parsers jump between a few small ranges, read-ahead of the pixel data is wasted I/O.
+        madvise(data, static_cast<size_t>(st.st_size), MADV_RANDOM);
+
+        file->data_ = static_cast<const uint8_t*>(data);
+        file->size_ = static_cast<size_t>(st.st_size);
+        span.Bytes(file->size_);
+    } else {
+        close(fd);
+    }
+
+    return file;
+}
+
+void MappedFile::Prefetch() const {
+    if (this->data_ != nullptr) {
+        madvise(const_cast<uint8_t*>(this->data_), this->size_, MADV_WILLNEED);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (this->data_ != nullptr) {
+        munmap(const_cast<uint8_t*>(this->data_), this->size_);
+    }
+}
+
+#endif
+
+void writeFileAtomically(const std::filesystem::path& path, const uint8_t* data, size_t size) {
+    TraceSpan span("write file");
+    span.Detail(path.string());
+    span.Bytes(size);
+
+    const std::filesystem::path target = resolveLinks(path);
+    const std::filesystem::path parent = target.has_parent_path() ? target.parent_path() : std::filesystem::path(".");
+    std::filesystem::path temp;
+    std::error_code ec;
+
+#if defined(METOXID_WINDOWS)
+    // keep the permissions of the file being replaced
+    const auto permissions = std::filesystem::status(target, ec).permissions();
+    const bool replacing = !ec;
+
+    int fd = -1;
+    for (unsigned attempt = 0; fd < 0 && attempt < 100; ++attempt) { // unique, so concurrent writers of one file don't share it
+        temp = parent / (L"." + target.filename().wstring() + L".metoxid-" + std::to_wstring(GetCurrentProcessId()) + L"-" + std::to_wstring(GetTickCount64() + attempt));
+        fd = _wopen(temp.c_str(), _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+        if (fd < 0 && errno != EEXIST) {
+            break;
+        }
+    }
+#else
+    std::string pattern = (parent / ("." + target.filename().string() + ".metoxid-XXXXXX")).string();
+    const int fd = mkstemp(pattern.data()); // unique, so concurrent writers of one file don't share it
+    temp = pattern;
+#endif
+    if (fd < 0) {
+        throwErrno("failed to create", temp);
+    }
+
+    auto fail = [&](const char* what) {
+        const int error = errno;
+#if defined(METOXID_WINDOWS)
+        _close(fd);
+#else
+        close(fd);
+#endif
+        std::error_code ignored;
+        std::filesystem::remove(temp, ignored);
+        errno = error;
+        throwErrno(what, temp);
+    };
+
+#if !defined(METOXID_WINDOWS)
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    // The replacement takes over the owner, mode and extended attributes of the file it
+    // replaces (a new file stays 0600). Giving a file away needs privileges, so when that
+    // fails at least the group is kept; the mode comes after, a chown clears set-id bits.
+    struct stat original;
+    if (stat(target.c_str(), &original) == 0) {
+        if (fchown(fd, original.st_uid, original.st_gid) != 0 && fchown(fd, (uid_t)-1, original.st_gid) != 0) {
+            // not in the group either: the file stays ours
+        }
+        if (fchmod(fd, original.st_mode & 07777) != 0) {
+            fail("failed to set the permissions of");
+        }
+        copyAttributes(target, fd);
+    }
+#endif
+
+    if (!writeAll(fd, data, size)) {
+        fail("failed to write");
+    }
+
+#if defined(METOXID_WINDOWS)
+    if (_commit(fd) != 0) {
+        fail("failed to flush");
+    }
+    _close(fd);
+    if (replacing) {
+        std::filesystem::permissions(temp, permissions, ec);
+    }
+#else
+    if (fsync(fd) != 0) {
+        fail("failed to flush");
+    }
+    close(fd);
+#endif
+
+    std::filesystem::rename(temp, target, ec);
+    if (ec) {
+        std::error_code ignored;
+        std::filesystem::remove(temp, ignored);
+        throw std::system_error(ec, "failed to replace " + target.string());
+    }
+
+#if !defined(METOXID_WINDOWS)
+    // make the rename itself durable
+    const int dir = open(parent.c_str(), O_RDONLY | O_CLOEXEC);
+    if (dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+#endif
+}
+
+void writeFile(const std::filesystem::path& path, const uint8_t* data, size_t size) {
+    TraceSpan span("write file");
+    span.Detail(path.string());
+    span.Bytes(size);
+
+#if defined(METOXID_WINDOWS)
+    const int fd = _wopen(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+#endif
+    if (fd < 0) {
+        throwErrno("failed to create", path);
+    }
+
+    const bool written = writeAll(fd, data, size);
+    const int error = errno;
+#if defined(METOXID_WINDOWS)
+    _close(fd);
+#else
+    close(fd);
+#endif
+    if (!written) {
+        errno = error;
+        throwErrno("failed to write", path);
+    }
+}
+
+FileStamp patchFile(const std::filesystem::path& path, const FileStamp& expected, const std::vector<FilePatch>& patches) {
+    if (patches.empty()) {
+        return expected;
+    }
+
+    TraceSpan span("patch file");
+    span.Detail(path.string());
+    uint64_t patched = 0;
+    for (const auto& patch : patches) {
+        patched += patch.bytes.size();
+    }
+    span.Bytes(patched);
+
+#if defined(METOXID_WINDOWS)
+    const int fd = _wopen(path.c_str(), _O_WRONLY | _O_BINARY);
+#else
+    const int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+#endif
+    if (fd < 0) {
+        throwErrno("failed to open", path);
+    }
+
+    auto fail = [&](const char* what) {
+        const int error = errno;
+#if defined(METOXID_WINDOWS)
+        _close(fd);
+#else
+        close(fd);
+#endif
+        errno = error;
+        throwErrno(what, path);
+    };
+
+    // The offsets were worked out from an earlier read. A file replaced by another writer,
+    // even by one of the same size, or written to since, isn't that file anymore.
+#if defined(METOXID_WINDOWS)
+    const auto current = FileStamp::Of(path);
+    const bool same_file = current && *current == expected;
+#else
+    struct stat st;
+    const bool same_file = fstat(fd, &st) == 0 && stampOf(st) == expected;
+#endif
+    if (!same_file) {
+        errno = ESTALE;
+        fail("changed on disk, not patching");
+    }
+
+    for (const auto& patch : patches) {
+        if (patch.offset + patch.bytes.size() > expected.size) {
+            errno = EINVAL;
+            fail("patch past the end of");
+        }
+
+        size_t written = 0;
+        while (written < patch.bytes.size()) {
+#if defined(METOXID_WINDOWS)
+            if (_lseeki64(fd, static_cast<int64_t>(patch.offset + written), SEEK_SET) < 0) {
+                fail("failed to seek in");
+            }
+            const int result = _write(fd, patch.bytes.data() + written, static_cast<unsigned>(patch.bytes.size() - written));
+#else
+            const ssize_t result = pwrite(fd, patch.bytes.data() + written, patch.bytes.size() - written, static_cast<off_t>(patch.offset + written));
+#endif
+            if (result < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fail("failed to write");
+            }
+            written += static_cast<size_t>(result);
+        }
+    }
+
+#if defined(METOXID_WINDOWS)
+    if (_commit(fd) != 0) {
+#else
+    if (fsync(fd) != 0) {
+#endif
+        fail("failed to flush");
+    }
+
+#if defined(METOXID_WINDOWS)
+    _close(fd);
+    return FileStamp::Of(path).value_or(FileStamp{});
+#else
+    const FileStamp written = fstat(fd, &st) == 0 ? stampOf(st) : FileStamp{};
+    close(fd);
+    return written;
+#endif
+}
+
+std::string readFileHeader(const std::filesystem::path& path, size_t n) {
+    TraceSpan span("read header");
+    span.Bytes(n);
+#if defined(METOXID_WINDOWS)
+    const int fd = _wopen(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+    if (fd < 0) {
+        throwErrno("failed to open", path);
+    }
+
+    std::string header(n, '\0');
+#if defined(METOXID_WINDOWS)
+    const int result = _read(fd, header.data(), static_cast<unsigned>(n));
+#else
+    ssize_t result;
+    do {
+        result = pread(fd, header.data(), n, 0);
+    } while (result < 0 && errno == EINTR);
+#endif
+    const int error = errno;
+#if defined(METOXID_WINDOWS)
+    _close(fd);
+#else
+    close(fd);
+#endif
+
+    if (result < 0) {
+        errno = error;
+        throwErrno("failed to read", path);
+    }
+    header.resize(static_cast<size_t>(result));
+    return header;
+}
@@ -0,0 +1,149 @@
+#include <metoxid/fingerprint.hpp>
+#include <cstring>
+
+namespace {
+
+constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t kPrime3 = 0x165667B19E3779F9ull;
+constexpr uint64_t kPrime4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t kPrime5 = 0x27D4EB2F165667C5ull;
+
+uint64_t rotate(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// Little-endian loads, so fingerprints are the same on every machine
+uint64_t load64(const uint8_t* p) {
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+uint32_t load32(const uint8_t* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+}
+
+uint64_t mixRound(uint64_t accumulator, uint64_t input) {
+    return rotate(accumulator + input * kPrime2, 31) * kPrime1;
+}
+
+uint64_t merge(uint64_t hash, uint64_t lane) {
+    return (hash ^ mixRound(0, lane)) * kPrime1 + kPrime4;
+}
+
+std::string_view trimPadding(std::string_view value) {
+    while (!value.empty() && (value.back() == '\0' || value.back() == ' ')) {
+        value.remove_suffix(1);
+    }
+    return value;
+}
+
+void appendSized(std::string& out, std::string_view text) {
+    const uint32_t size = (uint32_t)text.size(); // length prefixed, so no two field lists encode the same
+    for (int i = 0; i < 4; ++i) {
+        out.push_back((char)(size >> (8 * i)));
+    }
+    out.append(text);
+}
+
+} // namespace
+
+uint64_t hash64(const void* data, size_t size, uint64_t seed) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const uint8_t* const end = p + size;
+    uint64_t hash;
+
+    if (size >= 32) {
+        uint64_t lanes[4] = {seed + kPrime1 + kPrime2, seed + kPrime2, seed, seed - kPrime1};
+        for (; end - p >= 32; p += 32) { //the lanes don't depend on each other
+            for (int lane = 0; lane < 4; ++lane) {
+                lanes[lane] = mixRound(lanes[lane], load64(p + 8 * lane));
+            }
+        }
+        hash = rotate(lanes[0], 1) + rotate(lanes[1], 7) + rotate(lanes[2], 12) + rotate(lanes[3], 18);
+        for (uint64_t lane : lanes) {
+            hash = merge(hash, lane);
+        }
+    } else {
+        hash = seed + kPrime5;
+    }
+    hash += size;
+
+    for (; end - p >= 8; p += 8) {
+        hash = rotate(hash ^ mixRound(0, load64(p)), 27) * kPrime1 + kPrime4;
+    }
+    if (end - p >= 4) {
+        hash = rotate(hash ^ (load32(p) * kPrime1), 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        hash = rotate(hash ^ (*p * kPrime5), 11) * kPrime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    hash *= kPrime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+KeySelection::KeySelection(std::string_view list) {
+    while (!list.empty()) {
+        const size_t comma = list.find(',');
+        std::string key(list.substr(0, comma));
+        list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+
+        if (key.empty()) {
+            continue;
+        }
+        if (key.back() == '*') {
+            key.pop_back();
+            this->prefixes_.push_back(std::move(key));
+        } else {
+            this->keys_.push_back(std::move(key));
+        }
+    }
+}
+
+bool KeySelection::Matches(const std::string& key) const {
+    if (this->keys_.empty() && this->prefixes_.empty()) {
+        return true;
+    }
+    for (const auto& selected : this->keys_) {
+        if (key == selected) {
+            return true;
+        }
+    }
+    for (const auto& prefix : this->prefixes_) {
+        if (key.compare(0, prefix.size(), prefix) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::optional<uint64_t> fingerprintFields(const FieldList& fields, const KeySelection& keys) {
+    thread_local std::string canonical; // reused, a worker fingerprints one file after another
+    canonical.clear();
+
+    for (const auto& field : fields) {
+        if (keys.Matches(field.first)) {
+            appendSized(canonical, field.first);
+            appendSized(canonical, trimPadding(field.second));
+        }
+    }
+    if (canonical.empty()) {
+        return std::nullopt;
+    }
+    return hash64(canonical.data(), canonical.size());
+}
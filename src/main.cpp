@@ -17,6 +17,7 @@
 #include <stdarg.h>
 #include <signal.h>
 #include <filesystem>
+#include <system_error>
 #include <vector>
 #include <iostream>
 #include <optional>
@@ -24,46 +25,123 @@
 #include <functional>
 #include <fstream>
 #include <iomanip>
+#include <algorithm>
 
 void browseDirectory(const std::filesystem::path& dir); //Function to browse the director that the User is in
 void editFile(const std::filesystem::path& path); //Function to start editing the file's meta data
-void printEditingValueAndCursor(std::string value, int total_subtracts, int& charstoleft, int col); //Function to print the value (metadata) of the field that is being edited
-void printFieldName(std::string fieldname, int& charstoleft); //Function to print the name of the field
-void printEditingFields(const std::pair<const std::string, std::variant<std::string, std::reference_wrapper<const Exiv2::Value>>>& field, int& total_subtracts, int& size, std::string& editing_data, std::string& temp, int& charstoleft, size_t& i, int row, int col); //Function to print the fields that are being edited
-void printRegularly(size_t i, int row, int col, const std::pair<const std::string, std::variant<std::string, std::reference_wrapper<const Exiv2::Value>>>& field, int& charstoleft); //Function to print the fields that are not being edited
-void printFields(std::string value, int& charstoleft, int row, int col); //Function to print the fields that are not being edited
-bool check_header(const std::filesystem::path& path); //Function to check if the file can be edited by Exiv2
+bool check_header(const MappedFile& file); //Function to check if the file can be edited by Exiv2
+std::shared_ptr<FileMetadata> loadFileMetadata(const std::filesystem::path& path, bool from_index); //Function the prefetcher uses to read a file in the background
+[[noreturn]] void quit(); //Function to wait for the saves still running and leave the program
+
+// Prefetched metadata outlives a single browseDirectory call, since editFile returns by browsing again
+struct BrowserState {
+	std::unique_ptr<MetadataIndex> index; //optional, flushed when the state is destroyed at exit
+	std::optional<std::filesystem::path> server; //metoxid serve socket the previews are asked from first, with --server
+	MetadataCache cache{256};
+	MetadataPrefetcher prefetcher{cache, [](const std::filesystem::path& path) { return loadFileMetadata(path, true); }};
+	SaveQueue saves{[this](const std::filesystem::path& path) { this->cache.Erase(path); }}; //drops anything prefetched while the file was being written
+};
+
+BrowserState& browserState() {
+	static BrowserState state;
+	return state;
+}
 
 int main(int argc, char* argv[]) {
+	std::vector<std::string> arguments; //every mode takes --trace and --server, the rest is theirs
+	std::optional<std::filesystem::path> server;
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if (arg == "--server") { //hand the work to a running metoxid serve
+			server = defaultSocketPath();
+		} else if (arg.rfind("--server=", 0) == 0) {
+			server = arg.substr(9);
+		} else if (arg.rfind("--trace=", 0) == 0) { //records where the time goes, written at exit
+			try {
+				startTracing(arg.substr(8));
+			} catch (const std::system_error& e) {
+				std::cerr << "metoxid: " << e.what() << std::endl;
+				return 2;
+			}
+			setTraceThreadName("main");
+		} else {
+			arguments.push_back(arg);
+		}
+	}
+
+	if (server && !arguments.empty() && isServedCommand(arguments[0])) {
+		if (const auto status = runRemote(*server, arguments)) {
+			return *status;
+		}
+		//nobody listening, run it here
+	}
+	if (!arguments.empty() && arguments[0] == "serve") {
+		return runServe(std::vector<std::string>(arguments.begin() + 1, arguments.end()));
+	}
+	if (!arguments.empty() && arguments[0] == "dump") { //headless modes never start ncurses
+		return runDump(std::vector<std::string>(arguments.begin() + 1, arguments.end()));
+	}
+	if (!arguments.empty() && arguments[0] == "query") {
+		return runQuery(std::vector<std::string>(arguments.begin() + 1, arguments.end()));
+	}
+	if (!arguments.empty() && arguments[0] == "dupes") {
+		return runDupes(std::vector<std::string>(arguments.begin() + 1, arguments.end()));
+	}
+	if (!arguments.empty() && arguments[0] == "previews") {
+		return runPreviews(std::vector<std::string>(arguments.begin() + 1, arguments.end()));
+	}
+	if (!arguments.empty() && arguments[0] == "set") {
+		return runSet(std::vector<std::string>(arguments.begin() + 1, arguments.end()));
+	}
+
+	std::vector<std::string> args; //command line arguments without the options
+	std::unique_ptr<MetadataIndex> index;
+	for (const std::string& arg : arguments) {
+		if (arg == "--index") { //remember extracted metadata between runs
+			index = std::make_unique<MetadataIndex>();
+		} else if (arg.rfind("--index=", 0) == 0) {
+			index = std::make_unique<MetadataIndex>(arg.substr(8));
+		} else {
+			args.push_back(arg);
+		}
+	}
+
 	signal(SIGINT, sigintHandler); // Register the signal handler
 
     initscr();
 	
 	keypad(stdscr, TRUE);
+	set_escdelay(25); //escape closes the editor's filter, don't wait a second for an escape sequence
 	curs_set(0);
 
+	Exiv2::XmpParser::initialize(); //must happen once before the prefetch threads use Exiv2
+	Exiv2::LogMsg::setLevel(Exiv2::LogMsg::mute); //warnings from background threads would scribble over the screen
+
 	if (has_colors()) {
 		start_color();
 		init_pair(1, COLOR_RED, COLOR_BLACK);
 		init_pair(2, COLOR_BLACK, COLOR_WHITE);
 	}
 	
-	if (argc == 1) {
+	browserState().index = std::move(index);
+	browserState().server = std::move(server);
+
+	if (args.empty()) {
 		browseDirectory(std::filesystem::current_path());
-	} else if (argc == 2) {
-		std::filesystem::path path = std::filesystem::absolute(argv[1]);
+	} else if (args.size() == 1) {
+		std::filesystem::path path = std::filesystem::absolute(args[0]);
 
 		if (std::filesystem::exists(path)) {
 			if (std::filesystem::is_regular_file(path)) {
 				editFile(path);
-                fatalError("%s Will Edit Now", argv[1]);
+                fatalError("%s Will Edit Now", args[0].c_str());
 			} else if (std::filesystem::is_directory(path)) {
 				browseDirectory(path);
 			} else {
-				fatalError("%s is not a file or a directory.", argv[1]);
+				fatalError("%s is not a file or a directory.", args[0].c_str());
 			}
 		} else {
-			fatalError("%s path doesn't exist.", argv[1]);
+			fatalError("%s path doesn't exist.", args[0].c_str());
 		}
 	} else {
 		fatalError("you can pass only one command line argument at a time.");
@@ -74,510 +152,668 @@ int main(int argc, char* argv[]) {
     return 0;
 }
 
+std::shared_ptr<FileMetadata> loadFileMetadata(const std::filesystem::path& path, bool from_index) {
+	auto loaded = std::make_shared<FileMetadata>();
+	std::error_code ec;
+
+	if (!std::filesystem::is_regular_file(path, ec)) {
+		loaded->error = std::filesystem::is_directory(path, ec) ? "directory" : "not a regular file";
+		return loaded;
+	}
+
+	const auto& server = browserState().server;
+	if (server && from_index) { //the server's warm index answers previews, editing still parses here
+		if (auto remote = readRemote(*server, path, ReadMode::Fast)) {
+			loaded->error = std::move(remote->error);
+			loaded->preview = previewFields(std::move(remote->fields));
+			return loaded;
+		}
+	}
+
+	MetadataIndex* index = browserState().index.get();
+	const auto stamp = index != nullptr ? FileStamp::Of(path) : std::nullopt;
+	if (stamp && from_index) {
+		if (auto indexed = index->Lookup(path, *stamp, ReadMode::Fast)) { //previews are happy with any entry
+			loaded->error = std::move(indexed->error);
+			loaded->preview = previewFields(std::move(indexed->fields));
+			return loaded;
+		}
+	}
+
+	IndexedFile entry;
+	try {
+		auto file = MappedFile::Open(path); //one read-only mapping, shared by the header check and the parser
+		loaded->editable = check_header(*file); //checks if Exiv2 can write the file back
+		entry.mode = loaded->editable ? ReadMode::Full : ReadMode::Fast; //read-only files (HEIF) only need the built-in reader
+		loaded->metadata = std::make_shared<Metadata>(file, entry.mode);
+		entry.fields = loaded->metadata->Flatten();
+		loaded->preview = previewFields(entry.fields);
+	} catch (const std::exception& e) {
+		loaded->metadata = nullptr;
+		loaded->error = entry.error = e.what();
+	}
+
+	if (stamp) {
+		entry.stamp = *stamp;
+		index->Store(path, std::move(entry));
+	}
+	return loaded;
+}
+
+void prefetchAround(const DirectoryListing& listing, size_t selected_index, int row) {
+	std::vector<std::filesystem::path> window; //the selected file first, then its neighbours outwards
+	auto add = [&](size_t index) {
+		if (listing.At(index).type == DirectoryListing::Type::File) { //directories have nothing to preview
+			window.push_back(listing.PathAt(index));
+		}
+	};
+	add(selected_index);
+
+	for (size_t distance = 1; distance <= (size_t)row; ++distance) {
+		if (selected_index + distance < listing.Size()) {
+			add(selected_index + distance);
+		}
+		if (distance <= selected_index) {
+			add(selected_index - distance);
+		}
+	}
+
+	browserState().prefetcher.Prefetch(window);
+}
+
+void printPreview(const std::filesystem::path& path, int x, int row, int width) {
+	const auto stamp = FileStamp::Of(path);
+	const auto loaded = stamp ? browserState().cache.Get(path, *stamp) : nullptr;
+
+	if (browserState().saves.Pending(path)) {
+		mvprintw(0, x, "%.*s", width, "saving...");
+	} else if (!loaded) {
+		mvprintw(0, x, "%.*s", width, "loading...");
+	} else if (!loaded->error.empty()) {
+		attron(COLOR_PAIR(1));
+		mvprintw(0, x, "%.*s", width, loaded->error.c_str());
+		attroff(COLOR_PAIR(1));
+	} else {
+		for (int i = 0; i < row && i < (int)loaded->preview.size(); ++i) {
+			const auto& field = loaded->preview[i];
+			mvprintw(i, x, "%.*s:", width, field.first.c_str());
+
+			const int value_width = width - (int)field.first.length() - 2;
+			if (value_width > 0) {
+				attron(COLOR_PAIR(1));
+				printw(" %.*s", value_width, field.second.c_str());
+				attroff(COLOR_PAIR(1));
+			}
+		}
+	}
+}
+
+std::string extractPreviews(const std::filesystem::path& path) { //writes the file's embedded previews next to it, returns what happened
+	const std::string name = path.filename().string();
+	try {
+		const auto file = MappedFile::Open(path);
+		const auto previews = readPreviews(file, false);
+		for (size_t i = 0; i < previews.size(); ++i) {
+			writeFile(previewPath({}, path, i, previews[i]), reinterpret_cast<const uint8_t*>(previews[i].bytes.data()), previews[i].bytes.size());
+		}
+		if (previews.empty()) {
+			return "no previews in " + name;
+		}
+		return "extracted " + std::to_string(previews.size()) + (previews.size() == 1 ? " preview of " : " previews of ") + name;
+	} catch (const std::exception& e) {
+		return "failed to extract previews of " + name + ": " + e.what();
+	}
+}
+
+std::string saveStatus(bool& failed) { //how the latest save went, empty before the first one
+	const auto status = browserState().saves.Latest();
+	failed = false;
+	if (!status) {
+		return "";
+	}
+
+	const size_t pending = browserState().saves.Pending();
+	const std::string name = status->path.filename().string();
+	std::string line;
+	switch (status->state) {
+	case SaveQueue::State::Queued:
+	case SaveQueue::State::Encoding:
+		line = "saving " + name + ": encoding";
+		break;
+	case SaveQueue::State::Writing:
+		line = "saving " + name + ": writing";
+		break;
+	case SaveQueue::State::Saved:
+		line = "saved " + name;
+		break;
+	case SaveQueue::State::Failed:
+		line = "failed to save " + name + ": " + status->error;
+		failed = true;
+		break;
+	}
+	if (pending > 1 || (pending == 1 && status->state == SaveQueue::State::Saved)) {
+		line += " (" + std::to_string(pending) + " still saving)";
+	}
+	return line;
+}
+
+void quit() {
+	SaveQueue& saves = browserState().saves;
+	if (saves.Pending() > 0) { //edits only exist in memory until their save finishes
+		erase();
+		mvprintw(0, 0, "Waiting for %zu files to finish saving...", saves.Pending());
+		refresh();
+		saves.WaitAll();
+	}
+
+	curs_set(1);
+	endwin();
+
+	const auto failures = saves.Failures();
+	for (const auto& failure : failures) { //the status line is gone with the screen
+		std::cerr << "Failed to save " << failure.path.string() << ": " << failure.error << std::endl;
+	}
+	exit(failures.empty() ? 0 : 1);
+}
+
 void browseDirectory(const std::filesystem::path& dir) {
-	auto contents = listDirectory(dir); //Get the contents of the directory
-	size_t num_of_elems = contents.size(); //Number of elements in the directory
+	static DirectoryListing::SortKey sort = DirectoryListing::SortKey::None; //kept when moving between directories
+	static const char* const sort_names[] = {"", "by name", "by size", "by date", "by type"};
+
+	auto listing = std::make_unique<DirectoryListing>(dir, browserState().prefetcher.Pool()); //read a batch per frame, the first screen doesn't wait for the rest
+	listing->Sort(sort);
 	size_t selected_index = 0; //Index of the selected file
 	size_t offset = 0; //offset from top of the screen
 	int row, col;
+	bool moved = true; //the cursor moved, so the prefetch window has to follow it
+	std::string query = ""; //what was typed after '/'
+	bool searching = false; //keys go to the query instead of moving the cursor
+	std::string notice = ""; //what the last 'p' did, shown until the next key
 
 	while (true) {
+		const bool busy = !listing->Complete(); //more of the directory to read, getch doesn't wait while there is
+		if (busy) {
+			const size_t before = listing->Size();
+			listing->ReadMore(4096);
+			moved |= before == 0 && listing->Size() > 0;
+		}
+		const size_t num_of_elems = listing->Size(); //Number of entries shown
+		if (selected_index >= num_of_elems) {
+			selected_index = num_of_elems > 0 ? num_of_elems - 1 : 0;
+		}
+
 		getmaxyx(stdscr, row, col);
+		const int list_width = col >= 60 ? col / 2 : col; //narrow terminals get no preview pane
+
+		bool save_failed;
+		const std::string save_status = saveStatus(save_failed);
+		const bool show_status = searching || !query.empty() || busy || listing->Sniffing() || listing->Media() > 0 || sort != DirectoryListing::SortKey::None || !save_status.empty() || !notice.empty();
+		if (show_status) { //the last line reports the listing and the saves
+			row = std::max(row - 1, 1);
+		}
+		if (selected_index < offset) {
+			offset = selected_index;
+		} else if (selected_index >= offset + row) {
+			offset = selected_index - row + 1;
+		}
+
+		listing->SniffMore(offset, row); //the rows on screen go to the pool first, the formats are merged as they come back
+
+		if (moved && num_of_elems > 0) {
+			prefetchAround(*listing, selected_index, row);
+			moved = false;
+		}
+
+		erase();
+
+		const int tag_width = list_width >= 24 ? 8 : 0; //format, and "ro" if Exiv2 can't write it
+		for (size_t i = 0; i < (size_t)row && i + offset < num_of_elems; ++i) {
+			const auto& entry = listing->At(i + offset);
+			const std::string name = entry.type == DirectoryListing::Type::Directory ? entry.name + "/" : entry.name;
+			if (i + offset == selected_index) {  //makes the one you are on look cooler
+				attron(COLOR_PAIR(2));
+				mvprintw(i, 0, "%-*.*s", list_width - 1 - tag_width, list_width - 1 - tag_width, name.c_str());
+				attroff(COLOR_PAIR(2));
+			} else {
+				mvprintw(i, 0, "%.*s", list_width - 1 - tag_width, name.c_str());
+			}
+
+			if (tag_width > 0 && entry.format != FileFormat::Unknown) {
+				const FormatInfo& format = formatInfo(entry.format);
+				attron(COLOR_PAIR(1));
+				mvprintw(i, list_width - tag_width, "%s%s", format.name, format.writable ? "" : " ro");
+				attroff(COLOR_PAIR(1));
+			}
+		}
+
+		if (list_width < col && num_of_elems > 0 && listing->At(selected_index).type == DirectoryListing::Type::File) {
+			printPreview(listing->PathAt(selected_index), list_width + 1, row, col - list_width - 1);
+		}
+
+		if (show_status) {
+			std::string info = std::to_string(listing->Total()) + (!listing->Complete() ? " entries, reading..." : listing->Sniffing() ? " entries, sniffing..." : " entries");
+			if (!query.empty()) {
+				info = std::to_string(num_of_elems - (listing->Dir().has_relative_path() ? 1 : 0)) + " of " + info;
+			}
+			if (sort != DirectoryListing::SortKey::None) {
+				info += std::string(", ") + sort_names[(int)sort];
+			}
+			if (listing->Media() > 0) {
+				info += ", " + std::to_string(listing->Media()) + " media";
+				if (listing->ReadOnly() > 0) {
+					info += " (" + std::to_string(listing->ReadOnly()) + " read-only)";
+				}
+			}
+			if (!listing->Error().empty()) {
+				info += ", " + listing->Error();
+			}
 
-		for (size_t i = 0; i < row; ++i) {
-			if (i + offset < num_of_elems) {
-				if (i + offset == selected_index) {  //makes the one you are on look cooler
+			move(row, 0);
+			if (searching || !query.empty()) {
+				printw("/%.*s", std::max(col - 2, 0), query.c_str());
+				if (searching) {
 					attron(COLOR_PAIR(2));
-					printw("%s\n", contents[i + offset].filename().c_str());
+					printw(" "); //the query's cursor
 					attroff(COLOR_PAIR(2));
-				} else {
-					printw("%s\n", contents[i + offset].filename().c_str());
 				}
+				printw("  ");
+			}
+			attron(COLOR_PAIR(1));
+			printw("%s", info.c_str());
+			attroff(COLOR_PAIR(1));
+			if (!save_status.empty()) {
+				printw("  ");
+				if (save_failed) {
+					attron(COLOR_PAIR(1));
+				}
+				printw("%s", save_status.c_str());
+				attroff(COLOR_PAIR(1));
+			}
+			if (!notice.empty()) {
+				printw("  %s", notice.c_str());
 			}
 		}
 
 		refresh();
-		
-		char ch = getch(); //waits for user input and store it
 
-		if (ch == (char)KEY_UP) {
+		timeout(busy ? 0 : listing->Sniffing() ? 20 : 100); //getch gives up now and then so previews and formats that came back get drawn, at once while the listing is still read
+		int ch = getch(); //waits for user input and store it
+		while (ch == ERR && !busy && !listing->SniffMore(offset, row) && !browserState().prefetcher.TakeUpdated() && !browserState().saves.TakeUpdated()) {
+			ch = getch();
+		}
+		if (ch == ERR) {
+			continue; //more of the directory was read, or something finished in the background
+		}
+		notice.clear();
+
+		if (searching) {
+			bool changed = false;
+
+			if (ch == 10) {
+				searching = false; //keeps the filter, the cursor moves over the matches
+			} else if (ch == 27) { //escape
+				searching = false;
+				changed = !query.empty();
+				query.clear();
+			} else if (ch == KEY_BACKSPACE || ch == 127 || ch == 8) {
+				if (!query.empty()) {
+					query.pop_back();
+					changed = true;
+				}
+			} else if (ch >= 32 && ch < 127) {
+				query += (char)ch;
+				changed = true;
+			}
+
+			if (changed) {
+				listing->Filter(query);
+				selected_index = 0;
+				offset = 0;
+				moved = true;
+			}
+		} else if (ch == KEY_UP) {
 			if (selected_index > 0) {
 				selected_index--;
-
-				if (selected_index < offset) { //scrolls up if you are to top
-					offset--;
-				}
+				moved = true;
 			}
-		} else if (ch == (char)KEY_DOWN) {
+		} else if (ch == KEY_DOWN) {
 			if (selected_index + 1 < num_of_elems) {
 				selected_index++;
-
-				if (selected_index > offset + row - 1) { //scrolls down if you are to bottom
-					offset++;
-				}
+				moved = true;
 			}
-		} else if (ch == 10) {
-			if (std::filesystem::is_directory(contents[selected_index])) {
-				const auto canonical_path = std::filesystem::canonical(contents[selected_index]);
+		} else if (ch == '/') {
+			searching = true;
+		} else if (ch == 27 && !query.empty()) { //escape shows every entry again
+			query.clear();
+			listing->Filter(query);
+			selected_index = 0;
+			offset = 0;
+			moved = true;
+		} else if (ch == 's') { //cycles directory order, name, size, date, type
+			sort = (DirectoryListing::SortKey)(((int)sort + 1) % 5);
+			listing->Sort(sort);
+			selected_index = 0;
+			offset = 0;
+			moved = true;
+		} else if (ch == 'p' && num_of_elems > 0 && listing->At(selected_index).type == DirectoryListing::Type::File) {
+			notice = extractPreviews(listing->PathAt(selected_index));
+		} else if (ch == 10 && num_of_elems > 0) {
+			const auto type = listing->At(selected_index).type;
+			const auto path = listing->PathAt(selected_index);
+			if (type == DirectoryListing::Type::Directory) { //the type from the directory read, no stat
+				listing = std::make_unique<DirectoryListing>(path, browserState().prefetcher.Pool());
+				listing->Sort(sort);
 				offset = 0;
 				selected_index = 0;
-				contents = listDirectory(canonical_path);
-				num_of_elems = contents.size();
-			} else if (std::filesystem::is_regular_file(contents[selected_index])) {
+				query.clear();
+				moved = true;
+			} else if (type == DirectoryListing::Type::File) {
 				clear();
-				editFile(contents[selected_index]);
-				curs_set(1);
-				endwin();
-				exit(0);
+				timeout(-1); //the editor waits for keys
+				editFile(path);
+				quit();
 			}
 		}
 		else if (ch == '~'){
-			curs_set(1);
-			endwin();
-			exit(0);
+			quit();
 		}
-		
-		clear();
 	}
 }
 
-
 void editFile(const std::filesystem::path& path) {
-	Metadata metadata(path);
-	auto dict = metadata.GetDict(); //an array that holds the categories
-	size_t num_of_elems = dict.size(); // size of the array
-	size_t selected_index = 0; //index of the dictionary that is being hovered on by the cursor
-	size_t offset = 0; //determines how many character rows down the screen has moved
-	int row, col; //row = number of characters that fit in a vertical line on the curent screen size | col = number of characters that fit horizontally
-	bool editing = false; // false if no field is being edited, allows cursor to move up and down, true if a field is being edited, only allows left and right cursor movement
-	std::string editing_name = ""; //name of the field that is being edited
-	std::string temp = ""; 
-	int editing_field = 0; //index of the field that is being edited
-	int charstoleft = 0; //like offset, but horizontally
-	int total_subtracts = 0; //how many characters from the end the cursor is at when editing a field
-	int field_size = 0; //length of the field being edited
-	std::string editing_data = ""; //holds the value of the field that is being edited once it is turned into a string
-	int non_category_offset = 0; //like offset, but disregards categories
-	int category_index = 0; //index of the category the cursor is within
-	std::vector<int> drop_indices; //array that holds the indices of the category dropdown positions
-	
-	for (size_t i = 0; i < num_of_elems + 1; ++i) { //+1 adds a dummy category at the end, used so that the last category can be expanded
-		drop_indices.push_back(i);
+	if (browserState().saves.Pending(path)) { //the file is still being written, edits have to start from what it ends up as
+		erase();
+		mvprintw(0, 0, "Waiting for %s to finish saving...", path.filename().c_str());
+		refresh();
+		browserState().saves.Wait(path);
 	}
 
-	bool should_edit = check_header(path); //checks if the file can be edited
-	
+	const auto stamp = FileStamp::Of(path);
+	std::shared_ptr<const FileMetadata> loaded = stamp ? browserState().cache.Get(path, *stamp) : nullptr; //prefetched by the browser
+	if (!loaded || !loaded->metadata) { //index entries only carry strings, editing needs the real thing
+		loaded = loadFileMetadata(path, false);
+	}
+	if (!loaded->metadata) {
+		fatalError("%s", loaded->error.c_str());
+	}
+	Metadata& metadata = *loaded->metadata;
+	bool should_edit = loaded->editable;
+
+	for (auto& category : metadata.Categories()) { //a cached file may have been browsed before, start collapsed
+		category.expanded = false;
+	}
+	RowModel rows(metadata.Categories()); //categories and the fields of expanded ones as one list, fields are only built once expanded
+	size_t selected_index = 0; //row that is being hovered on by the cursor
+	size_t top_line = 0; //first screen line shown, rows being edited can take more than one line
+	int row, col; //row = number of characters that fit in a vertical line on the curent screen size | col = number of characters that fit horizontally
+	int last_row = -1, last_col = -1; //screen size of the previous frame
+	EditSession session(metadata); //the field being edited, if any; only left and right cursor movement while it's active
+	std::string edit_error = ""; //why the last commit was refused, shown on the bottom line
+	bool repaint = true; //everything on screen moved (scrolling, expanding, resizing)
+	std::vector<size_t> damaged; //rows to redraw when the rest of the screen is unchanged
+	std::unique_ptr<FieldSearch> search; //built the first time '/' is pressed
+	std::string query = ""; //what was typed after '/'
+	bool searching = false; //keys go to the query instead of moving the cursor
+	bool prompt_shown = false; //the bottom line holds the query
+	size_t match_count = 0;
+
+	auto clearFilter = [&]() { //back to the categories, the cursor stays on the row it was on
+		const size_t category = rows.Size() > 0 ? rows.At(selected_index).category : 0;
+		const FieldMap::value_type* field = rows.Size() > 0 ? rows.At(selected_index).field : nullptr;
+		if (field != nullptr) {
+			metadata.Categories()[category].expanded = true;
+		}
+		rows.ClearFilter();
+		selected_index = rows.Size() > 0 ? std::min(rows.Find(category, field), rows.Size() - 1) : 0;
+		query.clear();
+		repaint = true;
+	};
+
+	clear();
+
 	while (true) {
-		size_t printed_categories = 0; //counter of categories that have been printed
 		getmaxyx(stdscr, row, col); //gets the row and col for the current screen
-		
-			for (size_t i = 0; i < row; ++i) { //ISSUES HERE STEM FROM ONLHY ONE, ALSO CAN'T PRINT/SHOW BOTTOM
-				int top_down_increament = 0; //ensures that fields are being printed even if their category is off screen
-			
-				if (i == 0){  //only for the first row
-					for (size_t j = 0; j < drop_indices.size(); ++j) {
-						if (drop_indices[j] == offset) { //if user has not scrolled at all
-							break;
-						} 
-						if (drop_indices[j] > offset) { //checks if a field is opened after the user scrolls past the category name
-							top_down_increament = drop_indices[j-1]+1;
-							for (auto& field : dict[j-1].fields) { //loops through every field in the selected category
-								
-								if (top_down_increament == offset){
-									i += 1;
-									charstoleft = 0;
-									if (i > row){ //if the would be off screen, break
-										break;
-									}					
-									if (i + offset == selected_index+1) { 
-										//prints out and highlights the selected field
-										attron(COLOR_PAIR(2));
-										editing_name = field.first;
-										editing_field = j-1;
-									}
-
-									printFieldName(field.first.c_str(), charstoleft);
-									attroff(COLOR_PAIR(2));
-									
-									if (editing_name == field.first && editing == true) { 
-										printEditingFields(field, total_subtracts, field_size, editing_data, temp, charstoleft, i, row, col);
-									} 
-									else { 
-										printRegularly(i, row, col, field, charstoleft);
-									}
-								}else{
-									top_down_increament++;
-								}
-							}
-							break;
-						}
-					}
+		if (row != last_row || col != last_col) {
+			last_row = row;
+			last_col = col;
+			repaint = true;
+		}
+
+		std::string edit_hint; //what the edited tag takes, or why the text isn't that yet
+		bool edit_invalid = false;
+		if (session.Active() && session.Schema() != nullptr) {
+			edit_hint = session.Problem(); //the schema only, cheap enough for every keystroke
+			edit_invalid = !edit_hint.empty();
+			if (!edit_invalid) {
+				edit_hint = describeTag(*session.Schema());
+			}
+		}
+
+		const bool show_prompt = searching || rows.Filtered() || !edit_error.empty() || !edit_hint.empty();
+		if (show_prompt != prompt_shown) {
+			prompt_shown = show_prompt;
+			repaint = true;
+		}
+		const int view_rows = show_prompt ? std::max(row - 1, 0) : row; //lines left for the rows
+
+		if (rows.Size() > 0) {
+			size_t focus = rows.LineOf(selected_index); //the line that has to be on screen
+			size_t focus_end = focus + rows.At(selected_index).height;
+
+			if (session.Active()) { //the edited field wraps, every row below moves if it got taller or shorter
+				TextBuffer& text = session.Text();
+				text.Layout(col, rows.Key(selected_index).length() + 4); //the key comes first
+				repaint |= rows.SetHeight(selected_index, text.Rows());
+				focus += text.CursorRow();
+				focus_end = focus + 1;
+			}
+
+			if (focus < top_line) { //scrolls up if you are to top
+				top_line = focus;
+				repaint = true;
+			} else if (focus_end > top_line + view_rows) { //scrolls down if you are to bottom
+				top_line = focus_end - view_rows;
+				repaint = true;
+			}
+		}
+
+		{ //one frame
+			TraceSpan span("render");
+
+			if (repaint) {
+				erase();
+				damaged.clear();
+				for (size_t i = rows.RowAtLine(top_line); i < rows.Size() && rows.LineOf(i) < top_line + view_rows; ++i) {
+					damaged.push_back(i);
 				}
+				repaint = false;
+			}
 
-				if (i + offset < num_of_elems && i < row) { //Prints out everything else
-
-					category_index = printed_categories + offset - non_category_offset;
-
-					if (i + offset == selected_index) {
-						//prints out and highlights the selected category
-						attron(COLOR_PAIR(2));
-						if (dict[category_index].expanded) {
-							printw("v %s\n", dict[category_index].name.c_str());
-						} else {
-							printw("> %s\n", dict[category_index].name.c_str());
-						}
-						attroff(COLOR_PAIR(2));
-
-						if (dict[category_index].expanded) {
-							for (auto& field : dict[category_index].fields) { 
-								//loops through the fields of an expanded category and prints the fields
-								i += 1;
-								if (i < row){
-									
-									charstoleft = 0;
-									printFieldName(field.first.c_str(), charstoleft);
-									printRegularly(i, row, col, field, charstoleft);
-								}
-							}
-						}
-					} else {
-						//for not selected categories
-						if (dict[category_index].expanded) { //prints category name
-							printw("v %s\n", dict[category_index].name.c_str());
-							
-							for (auto& field : dict[category_index].fields) {
-								//loops through the fields of the category
-								i += 1;
-								charstoleft = 0;
-
-								if (i < row){
-									
-									if (i + offset == selected_index) {
-										//if the field is selected, print and highlight it
-										attron(COLOR_PAIR(2));
-										editing_name = field.first;
-										editing_field = category_index;
-									}
-
-									printFieldName(field.first.c_str(), charstoleft);
-									attroff(COLOR_PAIR(2));
-									
-									if (editing_name == field.first && editing == true) {
-										printEditingFields(field, total_subtracts, field_size, editing_data, temp, charstoleft, i, row, col);
-									} 
-									else {
-										printRegularly(i, row, col, field, charstoleft);
-									}
-								}
-							}
-							
-						} else {
-							printw("> %s\n", dict[category_index].name.c_str());
-						}
-					}
-					printed_categories ++;
+			for (size_t i : damaged) {
+				const bool selected = i == selected_index;
+				drawRow(rows, i, (long)rows.LineOf(i) - (long)top_line, view_rows, col, selected, selected && session.Active() ? &session.Text() : nullptr);
+			}
+			damaged.clear();
+
+			if (show_prompt && !edit_error.empty()) {
+				move(row - 1, 0);
+				clrtoeol();
+				attron(COLOR_PAIR(1));
+				printw("%.*s", std::max(col - 1, 0), edit_error.c_str());
+				attroff(COLOR_PAIR(1));
+			} else if (show_prompt && !edit_hint.empty()) {
+				move(row - 1, 0);
+				clrtoeol();
+				if (edit_invalid) {
+					attron(COLOR_PAIR(1));
+				}
+				printw("%.*s", std::max(col - 1, 0), edit_hint.c_str());
+				attroff(COLOR_PAIR(1));
+			} else if (show_prompt) {
+				move(row - 1, 0);
+				clrtoeol();
+				printw("/%.*s", std::max(col - 2, 0), query.c_str());
+				if (searching) {
+					attron(COLOR_PAIR(2));
+					printw(" "); //the query's cursor
+					attroff(COLOR_PAIR(2));
+				}
+				if (rows.Filtered()) {
+					attron(COLOR_PAIR(1));
+					printw("  %zu matches", match_count);
+					attroff(COLOR_PAIR(1));
 				}
 			}
-		
 
-		refresh();
+			refresh(); //ncurses only sends the cells that changed
+		}
+
+		int ch = getch();
+		if (searching) {
+			bool changed = false;
+
+			if (ch == 10) {
+				searching = false; //keeps the filter, the cursor moves over the matches
+			} else if (ch == 27) { //escape
+				searching = false;
+				clearFilter();
+			} else if (ch == KEY_BACKSPACE || ch == 127 || ch == 8) {
+				if (!query.empty()) {
+					query.pop_back();
+					changed = true;
+				}
+			} else if (ch >= 32 && ch < 127) {
+				query += (char)ch;
+				changed = true;
+			}
 
-		char ch = getch();
-		if (!editing){
+			if (changed) {
+				if (query.empty()) {
+					clearFilter();
+				} else {
+					const auto& matches = search->Find(query);
+					rows.Filter(*search, matches); //only the matches become rows
+					match_count = matches.size();
+					selected_index = 0;
+					top_line = 0;
+					repaint = true;
+				}
+			}
+		}
+		else if (!session.Active()){
 			
-			if (ch == (char)KEY_UP) {
-				
+			if (ch == KEY_UP) {
 				if (selected_index > 0) {
-					//if the cursor is still within the bounds of the screen
+					damaged = {selected_index, selected_index - 1};
 					selected_index--;
-					
-					if (selected_index < offset) {
-						//if the cursor is outside the bounds of the screen and requires the screen to move up
-						offset--;
-
-						bool found = false;
-						for (size_t j = 0; j < drop_indices.size(); ++j) {
-							//checks if the row that was moved to was a category. If yes, reduces non category offset.
-							if (drop_indices[j] == offset) {
-								found = true;
-								break;
-							} 
-						}
-						if (!found) {
-							non_category_offset -= 1;
-						}
-					}
 				}
-			} else if (ch == (char)KEY_DOWN) {
-				if (selected_index + 1 < num_of_elems) {
-					//if the cursor is still within the bounds of the screen
+			} else if (ch == KEY_DOWN) {
+				if (selected_index + 1 < rows.Size()) {
+					damaged = {selected_index, selected_index + 1};
 					selected_index++;
-
-					if (selected_index > offset + row - 1) {
-						//if the cursor is outside the bounds of the screen and requires the screen to move up
-						offset++;
-
-						for (size_t j = 0; j < drop_indices.size(); ++j) {
-							//checks if the row that was moved to was a category. If yes, reduces non category offset.
-							if (drop_indices[j] == offset-1) {
-								break;
-							} 
-							if (drop_indices[j] > offset) {
-								non_category_offset += 1;
-								break;
-							}
-						}
-					}
 				}
-			} else if (ch == 10) {
+			} else if (ch == 10 && rows.Size() > 0) {
 				//if the key pressed was enter
-				total_subtracts = 0;
-				if(should_edit){editing = true;}
-			
-				for (int i = 0; i < drop_indices.size(); ++i) {
-					if (drop_indices[i] == selected_index) {
-						//if the selected item is a category
-						if (dict[i].expanded) {
-							//collapses if it is expanded
-							dict[i].expanded = false;
-							int sizeof_fields = dict[i].fields.size();
-							num_of_elems = num_of_elems - sizeof_fields;
-							for (int j = 1; j < drop_indices.size() - i; ++j) {
-								drop_indices[j + i] = drop_indices[j + i] - sizeof_fields;
-							}
-							editing = false;
-							break;
-						} else {
-							//expands the category if it's collapsed
-							dict[i].expanded = true;
-							int sizeof_fields = dict[i].fields.size();
-							num_of_elems = num_of_elems + sizeof_fields;
-							for (int j = 1; j < drop_indices.size() - i; ++j) {
-								drop_indices[j + i] = drop_indices[j + i] + sizeof_fields;
-							}
-							editing = false;
-							break;
-						}
+				if (rows.Toggle(selected_index)) {
+					repaint = true; //expands or collapses the category, everything below it moves
+				} else if (should_edit && !rows.At(selected_index).IsCategory()) {
+					const Row& selected = rows.At(selected_index);
+					if (selected.IsNode()) { //toggling failed, so it's a leaf of the packet's tree
+						session.Begin(*rows.PacketTree(), selected.node, *selected.field);
+					} else {
+						session.Begin(*selected.field);
 					}
+					damaged = {selected_index};
 				}
+			} else if (ch == '/') {
+				if (!search) { //every field of every category, once per file
+					search = std::make_unique<FieldSearch>(metadata.Categories());
+				}
+				searching = true;
+			} else if (ch == 27 && rows.Filtered()) { //escape shows every category again
+				clearFilter();
 			} else if (ch == '~') {
 				break; //exits and saves
 			}
 			
 		}
 		else{ //if mode is currently editing
-			refresh();
-
-			if (ch == 10) { //if the key is enter
-				total_subtracts = 0;
-				editing = false;
-				curs_set(0);
-			} 
-			else if (ch == char(KEY_LEFT)) { //if the key is key_left
-				if (total_subtracts < field_size){
-					//changes the position of the cursor
-					total_subtracts++;
-				}
+			TextBuffer& text = session.Text(); //the typed value, the field only changes once it's committed
+			damaged = {selected_index};
+			if (session.Schema() != nullptr) {
+				edit_error.clear(); //the live check on the prompt line takes over
 			}
-			else if (ch == char(KEY_RIGHT)) {
-				if (total_subtracts > 0){
-					//changes the position of the cursor
-					total_subtracts--;
+
+			if (ch == 10 || ch == 27 || ch == '~') { //enter commits the edit, escape drops it, ~ commits it and exits
+				const FieldMap::value_type* field = session.Field();
+				try {
+					if (ch == 27) {
+						session.Cancel();
+					} else {
+						session.Commit();
+					}
+				} catch (const MetadataError& e) {
+					edit_error = e.what(); //keeps editing so the value can be fixed
+					continue;
 				}
-			}
-			else if (ch == char(KEY_UP)){
-				if (total_subtracts + col > field_size){
-					//if the field is multiple lines, moves one line up. If not, moves to the start of the field 
-					total_subtracts = field_size;
+
+				edit_error.clear();
+				repaint |= rows.Refresh(selected_index);
+				if (search) {
+					search->Refresh(field);
 				}
-				else{
-					total_subtracts += col;
+				repaint |= rows.SetHeight(selected_index, 1);
+				if (ch == '~') {
+					break; //exits and saves
 				}
+			} 
+			else if (ch == KEY_LEFT) {
+				text.Left();
+			}
+			else if (ch == KEY_RIGHT) {
+				text.Right();
 			}
-			else if (ch == char(KEY_DOWN)){
-				if (total_subtracts - col < 0){
-					//if the field is multiple lines, moves one line down. If not, moves to the end of the field 
-					total_subtracts = 0;
+			else if (ch == KEY_UP){
+				//numbers and enumerations step to the next value. Otherwise, if the field is multiple lines, moves one line up, if not, to the start of the field
+				if (!session.Step(1)) {
+					text.Up();
 				}
-				else{
-					total_subtracts -= col;
+			}
+			else if (ch == KEY_DOWN){
+				//numbers and enumerations step to the previous value. Otherwise, if the field is multiple lines, moves one line down, if not, to the end of the field
+				if (!session.Step(-1)) {
+					text.Down();
 				}
 			}
-			else if (ch == '~') {
-				break; //exits and saves
+			else if (ch == KEY_HOME) {
+				text.Home();
 			}
-			else{
-				
-				if (ch == char(KEY_BACKSPACE)){
-					//deletes one character 
-					if (editing_data.length() != 0 && total_subtracts != editing_data.length()){
-						if (total_subtracts == 0){
-							editing_data.erase(editing_data.end() - 1);
-						}
-						else{
-							editing_data.erase(editing_data.end() - total_subtracts);
-						}
-					}
-				}
-				else if(ch == '~'){
-					break; //exits and saves
-				}
-				else{
-					if (isalnum(ch) || ispunct(ch) || isspace(ch)){
-						//if the character is a number, punctuation or space, type it where the cursor is
-						editing_data.insert(editing_data.end() - total_subtracts, ch);
-					}
-				}
-				
-				//saves the edits into editing data
-				std::visit([&](auto&& value) {
-					using T = std::decay_t<decltype(value)>;
-					if constexpr (std::is_same_v<T, std::string>) {
-						value = editing_data;
-					}
-					else if constexpr (std::is_same_v<T, std::reference_wrapper<const Exiv2::Value>>){
-						const_cast<Exiv2::Value&>(value.get()).read(editing_data);
-					}
-				}, dict[editing_field].fields[editing_name]);
+			else if (ch == KEY_END) {
+				text.End();
+			}
+			else if (ch == KEY_BACKSPACE || ch == 127 || ch == 8) {
+				//deletes the character before the cursor
+				text.Backspace();
+			}
+			else if (ch == KEY_DC) {
+				text.Delete();
+			}
+			else if (ch >= 0 && ch < 256 && (isalnum(ch) || ispunct(ch) || isspace(ch))){
+				//if the character is a number, punctuation or space, type it where the cursor is, unless the tag can't hold it
+				session.Type((char)ch);
 			}
 			
 		}
-
-		clear();
 	}
 
 	clear();
-	if (should_edit){
-		metadata.Save(); // Save the edited metadata
+	if (should_edit && metadata.Dirty()){ //only fields that were committed made it dirty
+		browserState().cache.Erase(path); //the cached copy holds edits the file doesn't have yet, nobody may open it again
+		browserState().saves.Save(path, loaded->metadata); //written in the background, the browser shows how it goes
 	}
 	browseDirectory(path.parent_path()); //goes back to image select
 }
 
-bool check_header(const std::filesystem::path& path){
-	
-	std::vector<std::vector<char>> headers = {
-		{0x00, 0x00, 0x00, 0x0C, 0x4A, 0x58, 0x4C, 0x20}, //JXL
-		{0x66, 0x74, 0x79, 0x70, 0x68, 0x65, 0x69, 0x63}, //HEIC
-		{0x00, 0x00, 0x00, 0x18, 0x66, 0x74, 0x79, 0x70}, //HIEF
-		{0x00, 0x00, 0x00, 0x20, 0x66, 0x74, 0x79, 0x70} //Diferent HIEF file format
-	};
-
-	std::fstream s(path, std::ios::binary | std::ios::in | std::ios::out);
-	
-	if (!s.is_open()){
-		fatalError("Failed to open file");
-	}
-
-	char file_header[8] = {0};
-	s.read(file_header, 8);
- 
-	for (int i = 0; i < headers.size(); i++){
-		for (int j = 0; headers[i].size(); j++){
-			if (file_header[j] != headers[i][j]){
-				break;
-			}
-			if (j == headers[i].size() - 1){
-				return false;
-			}
-		}
-	}
-
-	return true;
-}
-
-void printRegularly(size_t i, int row, int col, const std::pair<const std::string, std::variant<std::string, std::reference_wrapper<const Exiv2::Value>>>& field, int& charstoleft){
-	attron(COLOR_PAIR(1));
-
-	std::visit([&](auto&& value){ //allows us to access field.second, use "&" to access the address of it and actually change values easilly
-		using T = std::decay_t<decltype(value)>; //gets the datatype of value
-		if constexpr(std::is_same_v<T, std::string>){ //if string
-			printFields(value, charstoleft, row, col);
-		}
-		else if constexpr(std::is_same_v<T, std::reference_wrapper<const Exiv2::Value>>){ //if refrence wrapper
-			printFields(value.get().toString().c_str(), charstoleft, row, col); //sets the value to a string before printing
-		}
-	}, field.second);
-
-	if (charstoleft < col){ //if needed print a new line
-		printw("\n");
-	}
-	attroff(COLOR_PAIR(1));
-}
-
-void printFields(std::string value, int& charstoleft, int row, int col){
-	printw(" ");
-	charstoleft++;
-
-	for(int i = 0; i < value.length(); i++){ //prints the value by character (in case it is too long)
-		char c = value[i];
-		charstoleft++;
-		if (charstoleft <= col){ //only print if there is space horizontally
-			printw("%c", c);
-		}else{
-			break;
-		}
-	}
-}
-
-void printEditingFields(const std::pair<const std::string, std::variant<std::string, std::reference_wrapper<const Exiv2::Value>>>& field, int& total_subtracts, int& size, std::string& editing_data, std::string& temp, int& charstoleft, size_t& i, int row, int col){
-	attron(COLOR_PAIR(1));
-	
-	std::visit([&](auto&& value) { //allows us to access field.second, use "&" to access the address of it and actually change values easilly
-		using T = std::decay_t<decltype(value)>; //gets the datatype of value
-		if constexpr(std::is_same_v<T, std::string>){
-			printEditingValueAndCursor(value, total_subtracts, charstoleft, col);
-
-			editing_data = value;
-			size = value.length();
-		}
-		else if constexpr(std::is_same_v<T, std::reference_wrapper<const Exiv2::Value>>){
-			std::string temp = value.get().toString().c_str(); //sets the value to a string before passing it
-			printEditingValueAndCursor(temp, total_subtracts, charstoleft, col);
-
-			editing_data = temp;
-			size = temp.length();
-		}
-	}, field.second);
-
-	attroff(COLOR_PAIR(1));
-	if ((charstoleft - (charstoleft/col)*col) < col){ //if needed print a new line
-		printw("\n");
-	}
-
-	i += charstoleft/col; //how many rows has been taken up by the field (in case it goes beyond 1 row)
-}
-
-void printEditingValueAndCursor(std::string value, int total_subtracts, int& charstoleft, int col){ 
-	printw(" ");
-	charstoleft++;								
-
-	for(int i = 0; i < value.length(); i++){ //prints it out character by character to show the cursor
-		char c = value[i];
-		
-		if (i == value.length() - total_subtracts){ //prints out cursor
-			attroff(COLOR_PAIR(1));
-			attron(COLOR_PAIR(2));
-			printw("%c", c);
-			attroff(COLOR_PAIR(2));
-			attron(COLOR_PAIR(1));
-		}
-		else{
-			printw("%c", c); //just the character
-		}
-		charstoleft++;
-	}
-	if (total_subtracts == 0 && (charstoleft - (charstoleft/col)*col) < col){ //if you are at end print out cursor at end
-		attroff(COLOR_PAIR(1));
-		attron(COLOR_PAIR(2));
-		printw(" ");
-		attroff(COLOR_PAIR(2));
-		attron(COLOR_PAIR(1));
-		charstoleft++;
-	}
+bool check_header(const MappedFile& file){
+	return formatInfo(detectFormat(file.Header(kSniffBytes))).writable; //the signature table knows every format Exiv2 reads and which it can write
 }
-
-void printFieldName(std::string fieldname, int& charstoleft){ //prints the name of the field
-	printw("  %s:", fieldname.c_str());
-	charstoleft += 3 + fieldname.length();
-}
-
@@ -1,121 +1,534 @@
 #include <metoxid/metadata.hpp>
-#include <metoxid/utils.hpp>
-#if defined(METOXID_LINUX) || defined(METOXID_MACOS)
-#include <ncurses.h>
-#else
-#include <ncursesw/ncurses.h>
-#endif
+#include <metoxid/native_reader.hpp>
+#include <metoxid/tag_schema.hpp>
+#include <metoxid/trace.hpp>
+#include <algorithm>
 #include <exception>
 #include <memory>
+#include <system_error>
 
-Metadata::Metadata(const std::filesystem::path& file) {
+std::string toDisplayString(const MetadataValue& value) {
+    return std::visit([](auto&& value) -> std::string {
+        using T = std::decay_t<decltype(value)>;
+        if constexpr (std::is_same_v<T, std::string_view>) {
+            return std::string(value);
+        } else {
+            return value.get().toString();
+        }
+    }, value);
+}
+
+FieldMap& Category::Fields() {
+    if (!this->fields_) {
+        TraceSpan span("build fields");
+        span.Detail(this->name);
+        this->fields_.emplace(this->source_, *this->arena_);
+    }
+
+    return *this->fields_;
+}
+
+const FieldMap& Category::Fields() const {
+    return const_cast<Category*>(this)->Fields();
+}
+
+void Category::ForEachField(const FieldVisitor& visit) const {
+    if (this->fields_) {
+        for (const auto& field : *this->fields_) {
+            visit(field.first, field.second);
+        }
+    } else {
+        this->source_(visit);
+    }
+}
+
+namespace {
+
+// Grows a packet to exactly size bytes with whitespace before the trailer, which is where
+// XMP keeps the padding meant for in-place edits. False if it doesn't fit.
+bool padXmpPacket(std::string& packet, size_t size) {
+    if (packet.size() > size) {
+        return false;
+    }
+
+    std::string padding(size - packet.size(), ' ');
+    for (size_t i = 99; i < padding.size(); i += 100) {
+        padding[i] = '\n'; // the spec's suggested layout, lines of 100
+    }
+
+    const size_t trailer = packet.rfind("<?xpacket end=");
+    packet.insert(trailer != std::string::npos ? trailer : packet.size(), padding);
+    return true;
+}
+
+std::shared_ptr<const MappedFile> mapOrThrow(const std::filesystem::path& file) {
     try {
-        this->image_ = Exiv2::ImageFactory::open(file);
+        return MappedFile::Open(file);
+    } catch (const std::exception& e) {
+        throw MetadataError(e.what());
+    }
+}
+
+} // namespace
+
+Metadata::Metadata(const std::filesystem::path& file, ReadMode mode) : Metadata(mapOrThrow(file), mode) {
+}
+
+Metadata::Metadata(std::shared_ptr<const MappedFile> file, ReadMode mode) : file_(std::move(file)), stamp_(file_->Stamp()) {
+    TraceSpan span("Metadata");
+    span.Detail(this->file_->Path().string());
+    span.Bytes(this->file_->Size());
+
+    if (mode == ReadMode::Fast && this->ReadNative()) {
+        return;
+    }
+    this->ReadWithExiv2();
+}
+
+bool Metadata::ReadNative() {
+    TraceSpan span("native read");
+    NativeReadSink sink;
+    sink.exif = [this](std::string_view key, std::string_view value) {
+        this->native_exif_.emplace_back(&this->arena_.Key(key), this->arena_.Copy(value));
+    };
+    sink.comment = [this](std::string_view comment) {
+        this->native_comment_ = comment;
+    };
+    sink.xmp_packet = [this](std::string_view packet) {
+        this->native_xmp_packet_ = packet;
+    };
+
+    if (readNativeMetadata(this->file_->Data(), this->file_->Size(), sink) != NativeReadResult::Ok) {
+        // Exiv2 gets the whole file, including whatever the native reader choked on
+        this->native_exif_.clear();
+        this->native_comment_.clear();
+        this->native_xmp_packet_.clear();
+        return false;
+    }
+
+    if (!this->native_comment_.empty()) {
+        this->metadata_.emplace_back("Comment", [this](const FieldVisitor& visit) {
+            visit("Comment", this->native_comment_);
+        }, this->arena_);
+    }
+
+    if (!this->native_exif_.empty()) {
+        this->metadata_.emplace_back("Exif", [this](const FieldVisitor& visit) {
+            for (const auto& exif_entry : this->native_exif_) {
+                visit(*exif_entry.first, exif_entry.second);
+            }
+        }, this->arena_);
+    }
+
+    if (!this->native_xmp_packet_.empty()) {
+        this->metadata_.emplace_back("XMP Data", [this](const FieldVisitor& visit) {
+            for (const auto& xmp_entry : this->NativeXmpData()) {
+                visit(xmp_entry.key(), std::cref(xmp_entry.value()));
+            }
+        }, this->arena_);
+
+        this->metadata_.emplace_back("XMP Packet", [this](const FieldVisitor& visit) {
+            visit("XMP Packet", this->native_xmp_packet_);
+        }, this->arena_);
+    }
+
+    return true;
+}
+
+const Exiv2::XmpData& Metadata::NativeXmpData() const {
+    if (!this->native_xmp_data_) {
+        this->native_xmp_data_.emplace();
+        try {
+            if (Exiv2::XmpParser::decode(*this->native_xmp_data_, this->native_xmp_packet_) != 0) {
+                this->native_xmp_data_->clear();
+            }
+        } catch (Exiv2::Error&) {
+            this->native_xmp_data_->clear(); // a broken packet still shows up in the XMP Packet category
+        }
+    }
+    return *this->native_xmp_data_;
+}
+
+void Metadata::ReadWithExiv2() {
+    try {
+        // MemIo only copies the buffer if Exiv2 writes to it, reads come straight from the mapping
+        {
+            TraceSpan span("ImageFactory::open");
+            this->image_ = Exiv2::ImageFactory::open(std::make_unique<Exiv2::MemIo>(this->file_->Data(), this->file_->Size()));
+        }
+        TraceSpan span("readMetadata");
         image_->readMetadata();
     } catch (Exiv2::Error& err) {
-        fatalError("Failed to read file metadata, please check if the selected file is a media file: %s", err.what());
+        throw MetadataError(std::string("Failed to read file metadata, please check if the selected file is a media file: ") + err.what());
     } catch (const std::exception& e) {
-        fatalError("%s", e.what());
+        throw MetadataError(e.what());
+    }
+
+    Exiv2::Image* image = this->image_.get();
+
+    if (!image->comment().empty()) {
+        this->metadata_.emplace_back("Comment", [image](const FieldVisitor& visit) {
+            visit("Comment", image->comment());
+        }, this->arena_);
     }
 
-    this->comment_ = image_->comment();
-    this->xmp_packet_ = image_->xmpPacket();
-    this->exif_data_ = image_->exifData();
-    this->iptc_data_ = image_->iptcData();
-    this->xmp_data_ = image_->xmpData();
+    if (!image->exifData().empty()) {
+        this->metadata_.emplace_back("Exif", [image](const FieldVisitor& visit) {
+            for (const auto& exif_entry : image->exifData()) {
+                visit(exif_entry.key(), std::cref(exif_entry.value()));
+            }
+        }, this->arena_);
+    }
+
+    if (!image->iptcData().empty()) {
+        this->metadata_.emplace_back("IPTC", [image](const FieldVisitor& visit) {
+            for (const auto& iptc_entry : image->iptcData()) {
+                visit(iptc_entry.key(), std::cref(iptc_entry.value()));
+            }
+        }, this->arena_);
+    }
+
+    if (!image->xmpData().empty()) {
+        this->metadata_.emplace_back("XMP Data", [image](const FieldVisitor& visit) {
+            for (const auto& xmp_entry : image->xmpData()) {
+                visit(xmp_entry.key(), std::cref(xmp_entry.value()));
+            }
+        }, this->arena_);
+    }
 
-    if (!this->comment_.empty()) {
-        
-        Category category("Comment", {
-            { "Comment", this->comment_ }
+    if (!image->xmpPacket().empty()) {
+        this->metadata_.emplace_back("XMP Packet", [image](const FieldVisitor& visit) {
+            visit("XMP Packet", image->xmpPacket());
+        }, this->arena_);
+    }
+}
+
+FieldList Metadata::Flatten(bool with_xmp_packet) const {
+    FieldList fields;
+    for (const auto& category : this->metadata_) {
+        if (category.name == "XMP Packet" && !with_xmp_packet) {
+            continue;
+        }
+
+        category.ForEachField([&](const std::string& key, const MetadataValue& value) {
+            fields.emplace_back(key, toDisplayString(value));
         });
+    }
+
+    // sources visit fields in the order the file stores them, and the editor shows a repeated key once
+    std::stable_sort(fields.begin(), fields.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    fields.erase(std::unique(fields.begin(), fields.end(), [](const auto& a, const auto& b) { return a.first == b.first; }), fields.end());
+    return fields;
+}
+
+const Category* Metadata::FindCategory(const std::string& name) const {
+    for (const auto& category : this->metadata_) {
+        if (category.name == name) {
+            return &category;
+        }
+    }
+    return nullptr;
+}
 
-        this->metadata_.push_back(category);
+Category* Metadata::CategoryForKey(const std::string& key) {
+    const char* name = key == "Comment" ? "Comment"
+        : key.rfind("Exif.", 0) == 0 ? "Exif"
+        : key.rfind("Iptc.", 0) == 0 ? "IPTC"
+        : key.rfind("Xmp.", 0) == 0 ? "XMP Data"
+        : nullptr;
+    if (name == nullptr) {
+        throw MetadataError("Unknown metadata key " + key + ", expected Exif.*, Iptc.*, Xmp.* or Comment");
     }
+    return const_cast<Category*>(this->FindCategory(name)); // null if the file had none of these
+}
 
-    if (!this->exif_data_.empty()) {
-        std::unordered_map<std::string, MetadataValue> fields;
+Metadata::Block Metadata::BlockOf(const std::string& key) {
+    return key == "Comment" ? CommentBlock
+        : key == "XMP Packet" ? XmpPacketBlock
+        : key.rfind("Exif.", 0) == 0 ? ExifBlock
+        : key.rfind("Iptc.", 0) == 0 ? IptcBlock
+        : XmpBlock;
+}
 
-        for (const auto& exif_entry : this->exif_data_) {
-            std::string key = exif_entry.key();
-            MetadataValue value = exif_entry.value();
-            fields.insert({key, value});
+void Metadata::RequireValid(const std::string& key, const std::string& value) {
+    // Exiv2 stores what it could read of a malformed value, which would only show up as a
+    // wrong tag after the file was written
+    if (const TagSchema* tag = findTag(key)) {
+        const std::string problem = checkValue(*tag, value);
+        if (!problem.empty()) {
+            throw MetadataError(problem);
         }
+    }
+}
 
-        Category category("Exif", fields);
-        this->metadata_.push_back(category);
+void Metadata::RequireEditable() const {
+    if (!this->Editable()) {
+        throw MetadataError("Metadata was read with the built-in reader and can't be saved, open it with ReadMode::Full");
     }
+}
 
-    if (!this->iptc_data_.empty()) {
-        std::unordered_map<std::string, MetadataValue> fields;
+void Metadata::Set(const std::string& key, const std::string& value) {
+    this->RequireEditable();
+    Category* category = this->CategoryForKey(key);
+    RequireValid(key, value);
 
-        for (const auto& iptc_entry : this->iptc_data_) {
-            std::string key = iptc_entry.key();
-            MetadataValue value = iptc_entry.value();
-            fields.insert({key, value});
+    try {
+        bool existed = true;
+        if (key == "Comment") {
+            this->image_->setComment(value);
+        } else if (key.rfind("Exif.", 0) == 0) {
+            existed = this->image_->exifData().findKey(Exiv2::ExifKey(key)) != this->image_->exifData().end();
+            this->image_->exifData()[key] = value; // converted to the tag's default type
+        } else if (key.rfind("Iptc.", 0) == 0) {
+            existed = this->image_->iptcData().findKey(Exiv2::IptcKey(key)) != this->image_->iptcData().end();
+            this->image_->iptcData()[key] = value;
+        } else {
+            existed = this->image_->xmpData().findKey(Exiv2::XmpKey(key)) != this->image_->xmpData().end();
+            this->image_->xmpData()[key] = value;
+        }
+
+        if (existed) {
+            this->edited_keys_.insert(key);
+        } else {
+            this->restructured_ = true;
         }
+        this->dirty_.set(BlockOf(key));
+    } catch (Exiv2::Error& err) {
+        throw MetadataError("Failed to set " + key + ": " + err.what());
+    }
 
-        Category category("IPTC", fields);
-        this->metadata_.push_back(category);
+    if (category != nullptr) {
+        category->Reset(); // adding a datum may have moved the others
     }
+}
 
-    if (!this->xmp_data_.empty()) {
-        std::unordered_map<std::string, MetadataValue> fields;
+bool Metadata::Erase(const std::string& key) {
+    this->RequireEditable();
+    Category* category = this->CategoryForKey(key);
+    bool erased = false;
 
-        for (const auto& xmp_entry : this->xmp_data_) {
-            std::string key = xmp_entry.key();
-            MetadataValue value = xmp_entry.value();
-            fields.insert({key, value});
+    // a key can appear more than once (e.g. repeated IPTC keywords), all of them go
+    auto eraseAll = [&erased](auto& data, const auto& datum_key) {
+        for (auto it = data.findKey(datum_key); it != data.end(); it = data.findKey(datum_key)) {
+            data.erase(it);
+            erased = true;
         }
+    };
 
-        Category category("XMP Data", fields);
-        this->metadata_.push_back(category);
+    try {
+        if (key == "Comment") {
+            erased = !this->image_->comment().empty();
+            this->image_->clearComment();
+        } else if (key.rfind("Exif.", 0) == 0) {
+            eraseAll(this->image_->exifData(), Exiv2::ExifKey(key));
+        } else if (key.rfind("Iptc.", 0) == 0) {
+            eraseAll(this->image_->iptcData(), Exiv2::IptcKey(key));
+        } else {
+            eraseAll(this->image_->xmpData(), Exiv2::XmpKey(key));
+        }
+    } catch (Exiv2::Error& err) {
+        throw MetadataError("Failed to delete " + key + ": " + err.what());
     }
 
-    if (!this->xmp_packet_.empty()) {
-        Category category("XMP Packet", {
-            { "XMP Packet", this->xmp_packet_ }
-        });
+    if (erased) {
+        this->restructured_ = true;
+        this->dirty_.set(BlockOf(key));
+    }
 
-        this->metadata_.push_back(category);
+    if (category != nullptr) {
+        category->Reset();
     }
+    return erased;
 }
 
-void Metadata::Save() {
-    try{
-        this->image_->setComment(this->comment_); //For some reason comment can not save FOR REAL
+void Metadata::Apply(FieldMap::value_type& field, const std::string& text) {
+    this->RequireEditable();
+
+    if (auto* value = std::get_if<std::string_view>(&field.second)) { // Comment and XMP Packet, compared with the image on Encode()
+        if (*value != text) {
+            *value = this->arena_.Replace(*value, text);
+            this->dirty_.set(BlockOf(field.first));
+        }
+        return;
     }
-    catch (const std::exception& e) {
-        std::cout << "hi" << std::endl;
-    } 
 
-    try{
-        this->image_->setXmpPacket(this->xmp_packet_); //For some reason XMP can not save FOR REAL
+    // the category only references the datum's value, it's owned by the image and ours to change
+    auto& value = const_cast<Exiv2::Value&>(std::get<std::reference_wrapper<const Exiv2::Value>>(field.second).get());
+    if (value.toString() == text) {
+        return;
     }
-    catch (const std::exception& e) {
-        std::cout << "hi" << std::endl;
-    } 
-    
-    try{
-        this->image_->setExifData(this->exif_data_); //For some reason EXIF can not save
+    RequireValid(field.first, text);
+
+    try {
+        if (value.clone()->read(text) != 0) { // parsed into a copy first, a failed read can leave a value half-changed
+            throw MetadataError("\"" + text + "\" is not a valid " + Exiv2::TypeInfo::typeName(value.typeId()) + " value for " + field.first);
+        }
+        value.read(text);
+    } catch (Exiv2::Error& err) {
+        throw MetadataError("Failed to set " + field.first + ": " + err.what());
     }
-    catch (const std::exception& e){
-        std::cout << "HI" << std::endl;
+    this->MarkEdited(field.first);
+}
+
+void Metadata::Encode() {
+    this->RequireEditable();
+    this->patches_.reset();
+
+    if (this->dirty_.none()) {
+        this->patches_.emplace(); // no patches, WriteFile() has nothing to do
+        return;
     }
 
-    try{
-    this->image_->setXmpData(this->xmp_data_); //For some reason XMP_Data can not save
+    TraceSpan span("encode");
+    span.Detail(this->file_->Path().string());
+
+    try {
+        // Exif, IPTC and XMP values are edited in place inside the image, only the two
+        // plain string categories hold copies that have to be written back.
+        std::optional<std::string> comment;
+        const Category* comment_category = this->FindCategory("Comment");
+        if (this->dirty_[CommentBlock] && comment_category != nullptr && comment_category->Loaded()) {
+            const std::string value = toDisplayString(comment_category->Fields().at("Comment"));
+            if (value != this->image_->comment()) {
+                comment = value;
+            }
+        }
+
+        std::optional<std::string> packet;
+        const Category* packet_category = this->FindCategory("XMP Packet");
+        if (this->dirty_[XmpPacketBlock] && packet_category != nullptr && packet_category->Loaded()) {
+            const std::string value = toDisplayString(packet_category->Fields().at("XMP Packet"));
+            if (value != this->image_->xmpPacket()) {
+                packet = value;
+            }
+        }
+
+        if (!comment) {
+            TraceSpan plan_span("plan patches");
+            this->patches_ = this->PlanPatches(packet);
+            if (this->patches_) {
+                return;
+            }
+        }
+
+        if (comment) {
+            this->image_->setComment(*comment);
+        }
+        if (packet) {
+            this->image_->setXmpPacket(*packet); // also re-parses it into the XMP data
+            this->image_->writeXmpFromPacket(true);
+        }
+
+        TraceSpan write_span("writeMetadata");
+        this->image_->writeMetadata(); //Writes the new file into the image's MemIo
+        write_span.Bytes(this->image_->io().size());
+    } catch (Exiv2::Error& err) {
+        throw MetadataError(std::string("Failed to write file metadata: ") + err.what());
+    }
+}
+
+void Metadata::WriteFile() {
+    this->RequireEditable();
+
+    try {
+        if (this->patches_) {
+            this->stamp_ = patchFile(this->file_->Path(), this->stamp_, *this->patches_);
+        } else {
+            Exiv2::BasicIo& io = this->image_->io();
+            writeFileAtomically(this->file_->Path(), io.mmap(), io.size());
+            this->restructured_ = true; // the path is a new file now, offsets read from the mapping don't apply to it
+        }
+        this->dirty_.reset();
+    } catch (Exiv2::Error& err) {
+        throw MetadataError(std::string("Failed to write file metadata: ") + err.what());
+    } catch (const std::system_error& e) {
+        throw MetadataError(std::string("Failed to write file metadata: ") + e.what());
+    }
+}
+
+std::optional<std::vector<FilePatch>> Metadata::PlanPatches(const std::optional<std::string>& packet) const {
+    if (this->restructured_) {
+        return std::nullopt;
+    }
+
+    std::vector<FilePatch> patches;
+    if (this->edited_keys_.empty() && !packet) {
+        return patches; // nothing to write at all
+    }
+
+    // Where the values are stored in the file as it is on disk, found by the built-in reader
+    const uint8_t* data = this->file_->Data();
+    const size_t size = this->file_->Size();
+    struct Slot {
+        uint16_t type;
+        uint32_t count;
+        size_t offset;
+        bool repeated;
+    };
+    std::unordered_map<std::string, Slot> slots;
+    std::optional<std::pair<size_t, size_t>> packet_slot;
+
+    NativeReadSink sink;
+    sink.skip_iptc = true;
+    sink.exif_slot = [&](std::string_view key, uint16_t type, uint32_t count, const uint8_t* value) {
+        auto inserted = slots.emplace(std::string(key), Slot{type, count, size_t(value - data), false});
+        if (!inserted.second) {
+            inserted.first->second.repeated = true; // which one Exiv2 reports isn't ours to guess
+        }
+    };
+    sink.xmp_packet = [&](std::string_view stored) {
+        const auto* begin = reinterpret_cast<const uint8_t*>(stored.data());
+        if (begin >= data && begin + stored.size() <= data + size) { //not a copy assembled from pieces
+            packet_slot.emplace(size_t(begin - data), stored.size());
+        }
+    };
+    if (readNativeMetadata(data, size, sink) != NativeReadResult::Ok) {
+        return std::nullopt;
     }
-    catch (const std::exception& e) {
-        std::cout << "hi" << std::endl;
-    } 
 
-    try{
-    this->image_->setIptcData(this->iptc_data_); //For some reason IPTC can not save
+    bool xmp_changed = packet.has_value();
+    for (const auto& key : this->edited_keys_) {
+        if (key.rfind("Xmp.", 0) == 0) {
+            xmp_changed = true;
+            continue;
+        }
+        if (key.rfind("Exif.", 0) != 0) {
+            return std::nullopt; // IPTC and the comment live in blocks with their own lengths
+        }
+
+        const auto datum = this->image_->exifData().findKey(Exiv2::ExifKey(key));
+        const auto slot = slots.find(key);
+        if (datum == this->image_->exifData().end() || datum->typeId() != Exiv2::asciiString || slot == slots.end() ||
+            slot->second.repeated || slot->second.type != 2) {
+            return std::nullopt;
+        }
+
+        // the old slot, NUL-padded: readers stop at the first NUL
+        std::string value = datum->toString();
+        if (value.size() + 1 > slot->second.count || value.find('\0') != std::string::npos) {
+            return std::nullopt;
+        }
+        value.resize(slot->second.count, '\0');
+        patches.push_back({slot->second.offset, std::move(value)});
     }
-    catch (const std::exception& e) {
-        std::cout << "hi" << std::endl;
-    } 
-    
-    this->image_->writeMetadata(); //Finally writes metadata to the file
-}
\ No newline at end of file
+
+    if (xmp_changed) {
+        if (!packet_slot) {
+            return std::nullopt;
+        }
+
+        std::string serialized;
+        if (packet) {
+            serialized = *packet;
+        } else if (Exiv2::XmpParser::encode(serialized, this->image_->xmpData()) != 0) {
+            return std::nullopt;
+        }
+
+        if (!padXmpPacket(serialized, packet_slot->second)) {
+            return std::nullopt;
+        }
+        patches.push_back({packet_slot->first, std::move(serialized)});
+    }
+
+    return patches;
+}
@@ -0,0 +1,304 @@
+#include <metoxid/metadata_index.hpp>
+#include <metoxid/file_format.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+
+namespace {
+
+// Format: magic, the directory's path, then per file: name, inode, size,
+// mtime, mode, error, field count and key/value pairs. Integers are little-endian,
+// strings are a u32 length followed by the bytes.
+const char kMagic[8] = {'M', 'T', 'X', 'I', 'D', 'X', '1', '\0'};
+
+void putU64(std::string& out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out.push_back(static_cast<char>(value >> (i * 8)));
+    }
+}
+
+void putString(std::string& out, const std::string& value) {
+    const uint32_t size = static_cast<uint32_t>(value.size());
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>(size >> (i * 8)));
+    }
+    out += value;
+}
+
+class Reader {
+public:
+    Reader(const uint8_t* data, size_t size) : data_(data), size_(size) {
+    }
+
+    bool AtEnd() const {
+        return this->pos_ == this->size_;
+    }
+
+    bool U8(uint8_t& value) {
+        if (this->size_ - this->pos_ < 1) {
+            return false;
+        }
+        value = this->data_[this->pos_++];
+        return true;
+    }
+
+    bool U64(uint64_t& value) {
+        if (this->size_ - this->pos_ < 8) {
+            return false;
+        }
+        value = 0;
+        for (int i = 7; i >= 0; --i) {
+            value = value << 8 | this->data_[this->pos_ + i];
+        }
+        this->pos_ += 8;
+        return true;
+    }
+
+    bool String(std::string& value) {
+        if (this->size_ - this->pos_ < 4) {
+            return false;
+        }
+        const uint32_t size = uint32_t(this->data_[this->pos_]) | uint32_t(this->data_[this->pos_ + 1]) << 8 |
+                              uint32_t(this->data_[this->pos_ + 2]) << 16 | uint32_t(this->data_[this->pos_ + 3]) << 24;
+        this->pos_ += 4;
+        if (this->size_ - this->pos_ < size) {
+            return false;
+        }
+        value.assign(reinterpret_cast<const char*>(this->data_ + this->pos_), size);
+        this->pos_ += size;
+        return true;
+    }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t pos_ = 0;
+};
+
+// FNV-1a, only used to name index files
+uint64_t hashPath(const std::string& path) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char c : path) {
+        hash = (hash ^ c) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// the same directory reached through different relative paths must share one index
+std::filesystem::path normalize(const std::filesystem::path& path) {
+    std::error_code ec;
+    const auto absolute = std::filesystem::absolute(path, ec);
+    return (ec ? path : absolute).lexically_normal();
+}
+
+} // namespace
+
+std::filesystem::path MetadataIndex::DefaultLocation() {
+#if defined(_WIN32)
+    if (const char* local = std::getenv("LOCALAPPDATA")) {
+        return std::filesystem::path(local) / "metoxid";
+    }
+#else
+    if (const char* cache = std::getenv("XDG_CACHE_HOME"); cache != nullptr && *cache != '\0') {
+        return std::filesystem::path(cache) / "metoxid";
+    }
+    if (const char* home = std::getenv("HOME")) {
+        return std::filesystem::path(home) / ".cache" / "metoxid";
+    }
+#endif
+    return std::filesystem::temp_directory_path() / "metoxid";
+}
+
+MetadataIndex::MetadataIndex(std::filesystem::path location, size_t max_files) : location_(std::move(location)), max_files_(max_files) {
+    if (!this->location_.empty()) { // the working directory can change later (metoxid serve runs in each client's)
+        this->location_ = normalize(this->location_);
+    }
+}
+
+MetadataIndex::~MetadataIndex() {
+    this->Flush();
+}
+
+std::filesystem::path MetadataIndex::IndexPath(const std::filesystem::path& directory) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.idx", static_cast<unsigned long long>(hashPath(directory.string())));
+    return this->location_ / name;
+}
+
+MetadataIndex::Directory& MetadataIndex::Load(const std::filesystem::path& directory) {
+    const auto found = this->directories_.find(directory.string());
+    if (found != this->directories_.end()) {
+        this->used_.splice(this->used_.begin(), this->used_, found->second.used);
+        return found->second;
+    }
+
+    Directory& loaded = this->directories_[directory.string()];
+    loaded.used = this->used_.insert(this->used_.begin(), directory.string());
+    this->Read(directory, loaded);
+    this->files_ += loaded.files.size();
+    this->Evict();
+    return loaded;
+}
+
+void MetadataIndex::Read(const std::filesystem::path& directory, Directory& loaded) {
+    if (this->location_.empty()) {
+        return; // kept in memory only
+    }
+
+    std::shared_ptr<const MappedFile> file;
+    try {
+        file = MappedFile::Open(this->IndexPath(directory));
+    } catch (const std::exception&) {
+        return; // no index yet
+    }
+
+    if (file->Size() < sizeof(kMagic) || std::memcmp(file->Data(), kMagic, sizeof(kMagic)) != 0) {
+        return;
+    }
+
+    Reader reader(file->Data() + sizeof(kMagic), file->Size() - sizeof(kMagic));
+    std::string owner;
+    if (!reader.String(owner) || owner != directory.string()) {
+        return; // a hash collision, the file belongs to another directory
+    }
+
+    while (!reader.AtEnd()) {
+        std::string name;
+        IndexedFile entry;
+        uint64_t mtime = 0, fields = 0;
+        uint8_t mode = 0;
+
+        if (!reader.String(name) || !reader.U64(entry.stamp.inode) || !reader.U64(entry.stamp.size) ||
+            !reader.U64(mtime) || !reader.U8(mode) || !reader.String(entry.error) ||
+            !reader.U64(fields)) {
+            loaded.files.clear(); // truncated or corrupt: start over
+            return;
+        }
+        entry.stamp.mtime_ns = static_cast<int64_t>(mtime);
+        entry.mode = mode == 0 ? ReadMode::Full : ReadMode::Fast;
+
+        entry.fields.resize(static_cast<size_t>(std::min<uint64_t>(fields, 1 << 20)));
+        for (auto& field : entry.fields) {
+            if (!reader.String(field.first) || !reader.String(field.second)) {
+                loaded.files.clear();
+                return;
+            }
+        }
+
+        loaded.files[name] = std::move(entry);
+    }
+}
+
+void MetadataIndex::Evict() {
+    while (this->max_files_ != 0 && this->files_ > this->max_files_ && this->used_.size() > 1) {
+        const auto oldest = this->directories_.find(this->used_.back());
+        if (oldest->second.dirty && !this->location_.empty()) {
+            this->Write(oldest->first, oldest->second); // a failed write loses nothing but the cache
+        }
+        this->files_ -= oldest->second.files.size();
+        this->directories_.erase(oldest);
+        this->used_.pop_back();
+    }
+}
+
+std::optional<IndexedFile> MetadataIndex::Lookup(const std::filesystem::path& path, const FileStamp& stamp, ReadMode mode) {
+    const auto file = normalize(path);
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    Directory& directory = this->Load(file.parent_path());
+    directory.seen.insert(file.filename().string());
+
+    const auto it = directory.files.find(file.filename().string());
+    if (it == directory.files.end() || !(it->second.stamp == stamp)) {
+        return std::nullopt;
+    }
+    if (mode == ReadMode::Full && it->second.mode == ReadMode::Fast) {
+        return std::nullopt; // the built-in reader's fields are only a subset
+    }
+    return it->second;
+}
+
+void MetadataIndex::Store(const std::filesystem::path& path, IndexedFile entry) {
+    const auto file = normalize(path);
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    Directory& directory = this->Load(file.parent_path());
+
+    directory.seen.insert(file.filename().string());
+    if (directory.files.insert_or_assign(file.filename().string(), std::move(entry)).second) {
+        this->files_++;
+        this->Evict();
+    }
+    directory.dirty = true;
+}
+
+void MetadataIndex::Flush() {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    if (this->location_.empty()) {
+        return;
+    }
+
+    for (auto& [path, directory] : this->directories_) {
+        if (directory.dirty) {
+            this->Write(path, directory);
+        }
+    }
+}
+
+void MetadataIndex::Write(const std::string& path, Directory& directory) {
+    std::string out(kMagic, sizeof(kMagic));
+    putString(out, path);
+
+    for (const auto& [name, entry] : directory.files) {
+        std::error_code ec;
+        if (directory.seen.count(name) == 0 && !std::filesystem::exists(std::filesystem::path(path) / name, ec)) {
+            continue; // deleted since it was indexed
+        }
+
+        putString(out, name);
+        putU64(out, entry.stamp.inode);
+        putU64(out, entry.stamp.size);
+        putU64(out, static_cast<uint64_t>(entry.stamp.mtime_ns));
+        out.push_back(entry.mode == ReadMode::Full ? 0 : 1);
+        putString(out, entry.error);
+        putU64(out, entry.fields.size());
+        for (const auto& field : entry.fields) {
+            putString(out, field.first);
+            putString(out, field.second);
+        }
+    }
+
+    try {
+        std::filesystem::create_directories(this->location_);
+        writeFileAtomically(this->IndexPath(path), reinterpret_cast<const uint8_t*>(out.data()), out.size());
+        directory.dirty = false;
+    } catch (const std::exception&) {
+        // read-only cache location: keep working without persisting
+    }
+}
+
+std::optional<IndexedFile> readFields(const std::filesystem::path& path, const std::optional<FileStamp>& stamp, ReadMode mode, MetadataIndex* index) {
+    if (index != nullptr && stamp) {
+        if (auto indexed = index->Lookup(path, *stamp, mode)) {
+            return indexed;
+        }
+    }
+
+    IndexedFile entry;
+    entry.mode = mode;
+    try {
+        const auto file = MappedFile::Open(path);
+        if (detectFormat(file->Header(kSniffBytes)) == FileFormat::Unknown) { // not something Exiv2 reads, don't let it probe every format
+            return std::nullopt;
+        }
+        entry.fields = Metadata(file, mode).Flatten();
+    } catch (const std::exception& e) {
+        entry.error = e.what();
+    }
+
+    if (index != nullptr && stamp) {
+        entry.stamp = *stamp;
+        index->Store(path, entry);
+    }
+    return entry;
+}
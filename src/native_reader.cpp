@@ -0,0 +1,764 @@
+#include <metoxid/native_reader.hpp>
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct TagInfo {
+    uint16_t tag;
+    const char* name;
+};
+
+// Names as Exiv2 spells them. Every table is sorted by tag for binary search.
+constexpr TagInfo kImageTags[] = {
+    {0x0100, "ImageWidth"}, {0x0101, "ImageLength"}, {0x0102, "BitsPerSample"}, {0x0103, "Compression"},
+    {0x0106, "PhotometricInterpretation"}, {0x010e, "ImageDescription"}, {0x010f, "Make"}, {0x0110, "Model"},
+    {0x0111, "StripOffsets"}, {0x0112, "Orientation"}, {0x0115, "SamplesPerPixel"}, {0x0116, "RowsPerStrip"},
+    {0x0117, "StripByteCounts"}, {0x011a, "XResolution"}, {0x011b, "YResolution"}, {0x011c, "PlanarConfiguration"},
+    {0x0128, "ResolutionUnit"}, {0x0131, "Software"}, {0x0132, "DateTime"}, {0x013b, "Artist"},
+    {0x013c, "HostComputer"}, {0x013e, "WhitePoint"}, {0x013f, "PrimaryChromaticities"}, {0x0142, "TileWidth"},
+    {0x0143, "TileLength"}, {0x0201, "JPEGInterchangeFormat"}, {0x0202, "JPEGInterchangeFormatLength"},
+    {0x0211, "YCbCrCoefficients"}, {0x0212, "YCbCrSubSampling"}, {0x0213, "YCbCrPositioning"},
+    {0x0214, "ReferenceBlackWhite"}, {0x4746, "Rating"}, {0x4749, "RatingPercent"}, {0x8298, "Copyright"},
+    {0x8769, "ExifTag"}, {0x8825, "GPSTag"}, {0x9003, "DateTimeOriginal"},
+};
+
+constexpr TagInfo kPhotoTags[] = {
+    {0x829a, "ExposureTime"}, {0x829d, "FNumber"}, {0x8822, "ExposureProgram"}, {0x8824, "SpectralSensitivity"},
+    {0x8827, "ISOSpeedRatings"}, {0x8830, "SensitivityType"}, {0x9000, "ExifVersion"}, {0x9003, "DateTimeOriginal"},
+    {0x9004, "DateTimeDigitized"}, {0x9010, "OffsetTime"}, {0x9011, "OffsetTimeOriginal"},
+    {0x9012, "OffsetTimeDigitized"}, {0x9101, "ComponentsConfiguration"}, {0x9102, "CompressedBitsPerPixel"},
+    {0x9201, "ShutterSpeedValue"}, {0x9202, "ApertureValue"}, {0x9203, "BrightnessValue"},
+    {0x9204, "ExposureBiasValue"}, {0x9205, "MaxApertureValue"}, {0x9206, "SubjectDistance"},
+    {0x9207, "MeteringMode"}, {0x9208, "LightSource"}, {0x9209, "Flash"}, {0x920a, "FocalLength"},
+    {0x9214, "SubjectArea"}, {0x9286, "UserComment"}, {0x9290, "SubSecTime"}, {0x9291, "SubSecTimeOriginal"},
+    {0x9292, "SubSecTimeDigitized"}, {0xa000, "FlashpixVersion"}, {0xa001, "ColorSpace"},
+    {0xa002, "PixelXDimension"}, {0xa003, "PixelYDimension"}, {0xa005, "InteroperabilityTag"},
+    {0xa20e, "FocalPlaneXResolution"}, {0xa20f, "FocalPlaneYResolution"}, {0xa210, "FocalPlaneResolutionUnit"},
+    {0xa217, "SensingMethod"}, {0xa300, "FileSource"}, {0xa301, "SceneType"}, {0xa401, "CustomRendered"},
+    {0xa402, "ExposureMode"}, {0xa403, "WhiteBalance"}, {0xa404, "DigitalZoomRatio"},
+    {0xa405, "FocalLengthIn35mmFilm"}, {0xa406, "SceneCaptureType"}, {0xa407, "GainControl"},
+    {0xa408, "Contrast"}, {0xa409, "Saturation"}, {0xa40a, "Sharpness"}, {0xa40c, "SubjectDistanceRange"},
+    {0xa420, "ImageUniqueID"}, {0xa430, "CameraOwnerName"}, {0xa431, "BodySerialNumber"},
+    {0xa432, "LensSpecification"}, {0xa433, "LensMake"}, {0xa434, "LensModel"}, {0xa435, "LensSerialNumber"},
+};
+
+constexpr TagInfo kGpsTags[] = {
+    {0x0000, "GPSVersionID"}, {0x0001, "GPSLatitudeRef"}, {0x0002, "GPSLatitude"}, {0x0003, "GPSLongitudeRef"},
+    {0x0004, "GPSLongitude"}, {0x0005, "GPSAltitudeRef"}, {0x0006, "GPSAltitude"}, {0x0007, "GPSTimeStamp"},
+    {0x0008, "GPSSatellites"}, {0x0009, "GPSStatus"}, {0x000a, "GPSMeasureMode"}, {0x000b, "GPSDOP"},
+    {0x000c, "GPSSpeedRef"}, {0x000d, "GPSSpeed"}, {0x000e, "GPSTrackRef"}, {0x000f, "GPSTrack"},
+    {0x0010, "GPSImgDirectionRef"}, {0x0011, "GPSImgDirection"}, {0x0012, "GPSMapDatum"},
+    {0x001b, "GPSProcessingMethod"}, {0x001c, "GPSAreaInformation"}, {0x001d, "GPSDateStamp"},
+    {0x001e, "GPSDifferential"},
+};
+
+constexpr TagInfo kIopTags[] = {
+    {0x0001, "InteroperabilityIndex"}, {0x0002, "InteroperabilityVersion"}, {0x1001, "RelatedImageWidth"},
+    {0x1002, "RelatedImageLength"},
+};
+
+template <size_t N>
+constexpr bool isSorted(const TagInfo (&tags)[N]) {
+    for (size_t i = 1; i < N; ++i) {
+        if (tags[i - 1].tag >= tags[i].tag) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(isSorted(kImageTags) && isSorted(kPhotoTags) && isSorted(kGpsTags) && isSorted(kIopTags),
+              "tag tables must be sorted by tag");
+
+enum class Ifd { Image, Photo, GpsInfo, Iop, Thumbnail };
+
+struct TagTable {
+    const TagInfo* begin;
+    const TagInfo* end;
+    const char* group;
+};
+
+TagTable tableFor(Ifd ifd) {
+    switch (ifd) {
+        case Ifd::Image: return {std::begin(kImageTags), std::end(kImageTags), "Image"};
+        case Ifd::Photo: return {std::begin(kPhotoTags), std::end(kPhotoTags), "Photo"};
+        case Ifd::GpsInfo: return {std::begin(kGpsTags), std::end(kGpsTags), "GPSInfo"};
+        case Ifd::Iop: return {std::begin(kIopTags), std::end(kIopTags), "Iop"};
+        case Ifd::Thumbnail: return {std::begin(kImageTags), std::end(kImageTags), "Thumbnail"};
+    }
+    return {nullptr, nullptr, ""};
+}
+
+const char* tagName(const TagTable& table, uint16_t tag) {
+    const TagInfo* it = std::lower_bound(table.begin, table.end, tag,
+                                         [](const TagInfo& info, uint16_t tag) { return info.tag < tag; });
+    return it != table.end && it->tag == tag ? it->name : nullptr;
+}
+
+enum TiffType : uint16_t {
+    kByte = 1, kAscii, kShort, kLong, kRational, kSByte, kUndefined, kSShort, kSLong, kSRational, kFloat, kDouble, kIfd,
+};
+
+size_t typeSize(uint16_t type) {
+    switch (type) {
+        case kByte: case kAscii: case kSByte: case kUndefined: return 1;
+        case kShort: case kSShort: return 2;
+        case kLong: case kSLong: case kFloat: case kIfd: return 4;
+        case kRational: case kSRational: case kDouble: return 8;
+        default: return 0;
+    }
+}
+
+// Photoshop image resource blocks, IPTC lives in resource 0x0404.
+bool irbHasIptc(const uint8_t* data, size_t size) {
+    size_t pos = 0;
+    while (pos + 12 <= size && std::memcmp(data + pos, "8BIM", 4) == 0) {
+        const uint16_t id = static_cast<uint16_t>(data[pos + 4] << 8 | data[pos + 5]);
+        if (id == 0x0404) {
+            return true;
+        }
+
+        size_t name_length = data[pos + 6];
+        const size_t name_size = (name_length + 2) & ~size_t(1); // pascal string padded to even
+        if (pos + 6 + name_size + 4 > size) {
+            break;
+        }
+        const uint8_t* length = data + pos + 6 + name_size;
+        const size_t data_size = size_t(length[0]) << 24 | size_t(length[1]) << 16 | size_t(length[2]) << 8 | length[3];
+        pos += 6 + name_size + 4 + ((data_size + 1) & ~size_t(1));
+    }
+    return false;
+}
+
+class TiffReader {
+public:
+    TiffReader(const uint8_t* data, size_t size, const NativeReadSink& sink) : data_(data), size_(size), sink_(sink) {
+        // one buffer each, reused for every tag
+        this->key_.reserve(64);
+        this->value_.reserve(256);
+    }
+
+    NativeReadResult Read() {
+        if (this->size_ < 8) {
+            return NativeReadResult::Malformed;
+        }
+
+        if (this->data_[0] == 'I' && this->data_[1] == 'I') {
+            this->little_endian_ = true;
+        } else if (this->data_[0] == 'M' && this->data_[1] == 'M') {
+            this->little_endian_ = false;
+        } else {
+            return NativeReadResult::Malformed;
+        }
+
+        if (this->U16(2) != 42) {
+            return NativeReadResult::Unsupported; // BigTIFF and vendor variants (ORF, RW2) are left to Exiv2
+        }
+
+        uint32_t next = 0;
+        if (!this->ReadIfd(this->U32(4), Ifd::Image, &next)) {
+            return this->result_;
+        }
+        if (next != 0 && !this->ReadIfd(next, Ifd::Thumbnail, nullptr)) {
+            this->result_ = NativeReadResult::Ok; // a broken thumbnail IFD doesn't spoil the main image's tags
+        }
+
+        return this->result_;
+    }
+
+private:
+    uint16_t U16(size_t offset) const {
+        const uint8_t* p = this->data_ + offset;
+        return this->little_endian_ ? static_cast<uint16_t>(p[0] | p[1] << 8) : static_cast<uint16_t>(p[0] << 8 | p[1]);
+    }
+
+    uint32_t U32(size_t offset) const {
+        const uint8_t* p = this->data_ + offset;
+        return this->little_endian_ ? uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24
+                                    : uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | uint32_t(p[3]);
+    }
+
+    uint64_t U64(size_t offset) const {
+        const uint64_t first = this->U32(offset);
+        const uint64_t second = this->U32(offset + 4);
+        return this->little_endian_ ? second << 32 | first : first << 32 | second;
+    }
+
+    bool Fail(NativeReadResult result) {
+        this->result_ = result;
+        return false;
+    }
+
+    bool ReadIfd(size_t offset, Ifd ifd, uint32_t* next) {
+        if (++this->ifds_read_ > 8) {
+            return this->Fail(NativeReadResult::Malformed); // pointer loop
+        }
+        if (offset < 8 || offset + 2 > this->size_) {
+            return this->Fail(NativeReadResult::Malformed);
+        }
+
+        const size_t entries = this->U16(offset);
+        const size_t end = offset + 2 + entries * 12;
+        if (end + (next != nullptr ? 4 : 0) > this->size_) {
+            return this->Fail(NativeReadResult::Malformed);
+        }
+
+        const TagTable table = tableFor(ifd);
+        uint32_t jpeg_offset = 0; // JPEGInterchangeFormat and its length, an embedded preview
+        uint32_t jpeg_length = 0;
+
+        for (size_t i = 0; i < entries; ++i) {
+            const size_t entry = offset + 2 + i * 12;
+            const uint16_t tag = this->U16(entry);
+            const uint16_t type = this->U16(entry + 2);
+            const uint32_t count = this->U32(entry + 4);
+
+            const size_t unit = typeSize(type);
+            if (unit == 0) {
+                continue;
+            }
+            const uint64_t bytes = uint64_t(unit) * count;
+            const size_t value_offset = bytes <= 4 ? entry + 8 : this->U32(entry + 8);
+            if (value_offset > this->size_ || bytes > this->size_ - value_offset) {
+                continue; // Exiv2 drops entries pointing outside the data as well
+            }
+
+            if ((tag == 0x0201 || tag == 0x0202) && count == 1 && (type == kLong || type == kShort)) {
+                (tag == 0x0201 ? jpeg_offset : jpeg_length) = type == kLong ? this->U32(value_offset) : this->U16(value_offset);
+            }
+
+            if (ifd == Ifd::Image) {
+                if (tag == 0x02bc) { // XMLPacket
+                    if (this->sink_.xmp_packet) {
+                        this->sink_.xmp_packet(std::string_view(reinterpret_cast<const char*>(this->data_ + value_offset), bytes));
+                    }
+                    continue;
+                }
+                if (tag == 0x83bb || (tag == 0x8649 && irbHasIptc(this->data_ + value_offset, bytes))) {
+                    if (!this->sink_.skip_iptc) {
+                        return this->Fail(NativeReadResult::Unsupported); // IPTC is read by Exiv2
+                    }
+                    continue;
+                }
+            }
+
+            const char* name = tagName(table, tag);
+            if (name == nullptr) {
+                continue;
+            }
+
+            this->key_ = "Exif.";
+            this->key_ += table.group;
+            this->key_ += '.';
+            this->key_ += name;
+
+            if (this->sink_.exif_slot) {
+                this->sink_.exif_slot(this->key_, type, count, this->data_ + value_offset);
+            }
+
+            const bool comment = (ifd == Ifd::Photo && tag == 0x9286) || (ifd == Ifd::GpsInfo && (tag == 0x1b || tag == 0x1c));
+            if (comment ? this->FormatComment(value_offset, count) : this->FormatValue(type, count, value_offset)) {
+                if (this->sink_.exif) {
+                    this->sink_.exif(this->key_, this->value_);
+                }
+            }
+
+            if (ifd == Ifd::Image && (tag == 0x8769 || tag == 0x8825) && count == 1 && (type == kLong || type == kIfd)) {
+                if (!this->ReadIfd(this->U32(value_offset), tag == 0x8769 ? Ifd::Photo : Ifd::GpsInfo, nullptr)) {
+                    return false;
+                }
+            } else if (ifd == Ifd::Photo && tag == 0xa005 && count == 1 && (type == kLong || type == kIfd)) {
+                if (!this->ReadIfd(this->U32(value_offset), Ifd::Iop, nullptr)) {
+                    return false;
+                }
+            }
+        }
+
+        if (jpeg_offset != 0 && jpeg_length != 0 && jpeg_offset < this->size_ && jpeg_length <= this->size_ - jpeg_offset && this->sink_.preview) {
+            this->sink_.preview(this->data_ + jpeg_offset, jpeg_length);
+        }
+
+        if (next != nullptr) {
+            *next = this->U32(end);
+        }
+        return true;
+    }
+
+    template <typename... Args>
+    void Append(const char* fmt, Args... args) {
+        char buffer[64];
+        const int length = std::snprintf(buffer, sizeof(buffer), fmt, args...);
+        if (length > 0) {
+            this->value_.append(buffer, std::min(size_t(length), sizeof(buffer) - 1));
+        }
+    }
+
+    // Same text as Exiv2's Value::toString() for the tag's type.
+    bool FormatValue(uint16_t type, uint32_t count, size_t offset) {
+        this->value_.clear();
+
+        if (type == kAscii) {
+            const char* text = reinterpret_cast<const char*>(this->data_ + offset);
+            this->value_.assign(text, strnlen(text, count));
+            return true;
+        }
+
+        const size_t unit = typeSize(type);
+        for (uint32_t i = 0; i < count; ++i) {
+            const size_t at = offset + size_t(i) * unit;
+            if (i != 0) {
+                this->value_ += ' ';
+            }
+
+            switch (type) {
+                case kByte: case kSByte: case kUndefined: this->Append("%u", unsigned(this->data_[at])); break;
+                case kShort: this->Append("%u", unsigned(this->U16(at))); break;
+                case kSShort: this->Append("%d", int(int16_t(this->U16(at)))); break;
+                case kLong: case kIfd: this->Append("%" PRIu32, this->U32(at)); break;
+                case kSLong: this->Append("%" PRId32, int32_t(this->U32(at))); break;
+                case kRational: this->Append("%" PRIu32 "/%" PRIu32, this->U32(at), this->U32(at + 4)); break;
+                case kSRational: this->Append("%" PRId32 "/%" PRId32, int32_t(this->U32(at)), int32_t(this->U32(at + 4))); break;
+                case kFloat: {
+                    const uint32_t bits = this->U32(at);
+                    float value;
+                    std::memcpy(&value, &bits, sizeof(value));
+                    this->Append("%g", double(value));
+                    break;
+                }
+                case kDouble: {
+                    const uint64_t bits = this->U64(at);
+                    double value;
+                    std::memcpy(&value, &bits, sizeof(value));
+                    this->Append("%g", value);
+                    break;
+                }
+                default: return false;
+            }
+        }
+        return true;
+    }
+
+    // Exiv2's CommentValue: an 8 byte charset header, then the text.
+    bool FormatComment(size_t offset, uint32_t count) {
+        this->value_.clear();
+        if (count < 8) {
+            return true;
+        }
+
+        const char* header = reinterpret_cast<const char*>(this->data_ + offset);
+        const char* text = header + 8;
+        const size_t length = strnlen(text, count - 8);
+
+        if (std::memcmp(header, "ASCII\0\0\0", 8) == 0) {
+            this->value_ = "charset=Ascii ";
+        } else if (std::memcmp(header, "\0\0\0\0\0\0\0\0", 8) != 0) {
+            return false; // Unicode and JIS need charset conversion, leave them to Exiv2
+        }
+        this->value_.append(text, length);
+        return true;
+    }
+
+    const uint8_t* data_;
+    size_t size_;
+    const NativeReadSink& sink_;
+    bool little_endian_ = true;
+    int ifds_read_ = 0;
+    NativeReadResult result_ = NativeReadResult::Ok;
+    std::string key_;
+    std::string value_;
+};
+
+NativeReadResult readJpeg(const uint8_t* data, size_t size, const NativeReadSink& sink) {
+    static const char kExifHeader[] = "Exif\0\0";
+    static const char kXmpHeader[] = "http://ns.adobe.com/xap/1.0/"; // followed by a NUL
+    static const char kPhotoshopHeader[] = "Photoshop 3.0";
+
+    bool have_exif = false;
+    bool have_xmp = false;
+    bool have_comment = false;
+    size_t pos = 2;
+
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xff) {
+            return NativeReadResult::Malformed;
+        }
+
+        const uint8_t marker = data[pos + 1];
+        if (marker == 0xff) { // fill byte
+            pos++;
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd8)) { // markers without a length
+            pos += 2;
+            continue;
+        }
+        if (marker == 0xda || marker == 0xd9) { // start of scan: metadata can't follow
+            break;
+        }
+
+        const size_t length = size_t(data[pos + 2]) << 8 | data[pos + 3];
+        if (length < 2 || pos + 2 + length > size) {
+            return NativeReadResult::Malformed;
+        }
+        const uint8_t* segment = data + pos + 4;
+        const size_t segment_size = length - 2;
+
+        if (marker == 0xe1 && !have_exif && segment_size >= 6 && std::memcmp(segment, kExifHeader, 6) == 0) {
+            const NativeReadResult result = readTiffExif(segment + 6, segment_size - 6, sink);
+            if (result != NativeReadResult::Ok) {
+                return result;
+            }
+            have_exif = true;
+        } else if (marker == 0xe1 && !have_xmp && segment_size >= sizeof(kXmpHeader) &&
+                   std::memcmp(segment, kXmpHeader, sizeof(kXmpHeader)) == 0) {
+            if (sink.xmp_packet) {
+                sink.xmp_packet(std::string_view(reinterpret_cast<const char*>(segment) + sizeof(kXmpHeader),
+                                                 segment_size - sizeof(kXmpHeader)));
+            }
+            have_xmp = true;
+        } else if (marker == 0xed && segment_size >= sizeof(kPhotoshopHeader) &&
+                   std::memcmp(segment, kPhotoshopHeader, sizeof(kPhotoshopHeader)) == 0 &&
+                   irbHasIptc(segment + sizeof(kPhotoshopHeader), segment_size - sizeof(kPhotoshopHeader))) {
+            if (!sink.skip_iptc) {
+                return NativeReadResult::Unsupported; // IPTC is read by Exiv2
+            }
+        } else if (marker == 0xfe && !have_comment) {
+            std::string_view comment(reinterpret_cast<const char*>(segment), segment_size);
+            while (!comment.empty() && comment.back() == '\0') {
+                comment.remove_suffix(1);
+            }
+            if (sink.comment) {
+                sink.comment(comment);
+            }
+            have_comment = true;
+        }
+
+        pos += 2 + length;
+    }
+
+    return NativeReadResult::Ok;
+}
+
+// ISO-BMFF (HEIF/HEIC/AVIF). Only the box headers on the path to meta/iinf/iloc
+// and the Exif/XMP item extents are touched, never the coded image data.
+struct Box {
+    uint32_t type;
+    const uint8_t* payload; // after the (full)box header
+    size_t size;
+};
+
+constexpr uint32_t fourcc(const char (&code)[5]) {
+    return uint32_t(uint8_t(code[0])) << 24 | uint32_t(uint8_t(code[1])) << 16 | uint32_t(uint8_t(code[2])) << 8 | uint8_t(code[3]);
+}
+
+uint64_t readBigEndian(const uint8_t* p, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+        value = value << 8 | p[i];
+    }
+    return value;
+}
+
+// Iterates the boxes in [data, data + size). Returns false on a malformed header.
+template <typename Visit>
+bool forEachBox(const uint8_t* data, size_t size, Visit visit) {
+    size_t pos = 0;
+    while (pos + 8 <= size) {
+        uint64_t box_size = readBigEndian(data + pos, 4);
+        const uint32_t type = static_cast<uint32_t>(readBigEndian(data + pos + 4, 4));
+        size_t header = 8;
+
+        if (box_size == 1) {
+            if (pos + 16 > size) {
+                return false;
+            }
+            box_size = readBigEndian(data + pos + 8, 8);
+            header = 16;
+        } else if (box_size == 0) {
+            box_size = size - pos; // extends to the end
+        }
+
+        if (box_size < header || box_size > size - pos) {
+            return false;
+        }
+        if (!visit(Box{type, data + pos + header, static_cast<size_t>(box_size) - header})) {
+            return true; // visitor is done
+        }
+        pos += static_cast<size_t>(box_size);
+    }
+    return true;
+}
+
+struct ItemLocation {
+    uint32_t id;
+    int construction_method;
+    uint64_t offset;
+    uint64_t length;
+    int extents;
+};
+
+class BmffReader {
+public:
+    BmffReader(const uint8_t* data, size_t size, const NativeReadSink& sink) : data_(data), size_(size), sink_(sink) {
+    }
+
+    NativeReadResult Read() {
+        const uint8_t* meta = nullptr;
+        size_t meta_size = 0;
+        bool is_heif = false;
+
+        const bool ok = forEachBox(this->data_, this->size_, [&](const Box& box) {
+            if (box.type == fourcc("ftyp")) {
+                is_heif = this->IsHeifBrand(box);
+            } else if (box.type == fourcc("meta") && box.size >= 4) {
+                meta = box.payload + 4; // skip version and flags
+                meta_size = box.size - 4;
+                return false; // everything we need is in here, stop before mdat
+            }
+            return true;
+        });
+
+        if (!is_heif) {
+            return NativeReadResult::Unsupported; // CR3, MP4 and friends keep their metadata elsewhere
+        }
+        if (!ok || meta == nullptr) {
+            return NativeReadResult::Malformed;
+        }
+
+        if (!forEachBox(meta, meta_size, [&](const Box& box) {
+                if (box.type == fourcc("iinf")) {
+                    this->ok_ = this->ReadItemInfo(box) && this->ok_;
+                } else if (box.type == fourcc("iloc")) {
+                    this->ok_ = this->ReadItemLocations(box) && this->ok_;
+                } else if (box.type == fourcc("idat")) {
+                    this->idat_ = box.payload;
+                    this->idat_size_ = box.size;
+                }
+                return true;
+            }) || !this->ok_) {
+            return NativeReadResult::Malformed;
+        }
+
+        for (const auto& location : this->locations_) {
+            if (location.id == this->exif_id_ && this->exif_id_ != 0) {
+                const NativeReadResult result = this->ReadExifItem(location);
+                if (result != NativeReadResult::Ok) {
+                    return result;
+                }
+            } else if (location.id == this->xmp_id_ && this->xmp_id_ != 0) {
+                std::string_view packet;
+                if (this->ItemData(location, packet) && this->sink_.xmp_packet) {
+                    while (!packet.empty() && packet.back() == '\0') {
+                        packet.remove_suffix(1);
+                    }
+                    this->sink_.xmp_packet(packet);
+                }
+            }
+        }
+
+        return NativeReadResult::Ok;
+    }
+
+private:
+    bool IsHeifBrand(const Box& box) const {
+        static const uint32_t brands[] = {
+            fourcc("heic"), fourcc("heix"), fourcc("heim"), fourcc("heis"), fourcc("hevc"), fourcc("hevx"),
+            fourcc("mif1"), fourcc("msf1"), fourcc("avif"), fourcc("avis"),
+        };
+
+        // major brand, minor version, then compatible brands
+        for (size_t pos = 0; pos + 4 <= box.size; pos += pos == 0 ? 8 : 4) {
+            const uint32_t brand = static_cast<uint32_t>(readBigEndian(box.payload + pos, 4));
+            if (std::find(std::begin(brands), std::end(brands), brand) != std::end(brands)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool ReadItemInfo(const Box& box) {
+        if (box.size < 6) {
+            return false;
+        }
+        const int version = box.payload[0];
+        const size_t header = version == 0 ? 6 : 8;
+        if (box.size < header) {
+            return false;
+        }
+
+        return forEachBox(box.payload + header, box.size - header, [&](const Box& entry) {
+            if (entry.type != fourcc("infe") || entry.size < 4) {
+                return true;
+            }
+
+            const int entry_version = entry.payload[0];
+            if (entry_version < 2) {
+                return true; // pre-HEIF item info, no item types
+            }
+
+            const size_t id_size = entry_version == 2 ? 2 : 4;
+            size_t pos = 4;
+            if (pos + id_size + 2 + 4 > entry.size) {
+                return true;
+            }
+            const uint32_t id = static_cast<uint32_t>(readBigEndian(entry.payload + pos, id_size));
+            pos += id_size + 2; // item_protection_index
+            const uint32_t type = static_cast<uint32_t>(readBigEndian(entry.payload + pos, 4));
+            pos += 4;
+
+            if (type == fourcc("Exif")) {
+                this->exif_id_ = id;
+            } else if (type == fourcc("mime")) {
+                const char* strings = reinterpret_cast<const char*>(entry.payload + pos);
+                const size_t available = entry.size - pos;
+                const size_t name_length = strnlen(strings, available); // item_name
+                if (name_length < available) {
+                    const std::string_view content_type(strings + name_length + 1, strnlen(strings + name_length + 1, available - name_length - 1));
+                    if (content_type == "application/rdf+xml") {
+                        this->xmp_id_ = id;
+                    }
+                }
+            }
+            return true;
+        });
+    }
+
+    bool ReadItemLocations(const Box& box) {
+        if (box.size < 6) {
+            return false;
+        }
+        const uint8_t* p = box.payload;
+        const uint8_t* end = box.payload + box.size;
+        const int version = p[0];
+        if (version > 2) {
+            return false;
+        }
+
+        const size_t offset_size = p[4] >> 4;
+        const size_t length_size = p[4] & 0xf;
+        const size_t base_offset_size = p[5] >> 4;
+        const size_t index_size = version >= 1 ? (p[5] & 0xf) : 0;
+        p += 6;
+
+        const size_t count_size = version < 2 ? 2 : 4;
+        if (end - p < static_cast<ptrdiff_t>(count_size)) {
+            return false;
+        }
+        const uint64_t items = readBigEndian(p, count_size);
+        p += count_size;
+
+        for (uint64_t i = 0; i < items; ++i) {
+            const size_t fixed = count_size + (version >= 1 ? 2 : 0) + 2 + base_offset_size + 2;
+            if (end - p < static_cast<ptrdiff_t>(fixed)) {
+                return false;
+            }
+
+            ItemLocation location{};
+            location.id = static_cast<uint32_t>(readBigEndian(p, count_size));
+            p += count_size;
+            if (version >= 1) {
+                location.construction_method = p[1] & 0xf;
+                p += 2;
+            }
+            p += 2; // data_reference_index
+            const uint64_t base_offset = readBigEndian(p, base_offset_size);
+            p += base_offset_size;
+            const size_t extents = static_cast<size_t>(readBigEndian(p, 2));
+            p += 2;
+
+            const size_t extent_size = index_size + offset_size + length_size;
+            if (static_cast<size_t>(end - p) < extents * extent_size) {
+                return false;
+            }
+
+            location.extents = static_cast<int>(extents);
+            if (extents > 0) {
+                // only the first extent is kept, see ItemData()
+                location.offset = base_offset + readBigEndian(p + index_size, offset_size);
+                location.length = readBigEndian(p + index_size + offset_size, length_size);
+            }
+            p += extents * extent_size;
+
+            this->locations_.push_back(location);
+        }
+        return true;
+    }
+
+    // Exif and XMP items are written as a single extent in practice; anything
+    // fancier is left to Exiv2 by reporting the item as unreadable.
+    bool ItemData(const ItemLocation& location, std::string_view& data) const {
+        if (location.extents != 1) {
+            return false;
+        }
+
+        const uint8_t* base = nullptr;
+        size_t base_size = 0;
+        if (location.construction_method == 0) {
+            base = this->data_;
+            base_size = this->size_;
+        } else if (location.construction_method == 1) {
+            base = this->idat_;
+            base_size = this->idat_size_;
+        } else {
+            return false;
+        }
+
+        if (base == nullptr || location.offset > base_size || location.length > base_size - location.offset) {
+            return false;
+        }
+        data = std::string_view(reinterpret_cast<const char*>(base + location.offset), static_cast<size_t>(location.length));
+        return true;
+    }
+
+    NativeReadResult ReadExifItem(const ItemLocation& location) const {
+        std::string_view item;
+        if (!this->ItemData(location, item)) {
+            return NativeReadResult::Unsupported;
+        }
+        if (item.size() < 4) {
+            return NativeReadResult::Malformed;
+        }
+
+        // a 4 byte offset to the TIFF header, which usually skips an "Exif\0\0" prefix
+        const uint64_t tiff = 4 + readBigEndian(reinterpret_cast<const uint8_t*>(item.data()), 4);
+        if (tiff > item.size()) {
+            return NativeReadResult::Malformed;
+        }
+        return readTiffExif(reinterpret_cast<const uint8_t*>(item.data()) + tiff, item.size() - static_cast<size_t>(tiff), this->sink_);
+    }
+
+    const uint8_t* data_;
+    size_t size_;
+    const NativeReadSink& sink_;
+
+    const uint8_t* idat_ = nullptr;
+    size_t idat_size_ = 0;
+    uint32_t exif_id_ = 0;
+    uint32_t xmp_id_ = 0;
+    std::vector<ItemLocation> locations_;
+    bool ok_ = true;
+};
+
+} // namespace
+
+NativeReadResult readTiffExif(const uint8_t* data, size_t size, const NativeReadSink& sink) {
+    return TiffReader(data, size, sink).Read();
+}
+
+NativeReadResult readNativeMetadata(const uint8_t* data, size_t size, const NativeReadSink& sink) {
+    if (size >= 3 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff) {
+        return readJpeg(data, size, sink);
+    }
+    if (size >= 4 && (std::memcmp(data, "II*\0", 4) == 0 || std::memcmp(data, "MM\0*", 4) == 0)) {
+        return readTiffExif(data, size, sink);
+    }
+    if (size >= 12 && std::memcmp(data + 4, "ftyp", 4) == 0) {
+        return BmffReader(data, size, sink).Read();
+    }
+    return NativeReadResult::Unsupported;
+}
@@ -0,0 +1,137 @@
+#include <metoxid/prefetch.hpp>
+#include <metoxid/trace.hpp>
+#include <algorithm>
+#include <iterator>
+
+FieldList previewFields(FieldList fields, size_t limit) {
+    static const char* const kSummaryKeys[] = {
+        "Exif.Image.Make", "Exif.Image.Model", "Exif.Photo.LensModel", "Exif.Photo.DateTimeOriginal",
+        "Exif.Photo.ExposureTime", "Exif.Photo.FNumber", "Exif.Photo.ISOSpeedRatings", "Exif.Photo.FocalLength",
+        "Exif.Image.Orientation", "Exif.Photo.PixelXDimension", "Exif.Photo.PixelYDimension",
+        "Exif.GPSInfo.GPSLatitude", "Exif.GPSInfo.GPSLongitude", "Exif.Image.Artist", "Exif.Image.Copyright",
+        "Comment",
+    };
+
+    // fields is sorted by key, so the summary fields can be found by binary search
+    FieldList preview;
+    for (const char* key : kSummaryKeys) {
+        const auto it = std::lower_bound(fields.begin(), fields.end(), key,
+                                         [](const auto& field, const char* key) { return field.first < key; });
+        if (it != fields.end() && it->first == key) {
+            preview.push_back(std::move(*it));
+            fields.erase(it);
+        }
+    }
+
+    const size_t rest = std::min(fields.size(), limit > preview.size() ? limit - preview.size() : 0);
+    std::move(fields.begin(), fields.begin() + rest, std::back_inserter(preview));
+    return preview;
+}
+
+std::shared_ptr<const FileMetadata> MetadataCache::Get(const std::filesystem::path& path, const FileStamp& stamp) {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+
+    const auto it = this->index_.find(path.string());
+    if (it == this->index_.end() || !(it->second->stamp == stamp)) {
+        return nullptr;
+    }
+
+    this->entries_.splice(this->entries_.begin(), this->entries_, it->second);
+    return it->second->metadata;
+}
+
+bool MetadataCache::Contains(const std::filesystem::path& path, const FileStamp& stamp) {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+
+    const auto it = this->index_.find(path.string());
+    return it != this->index_.end() && it->second->stamp == stamp;
+}
+
+void MetadataCache::Put(const std::filesystem::path& path, const FileStamp& stamp, std::shared_ptr<const FileMetadata> metadata) {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    std::string key = path.string();
+
+    const auto it = this->index_.find(key);
+    if (it != this->index_.end()) {
+        it->second->stamp = stamp;
+        it->second->metadata = std::move(metadata);
+        this->entries_.splice(this->entries_.begin(), this->entries_, it->second);
+        return;
+    }
+
+    this->entries_.push_front(Entry{key, stamp, std::move(metadata)});
+    this->index_.emplace(std::move(key), this->entries_.begin());
+
+    while (this->entries_.size() > this->capacity_) {
+        this->index_.erase(this->entries_.back().path);
+        this->entries_.pop_back();
+    }
+}
+
+void MetadataCache::Erase(const std::filesystem::path& path) {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+
+    const auto it = this->index_.find(path.string());
+    if (it != this->index_.end()) {
+        this->entries_.erase(it->second);
+        this->index_.erase(it);
+    }
+}
+
+MetadataPrefetcher::MetadataPrefetcher(MetadataCache& cache, Loader loader, size_t threads)
+    : cache_(cache), loader_(std::move(loader)), pool_(threads) {
+}
+
+void MetadataPrefetcher::Prefetch(const std::vector<std::filesystem::path>& paths) {
+    std::vector<std::filesystem::path> submit;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->wanted_.clear();
+        for (const auto& path : paths) {
+            this->wanted_.insert(path.string());
+            if (this->queued_.count(path.string()) == 0) {
+                submit.push_back(path);
+            }
+        }
+    }
+
+    for (const auto& path : submit) {
+        const auto stamp = FileStamp::Of(path);
+        if (stamp && this->cache_.Contains(path, *stamp)) {
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->queued_.insert(path.string());
+        }
+        if (!this->pool_.TrySubmit([this, path] { this->Load(path); })) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->queued_.erase(path.string());
+            break; // queue is full, the rest is further from the cursor anyway
+        }
+    }
+}
+
+void MetadataPrefetcher::Load(const std::filesystem::path& path) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        if (this->wanted_.count(path.string()) == 0) { // the cursor moved on before we got here
+            this->queued_.erase(path.string());
+            return;
+        }
+    }
+
+    setTraceThreadName("prefetch");
+    TraceSpan span("prefetch");
+    span.Detail(path.string());
+
+    const auto stamp = FileStamp::Of(path);
+    if (stamp && !this->cache_.Contains(path, *stamp)) {
+        this->cache_.Put(path, *stamp, this->loader_(path));
+        this->updated_ = true;
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->queued_.erase(path.string());
+}
@@ -0,0 +1,127 @@
+#include <metoxid/preview.hpp>
+#include <metoxid/metadata.hpp>
+#include <metoxid/native_reader.hpp>
+#include <metoxid/trace.hpp>
+#include <algorithm>
+
+namespace {
+
+uint16_t bigEndian16(const uint8_t* p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+// Reads the dimensions from the JPEG's frame header, walking the segment lengths so only
+// the few bytes of each header are touched. Stops at the scan, where the frame header
+// has to have been.
+void jpegDimensions(const uint8_t* data, size_t size, size_t& width, size_t& height) {
+    size_t offset = 2; // after SOI
+    while (offset + 4 <= size && data[offset] == 0xff) {
+        const uint8_t marker = data[offset + 1];
+        if (marker == 0xff) { // fill byte
+            offset++;
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd7)) { // no length
+            offset += 2;
+            continue;
+        }
+        if (marker == 0xd9 || marker == 0xda) {
+            return;
+        }
+
+        const size_t length = bigEndian16(data + offset + 2);
+        const bool frame = marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc;
+        if (frame && length >= 7 && offset + 9 <= size) {
+            height = bigEndian16(data + offset + 5);
+            width = bigEndian16(data + offset + 7);
+            return;
+        }
+        offset += 2 + length;
+    }
+}
+
+} // namespace
+
+std::vector<EmbeddedPreview> readPreviews(const std::shared_ptr<const MappedFile>& file, bool fast) {
+    TraceSpan span("read previews");
+    span.Detail(file->Path().string());
+
+    const uint8_t* const data = file->Data();
+    const size_t size = file->Size();
+    std::vector<EmbeddedPreview> previews;
+
+    NativeReadSink sink;
+    sink.skip_iptc = true;
+    sink.preview = [&](const uint8_t* begin, size_t length) {
+        if (length < 4 || begin[0] != 0xff || begin[1] != 0xd8) { //not a JPEG, or the offset is stale
+            return;
+        }
+        for (const auto& preview : previews) {
+            if (preview.bytes.data() == reinterpret_cast<const char*>(begin)) {
+                return; // both IFDs pointing at one image
+            }
+        }
+
+        EmbeddedPreview preview;
+        preview.mime_type = "image/jpeg";
+        preview.extension = ".jpg";
+        preview.bytes = std::string_view(reinterpret_cast<const char*>(begin), length);
+        jpegDimensions(begin, length, preview.width, preview.height);
+        previews.push_back(std::move(preview));
+    };
+    const bool native = readNativeMetadata(data, size, sink) == NativeReadResult::Ok;
+
+    if (!fast || !native) {
+        try {
+            auto image = Exiv2::ImageFactory::open(std::make_unique<Exiv2::MemIo>(data, size));
+            image->readMetadata();
+
+            Exiv2::PreviewManager manager(*image);
+            for (const auto& properties : manager.getPreviewProperties()) {
+                const bool found = std::any_of(previews.begin(), previews.end(), [&](const EmbeddedPreview& preview) {
+                    return preview.Mapped() && preview.bytes.size() == properties.size_;
+                });
+                if (found) {
+                    continue; // the same JPEG the built-in reader already pointed at
+                }
+
+                const Exiv2::PreviewImage image_preview = manager.getPreviewImage(properties);
+                auto copy = std::make_shared<const std::string>(reinterpret_cast<const char*>(image_preview.pData()), image_preview.size());
+
+                EmbeddedPreview preview;
+                preview.mime_type = properties.mimeType_;
+                preview.extension = properties.extension_;
+                preview.width = properties.width_;
+                preview.height = properties.height_;
+                preview.bytes = *copy;
+                preview.copy = std::move(copy);
+                previews.push_back(std::move(preview));
+            }
+        } catch (Exiv2::Error& err) {
+            throw MetadataError(std::string("Failed to read the previews: ") + err.what());
+        } catch (const std::exception& e) {
+            throw MetadataError(e.what());
+        }
+    }
+
+    std::stable_sort(previews.begin(), previews.end(), [](const EmbeddedPreview& a, const EmbeddedPreview& b) {
+        const size_t a_pixels = a.width * a.height;
+        const size_t b_pixels = b.width * b.height;
+        return a_pixels != b_pixels ? a_pixels < b_pixels : a.bytes.size() < b.bytes.size();
+    });
+    return previews;
+}
+
+std::filesystem::path previewPath(const std::filesystem::path& dir, const std::filesystem::path& file, size_t index, const EmbeddedPreview& preview) {
+    std::filesystem::path path;
+    if (dir.empty()) {
+        path = file;
+    } else {
+        const std::filesystem::path absolute = std::filesystem::absolute(file).lexically_normal();
+        const std::filesystem::path relative = absolute.lexically_relative(std::filesystem::current_path());
+        const bool inside = !relative.empty() && *relative.begin() != "..";
+        path = dir / (inside ? relative : absolute.relative_path());
+    }
+    path += ".preview" + std::to_string(index) + preview.extension;
+    return path;
+}
@@ -0,0 +1,340 @@
+#include <metoxid/query.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+namespace {
+
+std::string lowercase(std::string_view text) {
+    std::string lower(text);
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return lower;
+}
+
+std::optional<double> parseDouble(const std::string& text) {
+    if (text.empty() || std::isspace((unsigned char)text[0])) {
+        return std::nullopt;
+    }
+    char* end = nullptr;
+    const double number = std::strtod(text.c_str(), &end);
+    if (end != text.c_str() + text.size()) {
+        return std::nullopt;
+    }
+    return number;
+}
+
+// Plain numbers and Exif rationals ("1/200", "28/10")
+std::optional<double> parseNumber(const std::string& text) {
+    const size_t slash = text.find('/');
+    if (slash == std::string::npos) {
+        return parseDouble(text);
+    }
+
+    const auto numerator = parseDouble(text.substr(0, slash));
+    const auto denominator = parseDouble(text.substr(slash + 1));
+    if (!numerator || !denominator || *denominator == 0) {
+        return std::nullopt;
+    }
+    return *numerator / *denominator;
+}
+
+bool isFileKey(const std::string& key) {
+    return key.rfind("File.", 0) == 0;
+}
+
+std::string fileValue(const std::string& key, const FileFacts& file) {
+    if (key == "File.Name") {
+        return file.path.filename().string();
+    }
+    if (key == "File.Extension") {
+        const std::string extension = file.path.extension().string();
+        return lowercase(extension.empty() ? extension : extension.substr(1));
+    }
+    if (key == "File.Path") {
+        return file.path.string();
+    }
+    return std::to_string(file.size); // File.Size, the parser rejects every other File.* key
+}
+
+} // namespace
+
+struct Query::Lexer {
+    enum class Token { End, Open, Close, Not, And, Or, Op, Word, String };
+
+    std::string_view text;
+    size_t position = 0;
+
+    Token token = Token::End;
+    size_t token_start = 0;
+    std::string spelling; // the word, the unescaped string or the operator
+
+    explicit Lexer(std::string_view text) : text(text) {
+        this->Next();
+    }
+
+    [[noreturn]] void Fail(const std::string& message) const {
+        throw QueryError(message + " at offset " + std::to_string(this->token_start));
+    }
+
+    static bool IsWordChar(char c) {
+        return !std::isspace((unsigned char)c) && std::string_view("()!=<>~&|\"'").find(c) == std::string_view::npos;
+    }
+
+    void Next() {
+        while (this->position < this->text.size() && std::isspace((unsigned char)this->text[this->position])) {
+            this->position++;
+        }
+        this->token_start = this->position;
+        this->spelling.clear();
+
+        if (this->position >= this->text.size()) {
+            this->token = Token::End;
+            return;
+        }
+
+        const char c = this->text[this->position];
+        const char next = this->position + 1 < this->text.size() ? this->text[this->position + 1] : '\0';
+
+        if (c == '(' || c == ')') {
+            this->token = c == '(' ? Token::Open : Token::Close;
+            this->position++;
+        } else if ((c == '&' && next == '&') || (c == '|' && next == '|')) {
+            this->token = c == '&' ? Token::And : Token::Or;
+            this->position += 2;
+        } else if (c == '!' && next != '=') {
+            this->token = Token::Not;
+            this->position++;
+        } else if (c == '=' || c == '!' || c == '<' || c == '>' || c == '~') {
+            this->token = Token::Op;
+            this->spelling.push_back(c);
+            this->position++;
+            if (next == '=' && c != '~') {
+                this->spelling.push_back('=');
+                this->position++;
+            }
+        } else if (c == '"' || c == '\'') {
+            this->token = Token::String;
+            this->position++;
+            while (true) {
+                if (this->position >= this->text.size()) {
+                    this->Fail("unterminated string");
+                }
+                char s = this->text[this->position++];
+                if (s == c) {
+                    break;
+                }
+                if (s == '\\' && this->position < this->text.size()) {
+                    s = this->text[this->position++];
+                }
+                this->spelling.push_back(s);
+            }
+        } else if (IsWordChar(c)) {
+            while (this->position < this->text.size() && IsWordChar(this->text[this->position])) {
+                this->spelling.push_back(this->text[this->position++]);
+            }
+
+            const std::string keyword = lowercase(this->spelling);
+            this->token = keyword == "and" ? Token::And : keyword == "or" ? Token::Or : keyword == "not" ? Token::Not : Token::Word;
+        } else {
+            this->Fail(std::string("unexpected '") + c + "'");
+        }
+    }
+};
+
+Query::Query(std::string_view text) {
+    Lexer lexer(text);
+    this->root_ = this->ParseOr(lexer);
+    if (lexer.token != Lexer::Token::End) {
+        lexer.Fail("expected and/or");
+    }
+}
+
+size_t Query::Add(Node node) {
+    this->nodes_.push_back(std::move(node));
+    return this->nodes_.size() - 1;
+}
+
+size_t Query::ParseOr(Lexer& lexer) {
+    size_t left = this->ParseAnd(lexer);
+    while (lexer.token == Lexer::Token::Or) {
+        lexer.Next();
+        Node node;
+        node.kind = Kind::Or;
+        node.left = left;
+        node.right = this->ParseAnd(lexer);
+        left = this->Add(std::move(node));
+    }
+    return left;
+}
+
+size_t Query::ParseAnd(Lexer& lexer) {
+    size_t left = this->ParseUnary(lexer);
+    while (lexer.token == Lexer::Token::And) {
+        lexer.Next();
+        Node node;
+        node.kind = Kind::And;
+        node.left = left;
+        node.right = this->ParseUnary(lexer);
+        left = this->Add(std::move(node));
+    }
+    return left;
+}
+
+size_t Query::ParseUnary(Lexer& lexer) {
+    if (lexer.token == Lexer::Token::Not) {
+        lexer.Next();
+        Node node;
+        node.kind = Kind::Not;
+        node.left = this->ParseUnary(lexer);
+        return this->Add(std::move(node));
+    }
+
+    if (lexer.token == Lexer::Token::Open) {
+        lexer.Next();
+        const size_t inner = this->ParseOr(lexer);
+        if (lexer.token != Lexer::Token::Close) {
+            lexer.Fail("expected ')'");
+        }
+        lexer.Next();
+        return inner;
+    }
+
+    return this->ParseLeaf(lexer);
+}
+
+size_t Query::ParseLeaf(Lexer& lexer) {
+    if (lexer.token != Lexer::Token::Word) {
+        lexer.Fail("expected a key");
+    }
+
+    Node node;
+    node.kind = Kind::Exists;
+    node.key = lexer.spelling;
+    if (node.key.back() == '*') {
+        node.key.pop_back();
+        node.prefix = true;
+    }
+    if (isFileKey(node.key) && (node.prefix || (node.key != "File.Name" && node.key != "File.Extension" && node.key != "File.Path" && node.key != "File.Size"))) {
+        lexer.Fail("unknown key " + lexer.spelling + " (File.Name, File.Extension, File.Path and File.Size are known)");
+    }
+    lexer.Next();
+
+    if (lexer.token != Lexer::Token::Op) {
+        return this->Add(std::move(node));
+    }
+
+    const std::string op = lexer.spelling;
+    if (op == "=" || op == "==") {
+        node.op = Op::Equal;
+    } else if (op == "!=") {
+        node.op = Op::NotEqual;
+    } else if (op == "<") {
+        node.op = Op::Less;
+    } else if (op == "<=") {
+        node.op = Op::LessEqual;
+    } else if (op == ">") {
+        node.op = Op::Greater;
+    } else if (op == ">=") {
+        node.op = Op::GreaterEqual;
+    } else if (op == "~") {
+        node.op = Op::Contains;
+    } else {
+        lexer.Fail("unknown operator " + op);
+    }
+    lexer.Next();
+
+    if (lexer.token != Lexer::Token::Word && lexer.token != Lexer::Token::String) {
+        lexer.Fail("expected a value");
+    }
+    node.kind = Kind::Compare;
+    node.value = node.op == Op::Contains ? lowercase(lexer.spelling) : lexer.spelling;
+    node.number = parseNumber(node.value);
+    lexer.Next();
+
+    return this->Add(std::move(node));
+}
+
+Query::Result Query::Evaluate(const FileFacts& file, const FieldList* fields) const {
+    return this->Evaluate(this->root_, file, fields);
+}
+
+Query::Result Query::Evaluate(size_t index, const FileFacts& file, const FieldList* fields) const {
+    const Node& node = this->nodes_[index];
+
+    switch (node.kind) {
+    case Kind::Not: {
+        const Result inner = this->Evaluate(node.left, file, fields);
+        return inner == Result::Unknown ? inner : inner == Result::True ? Result::False : Result::True;
+    }
+    case Kind::And:
+    case Kind::Or: {
+        // a side that decides the answer on its own makes the other side irrelevant, even if it's unknown
+        const Result decisive = node.kind == Kind::And ? Result::False : Result::True;
+        const Result left = this->Evaluate(node.left, file, fields);
+        if (left == decisive) {
+            return left;
+        }
+        const Result right = this->Evaluate(node.right, file, fields);
+        if (right == decisive) {
+            return right;
+        }
+        return left == Result::Unknown || right == Result::Unknown ? Result::Unknown : left;
+    }
+    case Kind::Exists:
+    case Kind::Compare:
+        break;
+    }
+
+    if (isFileKey(node.key)) {
+        const bool matched = node.kind == Kind::Exists || this->Compare(node, fileValue(node.key, file));
+        return matched ? Result::True : Result::False;
+    }
+    if (fields == nullptr) {
+        return Result::Unknown;
+    }
+
+    // fields are sorted by key, a prefix is a contiguous range
+    auto field = std::lower_bound(fields->begin(), fields->end(), node.key, [](const auto& field, const std::string& key) { return field.first < key; });
+    for (; field != fields->end(); ++field) {
+        if (node.prefix ? field->first.compare(0, node.key.size(), node.key) != 0 : field->first != node.key) {
+            break;
+        }
+        if (node.kind == Kind::Exists || this->Compare(node, field->second)) {
+            return Result::True;
+        }
+    }
+    return Result::False;
+}
+
+bool Query::Compare(const Node& node, const std::string& value) const {
+    if (node.op == Op::Contains) {
+        return lowercase(value).find(node.value) != std::string::npos;
+    }
+
+    int order;
+    const auto number = node.number ? parseNumber(value) : std::nullopt;
+    if (number) {
+        order = *number < *node.number ? -1 : *number > *node.number ? 1 : 0;
+    } else {
+        order = value.compare(node.value);
+        order = order < 0 ? -1 : order > 0 ? 1 : 0;
+    }
+
+    switch (node.op) {
+    case Op::Equal:
+        return order == 0;
+    case Op::NotEqual:
+        return order != 0;
+    case Op::Less:
+        return order < 0;
+    case Op::LessEqual:
+        return order <= 0;
+    case Op::Greater:
+        return order > 0;
+    case Op::GreaterEqual:
+        return order >= 0;
+    case Op::Contains:
+        break;
+    }
+    return false;
+}
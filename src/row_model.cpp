@@ -0,0 +1,205 @@
+#include <metoxid/row_model.hpp>
+#include <metoxid/field_search.hpp>
+#include <algorithm>
+
+std::string oneLine(std::string value) {
+    std::replace_if(value.begin(), value.end(), [](char c) { return (unsigned char)c < 0x20; }, ' ');
+    return value;
+}
+
+RowModel::RowModel(std::vector<Category>& categories) : categories_(categories) {
+    this->Rebuild();
+}
+
+void RowModel::Rebuild() {
+    this->rows_.clear();
+    for (size_t i = 0; i < this->categories_.size(); ++i) {
+        this->rows_.push_back({i, nullptr, "", 1});
+        if (this->categories_[i].expanded) {
+            this->AppendFields(i, this->rows_);
+        }
+    }
+    this->UpdateLines(0);
+}
+
+void RowModel::AppendFields(size_t category, std::vector<Row>& rows) {
+    for (auto& field : this->categories_[category].Fields()) { //already sorted by key
+        rows.push_back({category, &field, oneLine(toDisplayString(field.second)), 1});
+    }
+
+    if (this->categories_[category].name == "XMP Packet") { //the packet's tree goes under it
+        auto packet = this->categories_[category].Fields().find("XMP Packet");
+        if (packet != this->categories_[category].Fields().end()) {
+            if (!this->packet_tree_) {
+                this->packet_tree_ = std::make_unique<XmpTree>(toDisplayString(packet->second));
+            }
+            this->AppendNodes(category, &*packet, XmpTree::kRoot, rows);
+        }
+    }
+}
+
+void RowModel::AppendNodes(size_t category, FieldMap::value_type* packet, size_t node, std::vector<Row>& rows) {
+    for (size_t child : this->packet_tree_->Children(node)) {
+        rows.push_back({category, packet, this->NodeDisplay(child), 1, child});
+        if (this->packet_tree_->At(child).expanded) {
+            this->AppendNodes(category, packet, child, rows);
+        }
+    }
+}
+
+std::string RowModel::NodeDisplay(size_t node) const {
+    return this->packet_tree_->At(node).leaf ? oneLine(this->packet_tree_->Value(node)) : "";
+}
+
+std::string RowModel::Key(size_t index) const {
+    const Row& row = this->rows_[index];
+    if (!row.IsNode()) {
+        return row.field->first;
+    }
+
+    const XmpTree::Node& node = this->packet_tree_->At(row.node);
+    std::string key((node.depth - 1) * 2, ' ');
+    if (!node.leaf) {
+        key += node.expanded ? "v " : "> ";
+    }
+    key += node.attribute ? "@" + node.name : node.name;
+    if (!node.attributes.empty()) {
+        key += " " + oneLine(node.attributes);
+    }
+    return key;
+}
+
+bool RowModel::Toggle(size_t index) {
+    if (this->rows_[index].IsNode() && !this->filtered_) {
+        return this->ToggleNode(index);
+    }
+    if (!this->rows_[index].IsCategory() || this->filtered_) {
+        return false;
+    }
+
+    Category& category = this->categories_[this->rows_[index].category];
+    const auto first_field = this->rows_.begin() + index + 1;
+
+    if (category.expanded) {
+        category.expanded = false;
+        const size_t shown = this->rows_[index].category;
+        this->rows_.erase(first_field, std::find_if(first_field, this->rows_.end(), [shown](const Row& row) { return row.category != shown; }));
+    } else {
+        category.expanded = true;
+
+        std::vector<Row> fields;
+        this->AppendFields(this->rows_[index].category, fields);
+        this->rows_.insert(first_field, std::make_move_iterator(fields.begin()), std::make_move_iterator(fields.end()));
+    }
+
+    this->UpdateLines(index);
+    return true;
+}
+
+bool RowModel::ToggleNode(size_t index) {
+    XmpTree& tree = *this->packet_tree_;
+    const size_t node = this->rows_[index].node;
+    if (tree.At(node).leaf) {
+        return false;
+    }
+
+    const auto first_child = this->rows_.begin() + index + 1;
+    if (tree.At(node).expanded) { //everything deeper that follows is below it
+        tree.SetExpanded(node, false);
+        const size_t depth = tree.At(node).depth;
+        this->rows_.erase(first_child, std::find_if(first_child, this->rows_.end(), [&](const Row& row) { return !row.IsNode() || tree.At(row.node).depth <= depth; }));
+    } else {
+        tree.SetExpanded(node, true);
+
+        std::vector<Row> children;
+        this->AppendNodes(this->rows_[index].category, this->rows_[index].field, node, children);
+        this->rows_.insert(first_child, std::make_move_iterator(children.begin()), std::make_move_iterator(children.end()));
+    }
+
+    this->UpdateLines(index);
+    return true;
+}
+
+void RowModel::Filter(const FieldSearch& search, const std::vector<uint32_t>& matches) {
+    this->filtered_ = true;
+    this->rows_.clear();
+
+    for (uint32_t id : matches) { //matches come in category order, each group gets its header
+        const FieldSearch::Entry& entry = search.At(id);
+        if (this->rows_.empty() || this->rows_.back().category != entry.category) {
+            this->rows_.push_back({entry.category, nullptr, "", 1});
+        }
+        this->rows_.push_back({entry.category, entry.field, entry.display, 1});
+    }
+    this->UpdateLines(0);
+}
+
+void RowModel::ClearFilter() {
+    this->filtered_ = false;
+    this->Rebuild();
+}
+
+size_t RowModel::Find(size_t category, const FieldMap::value_type* field) const {
+    for (size_t i = 0; i < this->rows_.size(); ++i) {
+        if (this->rows_[i].category == category && this->rows_[i].field == field) {
+            return i;
+        }
+    }
+    return this->rows_.size();
+}
+
+bool RowModel::Refresh(size_t index) {
+    Row& row = this->rows_[index];
+    if (row.IsCategory()) {
+        return false;
+    }
+
+    if (row.IsNode()) { //the packet's own row shows the edit too
+        row.display = this->NodeDisplay(row.node);
+        const size_t packet_row = this->Find(row.category, row.field);
+        if (packet_row < this->rows_.size()) {
+            this->rows_[packet_row].display = oneLine(toDisplayString(row.field->second));
+        }
+        return false;
+    }
+
+    const std::string value = toDisplayString(row.field->second);
+    row.display = oneLine(value);
+
+    if (this->packet_tree_ && row.field->first == "XMP Packet" && this->packet_tree_->Packet() != value) {
+        this->packet_tree_.reset(); //edited as a whole, the nodes' offsets mean nothing now
+        if (!this->filtered_) { //filtered rows have no nodes, the tree comes back with the categories
+            this->Rebuild();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RowModel::SetHeight(size_t index, size_t height) {
+    height = std::max<size_t>(height, 1);
+    if (this->rows_[index].height == height) {
+        return false;
+    }
+
+    this->rows_[index].height = height;
+    this->UpdateLines(index);
+    return true;
+}
+
+size_t RowModel::RowAtLine(size_t line) const {
+    if (line >= this->Lines()) {
+        return this->rows_.size();
+    }
+    return std::upper_bound(this->line_starts_.begin(), this->line_starts_.end(), line) - this->line_starts_.begin() - 1;
+}
+
+void RowModel::UpdateLines(size_t from) {
+    this->line_starts_.resize(this->rows_.size() + 1);
+    if (from == 0) {
+        this->line_starts_[0] = 0;
+    }
+    for (size_t i = from; i < this->rows_.size(); ++i) {
+        this->line_starts_[i + 1] = this->line_starts_[i] + this->rows_[i].height;
+    }
+}
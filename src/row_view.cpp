@@ -0,0 +1,81 @@
+#include <metoxid.hpp>
+#if defined(METOXID_LINUX) || defined(METOXID_MACOS)
+#include <ncurses.h>
+#else
+#include <ncursesw/ncurses.h>
+#endif
+#include <algorithm>
+
+void drawRow(const RowModel& rows, size_t index, long y, int row, int col, bool selected, const TextBuffer* editing){
+	const Row& entry = rows.At(index);
+
+	for (long line = std::max(y, 0L); line < y + (long)entry.height && line < row; ++line) { //wipes what the row covered last frame
+		move(line, 0);
+		clrtoeol();
+	}
+
+	if (entry.IsCategory()) {
+		if (selected) {
+			attron(COLOR_PAIR(2)); //makes the one you are on look cooler
+		}
+		const Category& category = rows.CategoryOf(index);
+		mvprintw(y, 0, "%c %.*s", category.expanded || rows.Filtered() ? 'v' : '>', std::max(col - 2, 0), category.name.c_str());
+		attroff(COLOR_PAIR(2));
+		return;
+	}
+
+	const std::string key = rows.Key(index);
+	if (editing == nullptr) {
+		if (selected) {
+			attron(COLOR_PAIR(2));
+		}
+		if (entry.IsNode() && !rows.PacketTree()->At(entry.node).leaf) { //a packet tree node with children, nothing to show after it
+			mvprintw(y, 0, "  %.*s", std::max(col - 2, 0), key.c_str());
+			attroff(COLOR_PAIR(2));
+			return;
+		}
+		mvprintw(y, 0, "  %.*s:", std::max(col - 3, 0), key.c_str());
+		attroff(COLOR_PAIR(2));
+
+		const int value_width = col - (int)key.length() - 4; //only print if there is space horizontally
+		if (value_width > 0) {
+			attron(COLOR_PAIR(1));
+			printw(" %.*s", value_width, entry.display.c_str());
+			attroff(COLOR_PAIR(1));
+		}
+		return;
+	}
+
+	//the field being edited wraps over as many lines as it needs, only the lines on screen are drawn
+	const std::string prefix = "  " + key + ": ";
+	for (size_t i = 0; i < prefix.length(); ++i) {
+		const long line = y + (long)(i / col);
+		if (line >= 0 && line < row) {
+			const int pair = i < prefix.length() - 1 ? 2 : 0;
+			attron(COLOR_PAIR(pair));
+			mvaddch(line, i % col, (unsigned char)prefix[i]);
+			attroff(COLOR_PAIR(pair));
+		}
+	}
+
+	const size_t cursor_row = editing->CursorRow();
+	for (long line = std::max(y, 0L); line < y + (long)editing->Rows() && line < row; ++line) {
+		const size_t text_row = (size_t)(line - y);
+		const TextBuffer::Span span = editing->RowSpan(text_row);
+
+		attron(COLOR_PAIR(1));
+		for (size_t i = 0; i < span.length && span.column + i < (size_t)col; ++i) {
+			const char c = editing->At(span.position + i);
+			mvaddch(line, span.column + i, (unsigned char)c < 0x20 ? ' ' : (unsigned char)c); //tabs would move the cursor
+		}
+		attroff(COLOR_PAIR(1));
+
+		if (text_row == cursor_row) {
+			const size_t cursor = editing->Cursor();
+			const char c = cursor < editing->Size() ? editing->At(cursor) : ' ';
+			attron(COLOR_PAIR(2));
+			mvaddch(line, editing->CursorColumn(), (unsigned char)c < 0x20 ? ' ' : (unsigned char)c); //a cell past the end of the line when the cursor is there
+			attroff(COLOR_PAIR(2));
+		}
+	}
+}
@@ -0,0 +1,89 @@
+#include <metoxid/save_queue.hpp>
+#include <metoxid/trace.hpp>
+#include <limits>
+
+SaveQueue::SaveQueue(Done done)
+    : done_(std::move(done)), writer_(1, std::numeric_limits<size_t>::max()) { // one writer, queueing never blocks the UI
+}
+
+void SaveQueue::Save(const std::filesystem::path& path, std::shared_ptr<Metadata> metadata) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->pending_[path.string()]++;
+        this->pending_total_++;
+    }
+    this->SetState(path, State::Queued);
+
+    this->writer_.Submit([this, path, metadata = std::move(metadata)] { this->Write(path, metadata); });
+}
+
+void SaveQueue::Write(const std::filesystem::path& path, const std::shared_ptr<Metadata>& metadata) {
+    setTraceThreadName("save writer");
+    TraceSpan span("save");
+    span.Detail(path.string());
+
+    try {
+        this->SetState(path, State::Encoding);
+        metadata->Encode();
+        this->SetState(path, State::Writing);
+        metadata->WriteFile();
+        this->SetState(path, State::Saved);
+    } catch (const std::exception& e) {
+        this->SetState(path, State::Failed, e.what());
+    }
+
+    if (this->done_) {
+        this->done_(path);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        const auto it = this->pending_.find(path.string());
+        if (--it->second == 0) {
+            this->pending_.erase(it);
+        }
+        this->pending_total_--;
+    }
+    this->finished_.notify_all();
+}
+
+void SaveQueue::SetState(const std::filesystem::path& path, State state, std::string error) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->latest_ = Status{path, state, std::move(error)};
+        if (state == State::Failed) {
+            this->failures_.push_back(*this->latest_);
+        }
+    }
+    this->updated_ = true;
+}
+
+bool SaveQueue::Pending(const std::filesystem::path& path) {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    return this->pending_.count(path.string()) != 0;
+}
+
+size_t SaveQueue::Pending() {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    return this->pending_total_;
+}
+
+void SaveQueue::Wait(const std::filesystem::path& path) {
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    this->finished_.wait(lock, [&] { return this->pending_.count(path.string()) == 0; });
+}
+
+void SaveQueue::WaitAll() {
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    this->finished_.wait(lock, [this] { return this->pending_total_ == 0; });
+}
+
+std::optional<SaveQueue::Status> SaveQueue::Latest() {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    return this->latest_;
+}
+
+std::vector<SaveQueue::Status> SaveQueue::Failures() {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    return this->failures_;
+}
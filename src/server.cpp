@@ -0,0 +1,599 @@
+#include <metoxid.hpp>
+#include <metoxid/server.hpp>
+#include <metoxid/batch.hpp>
+#include <metoxid/thread_pool.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#if !defined(METOXID_WINDOWS)
+#include <cerrno>
+#include <signal.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+using BatchCommand = int (*)(const std::vector<std::string>&, const BatchContext&);
+
+const std::pair<const char*, BatchCommand> kServedCommands[] = {
+    {"dump", runDump},
+    {"query", runQuery},
+    {"dupes", runDupes},
+    {"previews", runPreviews},
+    {"set", runSet},
+};
+
+BatchCommand servedCommand(const std::string& command) {
+    for (const auto& [name, run] : kServedCommands) {
+        if (command == name) {
+            return run;
+        }
+    }
+    return nullptr;
+}
+
+} // namespace
+
+bool isServedCommand(const std::string& command) {
+    return servedCommand(command) != nullptr;
+}
+
+#if defined(METOXID_WINDOWS)
+
+int runServe(const std::vector<std::string>& args) {
+    std::fprintf(stderr, "metoxid serve: not supported on Windows\n");
+    return 2;
+}
+
+std::filesystem::path defaultSocketPath() {
+    return {};
+}
+
+std::optional<int> runRemote(const std::filesystem::path& socket, const std::vector<std::string>& args) {
+    return std::nullopt;
+}
+
+std::optional<IndexedFile> readRemote(const std::filesystem::path& socket, const std::filesystem::path& path, ReadMode mode) {
+    return std::nullopt;
+}
+
+#else
+
+namespace {
+
+// Protocol: a request is a kind byte, 'r' to run a command or 'f' for a file's fields,
+// followed by its strings. A run carries the client's stdout and stderr along with its
+// kind byte (SCM_RIGHTS) and is answered with the exit status once it's done; a fields
+// request is answered with a found byte, the error and the fields. Integers are u32
+// little-endian, strings are a u32 length followed by the bytes.
+constexpr uint32_t kMaxString = 1 << 20;
+constexpr uint32_t kMaxCount = 1 << 20;
+constexpr size_t kCachedFiles = 50000; // files the server's index holds in memory, unless --cache says otherwise
+
+#if defined(MSG_NOSIGNAL)
+constexpr int kSendFlags = MSG_NOSIGNAL; // a peer that went away is an error, not a SIGPIPE
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+volatile sig_atomic_t stop_requested = 0;
+
+void requestStop(int) {
+    stop_requested = 1;
+}
+
+// Closes the descriptor when it goes out of scope.
+class Descriptor {
+public:
+    explicit Descriptor(int fd = -1) : fd_(fd) {}
+    Descriptor(Descriptor&& other) noexcept : fd_(other.fd_) {
+        other.fd_ = -1;
+    }
+    Descriptor& operator=(Descriptor&&) = delete;
+    ~Descriptor() {
+        if (this->fd_ >= 0) {
+            ::close(this->fd_);
+        }
+    }
+
+    int Get() const {
+        return this->fd_;
+    }
+
+    int Release() {
+        const int fd = this->fd_;
+        this->fd_ = -1;
+        return fd;
+    }
+private:
+    int fd_;
+};
+
+void putU32(std::string& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>(value >> (i * 8)));
+    }
+}
+
+void putString(std::string& out, std::string_view text) {
+    putU32(out, static_cast<uint32_t>(text.size()));
+    out.append(text);
+}
+
+bool sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        const ssize_t result = ::send(fd, data.data() + sent, data.size() - sent, kSendFlags);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return false;
+        }
+        sent += static_cast<size_t>(result);
+    }
+    return true;
+}
+
+bool receiveAll(int fd, void* data, size_t size) {
+    char* next = static_cast<char*>(data);
+    while (size > 0) {
+        const ssize_t result = ::recv(fd, next, size, 0);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return false;
+        }
+        next += result;
+        size -= static_cast<size_t>(result);
+    }
+    return true;
+}
+
+bool receiveU32(int fd, uint32_t& value) {
+    uint8_t bytes[4];
+    if (!receiveAll(fd, bytes, sizeof(bytes))) {
+        return false;
+    }
+    value = static_cast<uint32_t>(bytes[0]) | static_cast<uint32_t>(bytes[1]) << 8 | static_cast<uint32_t>(bytes[2]) << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+    return true;
+}
+
+bool receiveString(int fd, std::string& text) {
+    uint32_t size = 0;
+    if (!receiveU32(fd, size) || size > kMaxString) {
+        return false;
+    }
+    text.resize(size);
+    return size == 0 || receiveAll(fd, text.data(), size);
+}
+
+// The control buffer of a message carrying stdout and stderr.
+union DescriptorControl {
+    char buffer[CMSG_SPACE(2 * sizeof(int))];
+    cmsghdr align;
+};
+
+// Receives the kind byte of a request and the descriptors sent along with it.
+bool receiveKind(int fd, char& kind, std::vector<Descriptor>& fds) {
+    DescriptorControl control;
+    std::memset(&control, 0, sizeof(control));
+    iovec part{&kind, 1};
+    msghdr message{};
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    ssize_t result;
+    do {
+        result = ::recvmsg(fd, &message, 0);
+    } while (result < 0 && errno == EINTR);
+    if (result != 1) {
+        return false;
+    }
+
+    for (cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header)) {
+        if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        const size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; ++i) {
+            int received;
+            std::memcpy(&received, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+            fds.emplace_back(received);
+        }
+    }
+    return (message.msg_flags & MSG_CTRUNC) == 0;
+}
+
+// Whether the process at the other end runs as the same user as this one. The socket's
+// permissions already say so where they're enforced, not every system does.
+bool sameUser(int fd) {
+#if defined(METOXID_LINUX)
+    ucred credentials{};
+    socklen_t size = sizeof(credentials);
+    return ::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &size) == 0 && credentials.uid == ::geteuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return ::getpeereid(fd, &uid, &gid) == 0 && uid == ::geteuid();
+#endif
+}
+
+bool socketAddress(const std::filesystem::path& path, sockaddr_un& address) {
+    const std::string text = path.string();
+    std::memset(&address, 0, sizeof(address));
+    if (text.empty() || text.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, text.c_str(), text.size() + 1);
+    return true;
+}
+
+// A connection to the server listening at path, -1 when there's none (or it belongs to someone else).
+int connectTo(const std::filesystem::path& path) {
+    sockaddr_un address;
+    if (!socketAddress(path, address)) {
+        return -1;
+    }
+
+    Descriptor connection(::socket(AF_UNIX, SOCK_STREAM, 0));
+    if (connection.Get() < 0) {
+        return -1;
+    }
+#if defined(SO_NOSIGPIPE)
+    const int on = 1;
+    ::setsockopt(connection.Get(), SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    if (::connect(connection.Get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || !sameUser(connection.Get())) {
+        return -1;
+    }
+    return connection.Release();
+}
+
+// What the server keeps between requests.
+struct Server {
+    MetadataIndex& index;
+    ThreadPool& pool;
+    std::filesystem::path directory; // its own working directory, restored after every run
+    Descriptor out; // its own stdout and stderr, likewise
+    Descriptor err;
+};
+
+// Runs a client's command with the client's stdout, stderr and working directory in place
+// of the server's, and answers with its exit status.
+void serveRun(Server& server, int connection, std::vector<Descriptor> fds) {
+    std::string directory;
+    uint32_t count = 0;
+    if (fds.size() != 2 || !receiveString(connection, directory) || !receiveU32(connection, count) || count == 0 || count > kMaxCount) {
+        return;
+    }
+    std::vector<std::string> args(count);
+    for (auto& arg : args) {
+        if (!receiveString(connection, arg)) {
+            return;
+        }
+    }
+
+    std::fflush(stdout);
+    std::fflush(stderr);
+    ::dup2(fds[0].Get(), STDOUT_FILENO);
+    ::dup2(fds[1].Get(), STDERR_FILENO);
+
+    int status = 2;
+    std::error_code ec;
+    std::filesystem::current_path(directory, ec);
+    const BatchCommand run = servedCommand(args[0]);
+    if (ec) {
+        std::fprintf(stderr, "metoxid: %s: %s\n", directory.c_str(), ec.message().c_str());
+    } else if (run == nullptr) {
+        std::fprintf(stderr, "metoxid serve: %s isn't a command the server runs\n", args[0].c_str());
+    } else {
+        try {
+            status = run(std::vector<std::string>(args.begin() + 1, args.end()), BatchContext{&server.index, &server.pool});
+        } catch (const std::exception& e) {
+            std::fprintf(stderr, "metoxid %s: %s\n", args[0].c_str(), e.what());
+        }
+    }
+
+    std::fflush(stdout);
+    std::fflush(stderr);
+    ::dup2(server.out.Get(), STDOUT_FILENO);
+    ::dup2(server.err.Get(), STDERR_FILENO);
+    std::filesystem::current_path(server.directory, ec);
+    fds.clear(); //whoever reads the client's output sees it end before the client does
+
+    std::string reply;
+    putU32(reply, static_cast<uint32_t>(status));
+    sendAll(connection, reply);
+}
+
+// Runs accepted but not started yet. The runner thread serves them one at a time, so a
+// long run holds up neither accepting connections nor the fields requests.
+struct RunQueue {
+    struct Run {
+        Descriptor connection;
+        std::vector<Descriptor> fds;
+    };
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<Run> runs;
+    bool stopping = false;
+};
+
+void runnerLoop(Server& server, RunQueue& queue) {
+    while (true) {
+        std::unique_lock<std::mutex> lock(queue.mutex);
+        queue.ready.wait(lock, [&queue] { return queue.stopping || !queue.runs.empty(); });
+        if (queue.stopping) {
+            return; // the runs still queued are closed unanswered, like connections never accepted
+        }
+        RunQueue::Run run = std::move(queue.runs.front());
+        queue.runs.pop_front();
+        lock.unlock();
+
+        serveRun(server, run.connection.Get(), std::move(run.fds));
+        server.index.Flush();
+    }
+}
+
+// Reads the file on the pool, so the server can take the next request meanwhile.
+void serveFields(Server& server, Descriptor connection) {
+    std::string path;
+    uint32_t mode = 0;
+    if (!receiveString(connection.Get(), path) || !receiveU32(connection.Get(), mode)) {
+        return;
+    }
+
+    auto shared = std::make_shared<Descriptor>(std::move(connection));
+    server.pool.Submit([&index = server.index, shared, path, mode] {
+        std::optional<IndexedFile> entry;
+        if (std::filesystem::path(path).is_absolute()) { //the server's working directory isn't the client's
+            entry = readFields(path, FileStamp::Of(path), mode == 0 ? ReadMode::Full : ReadMode::Fast, &index);
+        } else {
+            entry.emplace();
+            entry->error = "metoxid serve expects an absolute path";
+        }
+
+        std::string reply(1, entry ? 1 : 0);
+        putString(reply, entry ? entry->error : "");
+        putU32(reply, entry ? static_cast<uint32_t>(entry->fields.size()) : 0);
+        if (entry) {
+            for (const auto& field : entry->fields) {
+                putString(reply, field.first);
+                putString(reply, field.second);
+            }
+        }
+        sendAll(shared->Get(), reply);
+    });
+}
+
+} // namespace
+
+int runServe(const std::vector<std::string>& args) {
+    std::filesystem::path socket = defaultSocketPath();
+    size_t jobs = 0;
+    size_t cached = kCachedFiles;
+    std::optional<std::filesystem::path> location; //in memory unless --index
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        if (arg == "--socket" && i + 1 < args.size()) {
+            socket = args[++i];
+        } else if (arg.rfind("--socket=", 0) == 0) {
+            socket = arg.substr(9);
+        } else if ((arg == "-j" || arg == "--jobs") && i + 1 < args.size()) {
+            jobs = std::strtoul(args[++i].c_str(), nullptr, 10);
+        } else if (arg.rfind("--jobs=", 0) == 0) {
+            jobs = std::strtoul(arg.c_str() + 7, nullptr, 10);
+        } else if (arg == "--cache" && i + 1 < args.size()) {
+            cached = std::strtoul(args[++i].c_str(), nullptr, 10);
+        } else if (arg.rfind("--cache=", 0) == 0) {
+            cached = std::strtoul(arg.c_str() + 8, nullptr, 10);
+        } else if (arg == "--index") {
+            location = MetadataIndex::DefaultLocation();
+        } else if (arg.rfind("--index=", 0) == 0) {
+            location = arg.substr(8);
+        } else {
+            std::fprintf(stderr, "usage: metoxid serve [--socket PATH] [-j N] [--index[=DIR]] [--cache FILES]\n");
+            return 2;
+        }
+    }
+    const auto index = std::make_unique<MetadataIndex>(location.value_or(std::filesystem::path()), cached);
+
+    sockaddr_un address;
+    if (!socketAddress(socket, address)) {
+        std::fprintf(stderr, "metoxid serve: %s is too long for a socket path\n", socket.c_str());
+        return 2;
+    }
+    if (Descriptor running(connectTo(socket)); running.Get() >= 0) {
+        std::fprintf(stderr, "metoxid serve: a server is already listening on %s\n", socket.c_str());
+        return 2;
+    }
+    struct stat existing;
+    if (::lstat(socket.c_str(), &existing) == 0) {
+        if (!S_ISSOCK(existing.st_mode)) { //never remove something that isn't ours to remove
+            std::fprintf(stderr, "metoxid serve: %s exists and isn't a socket\n", socket.c_str());
+            return 2;
+        }
+        ::unlink(socket.c_str()); //left behind by a server that didn't exit cleanly
+    }
+
+    Descriptor listener(::socket(AF_UNIX, SOCK_STREAM, 0));
+    const mode_t mask = ::umask(0177); //the socket is created 0600
+    const bool bound = listener.Get() >= 0 && ::bind(listener.Get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+    ::umask(mask);
+    if (!bound || ::listen(listener.Get(), SOMAXCONN) != 0) {
+        std::fprintf(stderr, "metoxid serve: %s: %s\n", socket.c_str(), std::strerror(errno));
+        return 2;
+    }
+
+    // SIGINT and SIGTERM are blocked in every thread and only let through while waiting for
+    // a connection, so they never interrupt a run halfway through a file.
+    sigset_t signals, waiting;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &waiting);
+    struct sigaction action{};
+    action.sa_handler = requestStop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    Exiv2::XmpParser::initialize();
+    Exiv2::LogMsg::setLevel(Exiv2::LogMsg::mute);
+
+    ThreadPool pool(jobs);
+    std::error_code ec;
+    Server server{*index, pool, std::filesystem::current_path(ec), Descriptor(::dup(STDOUT_FILENO)), Descriptor(::dup(STDERR_FILENO))};
+    std::fprintf(stderr, "metoxid serve: listening on %s with %zu workers\n", socket.c_str(), pool.Size());
+
+    RunQueue queue;
+    std::thread runner(runnerLoop, std::ref(server), std::ref(queue)); //inherits the blocked signals
+
+    while (!stop_requested) {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(listener.Get(), &readable);
+        if (::pselect(listener.Get() + 1, &readable, nullptr, nullptr, nullptr, &waiting) <= 0) {
+            continue; // a signal
+        }
+
+        Descriptor connection(::accept(listener.Get(), nullptr, nullptr));
+        if (connection.Get() < 0 || !sameUser(connection.Get())) {
+            continue;
+        }
+        const timeval timeout{5, 0}; //a client that stops halfway through a request doesn't hold up the rest
+        ::setsockopt(connection.Get(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        char kind = 0;
+        std::vector<Descriptor> fds;
+        if (!receiveKind(connection.Get(), kind, fds)) {
+            continue;
+        }
+        if (kind == 'r') { //one at a time, a run takes over stdout and the working directory
+            {
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.runs.push_back(RunQueue::Run{std::move(connection), std::move(fds)});
+            }
+            queue.ready.notify_one();
+        } else if (kind == 'f') {
+            serveFields(server, std::move(connection));
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.stopping = true;
+    }
+    queue.ready.notify_one();
+    runner.join(); // lets the run in progress finish
+    pool.Wait();
+    ::unlink(socket.c_str());
+    std::fprintf(stderr, "metoxid serve: stopped\n");
+    return 0;
+}
+
+std::filesystem::path defaultSocketPath() {
+    if (const char* runtime = std::getenv("XDG_RUNTIME_DIR"); runtime != nullptr && *runtime != '\0') {
+        return std::filesystem::path(runtime) / "metoxid.sock";
+    }
+    return std::filesystem::temp_directory_path() / ("metoxid-" + std::to_string(::geteuid()) + ".sock");
+}
+
+std::optional<int> runRemote(const std::filesystem::path& socket, const std::vector<std::string>& args) {
+    const Descriptor connection(connectTo(socket));
+    if (connection.Get() < 0) {
+        return std::nullopt;
+    }
+
+    std::error_code ec;
+    std::string request;
+    putString(request, std::filesystem::current_path(ec).string());
+    putU32(request, static_cast<uint32_t>(args.size()));
+    for (const auto& arg : args) {
+        putString(request, arg);
+    }
+
+    // stdout and stderr go along with the kind byte, the server writes to them directly
+    char kind = 'r';
+    DescriptorControl control;
+    std::memset(&control, 0, sizeof(control));
+    iovec part{&kind, 1};
+    msghdr message{};
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    const int fds[2] = {STDOUT_FILENO, STDERR_FILENO};
+    std::memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+    std::fflush(stdout);
+    std::fflush(stderr);
+    if (::sendmsg(connection.Get(), &message, kSendFlags) != 1 || !sendAll(connection.Get(), request)) {
+        return std::nullopt; //nothing ran
+    }
+
+    uint32_t status = 0;
+    if (!receiveU32(connection.Get(), status)) {
+        std::fprintf(stderr, "metoxid: the server at %s stopped before %s finished\n", socket.c_str(), args[0].c_str());
+        return 1;
+    }
+    return static_cast<int>(status);
+}
+
+std::optional<IndexedFile> readRemote(const std::filesystem::path& socket, const std::filesystem::path& path, ReadMode mode) {
+    const Descriptor connection(connectTo(socket));
+    if (connection.Get() < 0) {
+        return std::nullopt;
+    }
+
+    std::error_code ec;
+    std::string request(1, 'f');
+    putString(request, std::filesystem::absolute(path, ec).string());
+    putU32(request, mode == ReadMode::Full ? 0 : 1);
+    if (!sendAll(connection.Get(), request)) {
+        return std::nullopt;
+    }
+
+    uint8_t found = 0;
+    uint32_t count = 0;
+    IndexedFile entry;
+    entry.mode = mode;
+    if (!receiveAll(connection.Get(), &found, 1) || !receiveString(connection.Get(), entry.error) || !receiveU32(connection.Get(), count) || count > kMaxCount) {
+        return std::nullopt;
+    }
+    entry.fields.resize(count);
+    for (auto& field : entry.fields) {
+        if (!receiveString(connection.Get(), field.first) || !receiveString(connection.Get(), field.second)) {
+            return std::nullopt;
+        }
+    }
+    if (found == 0) {
+        entry.error = "Not a file format metoxid reads";
+    }
+    return entry;
+}
+
+#endif
@@ -0,0 +1,578 @@
+#include <metoxid/tag_schema.hpp>
+#include <algorithm>
+
+namespace {
+
+constexpr TagSchema kTags[] = {
+    {"Exif.Image.ImageWidth", "Image Width", TagType::Long, 1, 0, -1, ""},
+    {"Exif.Image.ImageLength", "Image Height", TagType::Long, 1, 0, -1, ""},
+    {"Exif.Image.BitsPerSample", "Bits Per Sample", TagType::Short, 0, 0, -1, ""},
+    {"Exif.Image.Compression", "Compression", TagType::Short, 1, 0, -1, ""},
+    {"Exif.Image.PhotometricInterpretation", "Photometric Interpretation", TagType::Short, 1, 0, -1, ""},
+    {"Exif.Image.ImageDescription", "Image Description", TagType::Ascii, 0, 0, -1, ""},
+    {"Exif.Image.Make", "Make", TagType::Ascii, 0, 0, -1, ""},
+    {"Exif.Image.Model", "Model", TagType::Ascii, 0, 0, -1, ""},
+    {"Exif.Image.StripOffsets", "Strip Offsets", TagType::Long, 0, 0, -1, ""},
+    {"Exif.Image.Orientation", "Orientation", TagType::Short, 1, 1, 8, ""},
+    {"Exif.Image.SamplesPerPixel", "Samples Per Pixel", TagType::Short, 1, 0, -1, ""},
+    {"Exif.Image.RowsPerStrip", "Rows Per Strip", TagType::Long, 1, 0, -1, ""},
+    {"Exif.Image.StripByteCounts", "Strip Byte Counts", TagType::Long, 0, 0, -1, ""},
+    {"Exif.Image.XResolution", "X Resolution", TagType::Rational, 1, 0, -1, ""},
+    {"Exif.Image.YResolution", "Y Resolution", TagType::Rational, 1, 0, -1, ""},
+    {"Exif.Image.PlanarConfiguration", "Planar Configuration", TagType::Short, 1, 1, 2, ""},
+    {"Exif.Image.ResolutionUnit", "Resolution Unit", TagType::Short, 1, 1, 3, ""},
+    {"Exif.Image.Software", "Software", TagType::Ascii, 0, 0, -1, ""},
+    {"Exif.Image.DateTime", "Date and Time", TagType::DateTime, 0, 0, -1, ""},
+    {"Exif.Image.Artist", "Artist", TagType::Ascii, 0, 0, -1, ""},
+    {"Exif.Image.HostComputer", "Host Computer", TagType::Ascii, 0, 0, -1, ""},
+    {"Exif.Image.WhitePoint", "White Point", TagType::Rational, 2, 0, -1, ""},
+    {"Exif.Image.PrimaryChromaticities", "Primary Chromaticities", TagType::Rational, 6, 0, -1, ""},
+    {"Exif.Image.TileWidth", "Tile Width", TagType::Long, 1, 0, -1, ""},
+    {"Exif.Image.TileLength", "Tile Length", TagType::Long, 1, 0, -1, ""},
+    {"Exif.Image.JPEGInterchangeFormat", "Thumbnail Offset", TagType::Long, 1, 0, -1, ""},
+    {"Exif.Image.JPEGInterchangeFormatLength", "Thumbnail Length", TagType::Long, 1, 0, -1, ""},
+    {"Exif.Image.YCbCrCoefficients", "YCbCr Coefficients", TagType::Rational, 3, 0, -1, ""},
+    {"Exif.Image.YCbCrSubSampling", "YCbCr Sub-Sampling", TagType::Short, 2, 0, -1, ""},
+    {"Exif.Image.YCbCrPositioning", "YCbCr Positioning", TagType::Short, 1, 1, 2, ""},
+    {"Exif.Image.ReferenceBlackWhite", "Reference Black White", TagType::Rational, 6, 0, -1, ""},
+    {"Exif.Image.Rating", "Rating", TagType::Short, 1, 0, 5, ""},
+    {"Exif.Image.RatingPercent", "Rating Percent", TagType::Short, 1, 0, 100, ""},
+    {"Exif.Image.Copyright", "Copyright", TagType::Ascii, 0, 0, -1, ""},
+    {"Exif.Image.ExifTag", "Exif IFD Pointer", TagType::Long, 1, 0, -1, ""},
+    {"Exif.Image.GPSTag", "GPS IFD Pointer", TagType::Long, 1, 0, -1, ""},
+    {"Exif.Image.DateTimeOriginal", "Date and Time Original", TagType::DateTime, 0, 0, -1, ""},
+    {"Exif.Photo.ExposureTime", "Exposure Time", TagType::Rational, 1, 0, -1, ""},
+    {"Exif.Photo.FNumber", "F-Number", TagType::Rational, 1, 0, -1, ""},
+    {"Exif.Photo.ExposureProgram", "Exposure Program", TagType::Short, 1, 0, 8, ""},
+    {"Exif.Photo.SpectralSensitivity", "Spectral Sensitivity", TagType::Ascii, 0, 0, -1, ""},
+    {"Exif.Photo.ISOSpeedRatings", "ISO Speed", TagType::Short, 0, 0, -1, ""},
+    {"Exif.Photo.SensitivityType", "Sensitivity Type", TagType::Short, 1, 0, 7, ""},
+    {"Exif.Photo.ExifVersion", "Exif Version", TagType::Undefined, 4, 0, -1, ""},
+    {"Exif.Photo.DateTimeOriginal", "Date and Time Original", TagType::DateTime, 0, 0, -1, ""},
+    {"Exif.Photo.DateTimeDigitized", "Date and Time Digitized", TagType::DateTime, 0, 0, -1, ""},
+    {"Exif.Photo.OffsetTime", "Offset Time", TagType::Offset, 0, 0, -1, ""},
+    {"Exif.Photo.OffsetTimeOriginal", "Offset Time Original", TagType::Offset, 0, 0, -1, ""},
+    {"Exif.Photo.OffsetTimeDigitized", "Offset Time Digitized", TagType::Offset, 0, 0, -1, ""},
+    {"Exif.Photo.ComponentsConfiguration", "Components Configuration", TagType::Undefined, 4, 0, 6, ""},
+    {"Exif.Photo.CompressedBitsPerPixel", "Compressed Bits Per Pixel", TagType::Rational, 1, 0, -1, ""},
+    {"Exif.Photo.ShutterSpeedValue", "Shutter Speed Value", TagType::SRational, 1, 0, -1, ""},
+    {"Exif.Photo.ApertureValue", "Aperture Value", TagType::Rational, 1, 0, -1, ""},
+    {"Exif.Photo.BrightnessValue", "Brightness Value", TagType::SRational, 1, 0, -1, ""},
+    {"Exif.Photo.ExposureBiasValue", "Exposure Bias Value", TagType::SRational, 1, 0, -1, ""},
+    {"Exif.Photo.MaxApertureValue", "Max Aperture Value", TagType::Rational, 1, 0, -1, ""},
+    {"Exif.Photo.SubjectDistance", "Subject Distance", TagType::Rational, 1, 0, -1, ""},
+    {"Exif.Photo.MeteringMode", "Metering Mode", TagType::Short, 1, 0, 255, ""},
+    {"Exif.Photo.LightSource", "Light Source", TagType::Short, 1, 0, 255, ""},
+    {"Exif.Photo.Flash", "Flash", TagType::Short, 1, 0, 95, ""},
+    {"Exif.Photo.FocalLength", "Focal Length", TagType::Rational, 1, 0, -1, ""},
+    {"Exif.Photo.SubjectArea", "Subject Area", TagType::Short, 0, 0, -1, ""},
+    {"Exif.Photo.UserComment", "User Comment", TagType::Comment, 0, 0, -1, ""},
+    {"Exif.Photo.SubSecTime", "Sub-Second Time", TagType::Ascii, 0, 0, -1, ""},
+    {"Exif.Photo.SubSecTimeOriginal", "Sub-Second Time Original", TagType::Ascii, 0, 0, -1, ""},
+    {"Exif.Photo.SubSecTimeDigitized", "Sub-Second Time Digitized", TagType::Ascii, 0, 0, -1, ""},
+    {"Exif.Photo.FlashpixVersion", "FlashPix Version", TagType::Undefined, 4, 0, -1, ""},
+    {"Exif.Photo.ColorSpace", "Color Space", TagType::Short, 1, 1, 65535, ""},
+    {"Exif.Photo.PixelXDimension", "Pixel X Dimension", TagType::Long, 1, 0, -1, ""},
+    {"Exif.Photo.PixelYDimension", "Pixel Y Dimension", TagType::Long, 1, 0, -1, ""},
+    {"Exif.Photo.InteroperabilityTag", "Interoperability IFD Pointer", TagType::Long, 1, 0, -1, ""},
+    {"Exif.Photo.FocalPlaneXResolution", "Focal Plane X Resolution", TagType::Rational, 1, 0, -1, ""},
+    {"Exif.Photo.FocalPlaneYResolution", "Focal Plane Y Resolution", TagType::Rational, 1, 0, -1, ""},
+    {"Exif.Photo.FocalPlaneResolutionUnit", "Focal Plane Resolution Unit", TagType::Short, 1, 1, 5, ""},
+    {"Exif.Photo.SensingMethod", "Sensing Method", TagType::Short, 1, 1, 8, ""},
+    {"Exif.Photo.FileSource", "File Source", TagType::Undefined, 1, 0, 3, ""},
+    {"Exif.Photo.SceneType", "Scene Type", TagType::Undefined, 1, 0, 1, ""},
+    {"Exif.Photo.CustomRendered", "Custom Rendered", TagType::Short, 1, 0, -1, ""},
+    {"Exif.Photo.ExposureMode", "Exposure Mode", TagType::Short, 1, 0, 2, ""},
+    {"Exif.Photo.WhiteBalance", "White Balance", TagType::Short, 1, 0, 1, ""},
+    {"Exif.Photo.DigitalZoomRatio", "Digital Zoom Ratio", TagType::Rational, 1, 0, -1, ""},
+    {"Exif.Photo.FocalLengthIn35mmFilm", "Focal Length In 35mm Film", TagType::Short, 1, 0, -1, ""},
+    {"Exif.Photo.SceneCaptureType", "Scene Capture Type", TagType::Short, 1, 0, 3, ""},
+    {"Exif.Photo.GainControl", "Gain Control", TagType::Short, 1, 0, 4, ""},
+    {"Exif.Photo.Contrast", "Contrast", TagType::Short, 1, 0, 2, ""},
+    {"Exif.Photo.Saturation", "Saturation", TagType::Short, 1, 0, 2, ""},
+    {"Exif.Photo.Sharpness", "Sharpness", TagType::Short, 1, 0, 2, ""},
+    {"Exif.Photo.SubjectDistanceRange", "Subject Distance Range", TagType::Short, 1, 0, 3, ""},
+    {"Exif.Photo.ImageUniqueID", "Image Unique ID", TagType::Ascii, 32, 0, -1, ""},
+    {"Exif.Photo.CameraOwnerName", "Camera Owner Name", TagType::Ascii, 0, 0, -1, ""},
+    {"Exif.Photo.BodySerialNumber", "Body Serial Number", TagType::Ascii, 0, 0, -1, ""},
+    {"Exif.Photo.LensSpecification", "Lens Specification", TagType::Rational, 4, 0, -1, ""},
+    {"Exif.Photo.LensMake", "Lens Make", TagType::Ascii, 0, 0, -1, ""},
+    {"Exif.Photo.LensModel", "Lens Model", TagType::Ascii, 0, 0, -1, ""},
+    {"Exif.Photo.LensSerialNumber", "Lens Serial Number", TagType::Ascii, 0, 0, -1, ""},
+    {"Exif.GPSInfo.GPSVersionID", "GPS Version ID", TagType::Byte, 4, 0, -1, ""},
+    {"Exif.GPSInfo.GPSLatitudeRef", "GPS Latitude Reference", TagType::Ascii, 1, 0, -1, "N S"},
+    {"Exif.GPSInfo.GPSLatitude", "GPS Latitude", TagType::Rational, 3, 0, -1, ""},
+    {"Exif.GPSInfo.GPSLongitudeRef", "GPS Longitude Reference", TagType::Ascii, 1, 0, -1, "E W"},
+    {"Exif.GPSInfo.GPSLongitude", "GPS Longitude", TagType::Rational, 3, 0, -1, ""},
+    {"Exif.GPSInfo.GPSAltitudeRef", "GPS Altitude Reference", TagType::Byte, 1, 0, 1, ""},
+    {"Exif.GPSInfo.GPSAltitude", "GPS Altitude", TagType::Rational, 1, 0, -1, ""},
+    {"Exif.GPSInfo.GPSTimeStamp", "GPS Time Stamp", TagType::Rational, 3, 0, -1, ""},
+    {"Exif.GPSInfo.GPSSatellites", "GPS Satellites", TagType::Ascii, 0, 0, -1, ""},
+    {"Exif.GPSInfo.GPSStatus", "GPS Status", TagType::Ascii, 1, 0, -1, "A V"},
+    {"Exif.GPSInfo.GPSMeasureMode", "GPS Measure Mode", TagType::Ascii, 1, 0, -1, "2 3"},
+    {"Exif.GPSInfo.GPSDOP", "GPS DOP", TagType::Rational, 1, 0, -1, ""},
+    {"Exif.GPSInfo.GPSSpeedRef", "GPS Speed Reference", TagType::Ascii, 1, 0, -1, "K M N"},
+    {"Exif.GPSInfo.GPSSpeed", "GPS Speed", TagType::Rational, 1, 0, -1, ""},
+    {"Exif.GPSInfo.GPSTrackRef", "GPS Track Reference", TagType::Ascii, 1, 0, -1, "T M"},
+    {"Exif.GPSInfo.GPSTrack", "GPS Track", TagType::Rational, 1, 0, -1, ""},
+    {"Exif.GPSInfo.GPSImgDirectionRef", "Image Direction Reference", TagType::Ascii, 1, 0, -1, "T M"},
+    {"Exif.GPSInfo.GPSImgDirection", "Image Direction", TagType::Rational, 1, 0, -1, ""},
+    {"Exif.GPSInfo.GPSMapDatum", "GPS Map Datum", TagType::Ascii, 0, 0, -1, ""},
+    {"Exif.GPSInfo.GPSProcessingMethod", "GPS Processing Method", TagType::Comment, 0, 0, -1, ""},
+    {"Exif.GPSInfo.GPSAreaInformation", "GPS Area Information", TagType::Comment, 0, 0, -1, ""},
+    {"Exif.GPSInfo.GPSDateStamp", "GPS Date Stamp", TagType::Date, 0, 0, -1, ""},
+    {"Exif.GPSInfo.GPSDifferential", "GPS Differential", TagType::Short, 1, 0, 1, ""},
+    {"Exif.Iop.InteroperabilityIndex", "Interoperability Index", TagType::Ascii, 0, 0, -1, ""},
+    {"Exif.Iop.InteroperabilityVersion", "Interoperability Version", TagType::Undefined, 4, 0, -1, ""},
+    {"Exif.Iop.RelatedImageWidth", "Related Image Width", TagType::Long, 1, 0, -1, ""},
+    {"Exif.Iop.RelatedImageLength", "Related Image Length", TagType::Long, 1, 0, -1, ""},
+    {"Iptc.Application2.ObjectName", "Object Name", TagType::Ascii, 64, 0, -1, ""},
+    {"Iptc.Application2.EditStatus", "Edit Status", TagType::Ascii, 64, 0, -1, ""},
+    {"Iptc.Application2.Urgency", "Urgency", TagType::Number, 1, 1, 8, ""},
+    {"Iptc.Application2.Category", "Category", TagType::Ascii, 3, 0, -1, ""},
+    {"Iptc.Application2.SuppCategory", "Supplemental Category", TagType::Ascii, 32, 0, -1, ""},
+    {"Iptc.Application2.Keywords", "Keywords", TagType::Ascii, 64, 0, -1, ""},
+    {"Iptc.Application2.LocationCode", "Location Code", TagType::Ascii, 3, 0, -1, ""},
+    {"Iptc.Application2.LocationName", "Location Name", TagType::Ascii, 64, 0, -1, ""},
+    {"Iptc.Application2.ReleaseDate", "Release Date", TagType::IptcDate, 0, 0, -1, ""},
+    {"Iptc.Application2.ReleaseTime", "Release Time", TagType::IptcTime, 0, 0, -1, ""},
+    {"Iptc.Application2.ExpirationDate", "Expiration Date", TagType::IptcDate, 0, 0, -1, ""},
+    {"Iptc.Application2.ExpirationTime", "Expiration Time", TagType::IptcTime, 0, 0, -1, ""},
+    {"Iptc.Application2.SpecialInstructions", "Special Instructions", TagType::Ascii, 256, 0, -1, ""},
+    {"Iptc.Application2.ReferenceDate", "Reference Date", TagType::IptcDate, 0, 0, -1, ""},
+    {"Iptc.Application2.DateCreated", "Date Created", TagType::IptcDate, 0, 0, -1, ""},
+    {"Iptc.Application2.TimeCreated", "Time Created", TagType::IptcTime, 0, 0, -1, ""},
+    {"Iptc.Application2.DigitizationDate", "Digitization Date", TagType::IptcDate, 0, 0, -1, ""},
+    {"Iptc.Application2.DigitizationTime", "Digitization Time", TagType::IptcTime, 0, 0, -1, ""},
+    {"Iptc.Application2.Program", "Program", TagType::Ascii, 32, 0, -1, ""},
+    {"Iptc.Application2.ProgramVersion", "Program Version", TagType::Ascii, 10, 0, -1, ""},
+    {"Iptc.Application2.ObjectCycle", "Object Cycle", TagType::Ascii, 1, 0, -1, "a p b"},
+    {"Iptc.Application2.Byline", "By-line", TagType::Ascii, 32, 0, -1, ""},
+    {"Iptc.Application2.BylineTitle", "By-line Title", TagType::Ascii, 32, 0, -1, ""},
+    {"Iptc.Application2.City", "City", TagType::Ascii, 32, 0, -1, ""},
+    {"Iptc.Application2.SubLocation", "Sub-location", TagType::Ascii, 32, 0, -1, ""},
+    {"Iptc.Application2.ProvinceState", "Province/State", TagType::Ascii, 32, 0, -1, ""},
+    {"Iptc.Application2.CountryCode", "Country Code", TagType::Ascii, 3, 0, -1, ""},
+    {"Iptc.Application2.CountryName", "Country Name", TagType::Ascii, 64, 0, -1, ""},
+    {"Iptc.Application2.TransmissionReference", "Transmission Reference", TagType::Ascii, 32, 0, -1, ""},
+    {"Iptc.Application2.Headline", "Headline", TagType::Ascii, 256, 0, -1, ""},
+    {"Iptc.Application2.Credit", "Credit", TagType::Ascii, 32, 0, -1, ""},
+    {"Iptc.Application2.Source", "Source", TagType::Ascii, 32, 0, -1, ""},
+    {"Iptc.Application2.Copyright", "Copyright Notice", TagType::Ascii, 128, 0, -1, ""},
+    {"Iptc.Application2.Contact", "Contact", TagType::Ascii, 128, 0, -1, ""},
+    {"Iptc.Application2.Caption", "Caption", TagType::Ascii, 2000, 0, -1, ""},
+    {"Iptc.Application2.Writer", "Caption Writer", TagType::Ascii, 32, 0, -1, ""},
+    {"Iptc.Application2.Language", "Language", TagType::Ascii, 3, 0, -1, ""},
+};
+
+// The key lookup is a hash-and-displace perfect hash, built by the compiler: every key's
+// bucket (from one hash) has a displacement, chosen so that the keys of the bucket land
+// in free slots. Looking a key up reads one displacement and one slot.
+constexpr size_t kTagCount = sizeof(kTags) / sizeof(kTags[0]);
+constexpr size_t kSlots = 512;
+constexpr size_t kBuckets = 128;
+constexpr uint16_t kEmpty = 0xffff;
+static_assert(kSlots >= 2 * kTagCount, "the hash table has to stay at most half full");
+
+constexpr uint64_t hashKey(std::string_view key) {
+    uint64_t hash = 0xcbf29ce484222325ull; // FNV-1a
+    for (char c : key) {
+        hash = (hash ^ (uint8_t)c) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+constexpr size_t bucketOf(uint64_t hash) {
+    return (hash >> 32) & (kBuckets - 1);
+}
+
+constexpr size_t slotOf(uint64_t hash, uint16_t displacement) {
+    uint64_t stride = hash ^ (hash >> 29);
+    stride *= 0xbf58476d1ce4e5b9ull;
+    stride ^= stride >> 32;
+    return (hash + displacement * (stride | 1)) & (kSlots - 1); // an odd stride visits every slot
+}
+
+struct PerfectHash {
+    uint16_t displacements[kBuckets];
+    uint16_t tags[kSlots]; // index into kTags, or kEmpty
+    bool complete; // false if some bucket couldn't be placed, i.e. two keys are equal
+};
+
+constexpr PerfectHash buildHash() {
+    PerfectHash result{};
+    uint64_t hashes[kTagCount] = {};
+    size_t sizes[kBuckets] = {};
+    bool placed[kBuckets] = {};
+
+    for (size_t i = 0; i < kTagCount; ++i) {
+        hashes[i] = hashKey(kTags[i].key);
+        sizes[bucketOf(hashes[i])]++;
+    }
+    for (size_t slot = 0; slot < kSlots; ++slot) {
+        result.tags[slot] = kEmpty;
+    }
+
+    for (size_t round = 0; round < kBuckets; ++round) {
+        size_t bucket = kBuckets; // the largest bucket left, they are the hardest to place
+        for (size_t candidate = 0; candidate < kBuckets; ++candidate) {
+            if (!placed[candidate] && (bucket == kBuckets || sizes[candidate] > sizes[bucket])) {
+                bucket = candidate;
+            }
+        }
+        placed[bucket] = true;
+        if (sizes[bucket] == 0) {
+            break;
+        }
+
+        bool fits = false;
+        for (uint16_t displacement = 0; displacement < 4096 && !fits; ++displacement) {
+            size_t taken[kTagCount] = {};
+            size_t count = 0;
+            fits = true;
+            for (size_t i = 0; i < kTagCount && fits; ++i) {
+                if (bucketOf(hashes[i]) != bucket) {
+                    continue;
+                }
+                const size_t slot = slotOf(hashes[i], displacement);
+                fits = result.tags[slot] == kEmpty;
+                for (size_t j = 0; j < count && fits; ++j) {
+                    fits = taken[j] != slot;
+                }
+                taken[count++] = slot;
+            }
+
+            if (fits) {
+                result.displacements[bucket] = displacement;
+                for (size_t i = 0; i < kTagCount; ++i) {
+                    if (bucketOf(hashes[i]) == bucket) {
+                        result.tags[slotOf(hashes[i], displacement)] = (uint16_t)i;
+                    }
+                }
+            }
+        }
+        if (!fits) {
+            return result;
+        }
+    }
+
+    result.complete = true;
+    return result;
+}
+
+constexpr PerfectHash kHash = buildHash();
+static_assert(kHash.complete, "tag keys must be unique");
+
+bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+bool isIntegerType(TagType type) {
+    return type == TagType::Byte || type == TagType::Short || type == TagType::Long || type == TagType::SShort ||
+           type == TagType::SLong || type == TagType::Undefined;
+}
+
+bool isSigned(TagType type) {
+    return type == TagType::SShort || type == TagType::SLong || type == TagType::SRational;
+}
+
+// The values the type can hold, narrowed to the tag's range.
+std::pair<int64_t, int64_t> limits(const TagSchema& tag) {
+    std::pair<int64_t, int64_t> limit;
+    switch (tag.type) {
+        case TagType::Byte: case TagType::Undefined: limit = {0, 255}; break;
+        case TagType::Short: limit = {0, 65535}; break;
+        case TagType::SShort: limit = {-32768, 32767}; break;
+        case TagType::SLong: case TagType::SRational: limit = {-2147483648ll, 2147483647ll}; break;
+        case TagType::Number: limit = {0, 999999999999ll}; break;
+        default: limit = {0, 4294967295ll}; break;
+    }
+    if (tag.Ranged()) {
+        limit = {std::max(limit.first, tag.min), std::min(limit.second, tag.max)};
+    }
+    return limit;
+}
+
+// A decimal integer, with a leading '-' when negative is allowed. Nullopt if it isn't one
+// or has too many digits to be a value of any type.
+std::optional<int64_t> parseInteger(std::string_view text, bool negative) {
+    const bool minus = negative && !text.empty() && text[0] == '-';
+    if (minus) {
+        text.remove_prefix(1);
+    }
+    if (text.empty() || text.size() > 12) {
+        return std::nullopt;
+    }
+
+    int64_t value = 0;
+    for (char c : text) {
+        if (!isDigit(c)) {
+            return std::nullopt;
+        }
+        value = value * 10 + (c - '0');
+    }
+    return minus ? -value : value;
+}
+
+// The whitespace separated tokens, until visit returns false. False if it did.
+template <typename Visit>
+bool eachToken(std::string_view text, size_t& count, Visit visit) {
+    count = 0;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        if (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n') {
+            pos++;
+            continue;
+        }
+        size_t end = pos;
+        while (end < text.size() && text[end] != ' ' && text[end] != '\t' && text[end] != '\n') {
+            end++;
+        }
+        count++;
+        if (!visit(text.substr(pos, end - pos))) {
+            return false;
+        }
+        pos = end;
+    }
+    return true;
+}
+
+// Whether text has the shape of pattern, where every 'd' is a digit and everything else
+// is itself.
+bool matches(std::string_view text, std::string_view pattern) {
+    if (text.size() != pattern.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (pattern[i] == 'd' ? !isDigit(text[i]) : text[i] != pattern[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int digitsAt(std::string_view text, size_t pos, size_t length) {
+    int value = 0;
+    for (size_t i = pos; i < pos + length; ++i) {
+        value = value * 10 + (text[i] - '0');
+    }
+    return value;
+}
+
+bool validDate(std::string_view text, size_t month, size_t day) {
+    const int m = digitsAt(text, month, 2);
+    const int d = digitsAt(text, day, 2);
+    return m >= 1 && m <= 12 && d >= 1 && d <= 31;
+}
+
+bool validTime(std::string_view text, size_t hour, size_t minute, size_t second) {
+    return digitsAt(text, hour, 2) <= 23 && digitsAt(text, minute, 2) <= 59 && digitsAt(text, second, 2) <= 59;
+}
+
+bool validZone(std::string_view zone) {
+    return (matches(zone, "+dd:dd") || matches(zone, "-dd:dd") || matches(zone, "+dddd") || matches(zone, "-dddd")) &&
+           digitsAt(zone, 1, 2) <= 23 && digitsAt(zone, zone.size() - 2, 2) <= 59;
+}
+
+bool validChoice(std::string_view choices, std::string_view text) {
+    size_t count;
+    return !text.empty() && !eachToken(choices, count, [&](std::string_view choice) { return choice != text; });
+}
+
+bool validValue(const TagSchema& tag, std::string_view text) {
+    switch (tag.type) {
+        case TagType::Ascii:
+            return (tag.count == 0 || text.size() <= tag.count) && (tag.choices.empty() || validChoice(tag.choices, text));
+        case TagType::Comment:
+            return true;
+        case TagType::DateTime: // Exif writes an unknown date as blanks between the colons
+            return (matches(text, "dddd:dd:dd dd:dd:dd") && validDate(text, 5, 8) && validTime(text, 11, 14, 17)) ||
+                   text == "    :  :     :  :  ";
+        case TagType::Date:
+            return (matches(text, "dddd:dd:dd") && validDate(text, 5, 8)) || text == "    :  :  ";
+        case TagType::Offset:
+            return text.size() == 6 && validZone(text);
+        case TagType::IptcDate:
+            return (matches(text, "dddd-dd-dd") && validDate(text, 5, 8)) || (matches(text, "dddddddd") && validDate(text, 4, 6));
+        case TagType::IptcTime:
+            if (text.size() >= 8 && matches(text.substr(0, 8), "dd:dd:dd")) {
+                return validTime(text, 0, 3, 6) && (text.size() == 8 || validZone(text.substr(8)));
+            }
+            return text.size() >= 6 && matches(text.substr(0, 6), "dddddd") && validTime(text, 0, 2, 4) &&
+                   (text.size() == 6 || validZone(text.substr(6)));
+        case TagType::Number: {
+            const auto value = parseInteger(text, false);
+            const auto limit = limits(tag);
+            return value && text.size() <= tag.count && *value >= limit.first && *value <= limit.second;
+        }
+        default:
+            break;
+    }
+
+    const auto limit = limits(tag);
+    const bool negative = isSigned(tag.type);
+    size_t count;
+    const bool valid = eachToken(text, count, [&](std::string_view token) {
+        if (tag.type == TagType::Rational || tag.type == TagType::SRational) {
+            const size_t slash = token.find('/');
+            if (slash == std::string_view::npos) {
+                return false;
+            }
+            const auto numerator = parseInteger(token.substr(0, slash), negative);
+            const auto denominator = parseInteger(token.substr(slash + 1), false);
+            return numerator && denominator && *numerator >= limit.first && *numerator <= limit.second &&
+                   *denominator <= 4294967295ll && (*denominator != 0 || *numerator == 0); // 0/0 is how files say unknown
+        }
+        const auto value = parseInteger(token, negative);
+        return value && *value >= limit.first && *value <= limit.second;
+    });
+    return valid && (tag.count == 0 ? true : count == tag.count);
+}
+
+std::string plural(uint16_t count, const char* one, const char* many) {
+    return count == 1 ? one : std::to_string(count) + " " + many;
+}
+
+std::string expected(const TagSchema& tag) {
+    const auto limit = limits(tag);
+    switch (tag.type) {
+        case TagType::Rational:
+        case TagType::SRational: {
+            const char* example = tag.type == TagType::SRational ? "-1/3" : tag.count == 1 ? "1/250" : "1/1";
+            if (tag.count == 0) {
+                return std::string("fractions like ") + example + " separated by spaces";
+            }
+            return plural(tag.count, "a fraction", "fractions") + " like " + example;
+        }
+        case TagType::Undefined:
+            return tag.count == 0 ? "byte values separated by spaces" : plural(tag.count, "a byte value", "byte values") + " from 0 to 255";
+        case TagType::Ascii:
+            if (!tag.choices.empty()) {
+                return "one of " + std::string(tag.choices);
+            }
+            return tag.count == 0 ? "text" : "text of at most " + std::to_string(tag.count) + " characters";
+        case TagType::Comment:
+            return "text";
+        case TagType::DateTime:
+            return "a date and time like 2024:06:30 14:05:00";
+        case TagType::Date:
+            return "a date like 2024:06:30";
+        case TagType::Offset:
+            return "a time zone offset like +02:00";
+        case TagType::IptcDate:
+            return "a date like 2024-06-30";
+        case TagType::IptcTime:
+            return "a time like 14:05:00+02:00";
+        default:
+            break;
+    }
+
+    if (tag.count == 1) {
+        return tag.Ranged() ? "a number from " + std::to_string(limit.first) + " to " + std::to_string(limit.second) : "a whole number";
+    }
+    return tag.count == 0 ? "whole numbers separated by spaces" : std::to_string(tag.count) + " whole numbers";
+}
+
+} // namespace
+
+const TagSchema* findTag(std::string_view key) {
+    const uint64_t hash = hashKey(key);
+    const uint16_t index = kHash.tags[slotOf(hash, kHash.displacements[bucketOf(hash)])];
+    return index != kEmpty && kTags[index].key == key ? &kTags[index] : nullptr;
+}
+
+std::string checkValue(const TagSchema& tag, std::string_view text) {
+    if (validValue(tag, text)) {
+        return "";
+    }
+    return std::string(tag.label) + " takes " + expected(tag);
+}
+
+bool acceptsChar(const TagSchema& tag, char ch) {
+    if (isDigit(ch)) {
+        return true;
+    }
+    switch (tag.type) {
+        case TagType::Byte: case TagType::Short: case TagType::Long: case TagType::Undefined:
+            return ch == ' ';
+        case TagType::SShort: case TagType::SLong:
+            return ch == ' ' || ch == '-';
+        case TagType::Rational:
+            return ch == ' ' || ch == '/';
+        case TagType::SRational:
+            return ch == ' ' || ch == '/' || ch == '-';
+        case TagType::DateTime: case TagType::Date:
+            return ch == ':' || ch == ' ';
+        case TagType::Offset: case TagType::IptcTime:
+            return ch == ':' || ch == '+' || ch == '-';
+        case TagType::IptcDate:
+            return ch == '-';
+        case TagType::Number:
+            return false;
+        default:
+            return true;
+    }
+}
+
+std::optional<std::string> stepValue(const TagSchema& tag, std::string_view text, int delta) {
+    if (!tag.choices.empty()) {
+        std::string_view first;
+        std::string_view previous;
+        std::string_view next;
+        bool found = false;
+        size_t count;
+        eachToken(tag.choices, count, [&](std::string_view choice) {
+            if (first.empty()) {
+                first = choice;
+            }
+            if (found && next.empty()) {
+                next = choice;
+            }
+            if (choice == text) {
+                found = true;
+            } else if (!found) {
+                previous = choice;
+            }
+            return true;
+        });
+
+        if (!found) {
+            return std::string(first);
+        }
+        if (delta > 0) {
+            return std::string(next.empty() ? first : next);
+        }
+        if (previous.empty()) { //wraps to the last choice
+            std::string_view last;
+            eachToken(tag.choices, count, [&](std::string_view choice) { last = choice; return true; });
+            return std::string(last);
+        }
+        return std::string(previous);
+    }
+
+    if (tag.count != 1 || !(isIntegerType(tag.type) || tag.type == TagType::Number)) {
+        return std::nullopt;
+    }
+
+    const auto limit = limits(tag);
+    size_t start = 0;
+    size_t end = text.size();
+    while (start < end && text[start] == ' ') {
+        start++;
+    }
+    while (end > start && text[end - 1] == ' ') {
+        end--;
+    }
+    if (start == end) {
+        return std::to_string(limit.first);
+    }
+    const auto value = parseInteger(text.substr(start, end - start), isSigned(tag.type));
+    if (!value) {
+        return std::nullopt;
+    }
+    return std::to_string(std::clamp(*value + delta, limit.first, limit.second));
+}
+
+std::string describeTag(const TagSchema& tag) {
+    return std::string(tag.label) + ": " + expected(tag);
+}
@@ -0,0 +1,261 @@
+#include <metoxid/text_buffer.hpp>
+#include <algorithm>
+#include <cstring>
+
+void TextBuffer::Sums::Assign(const std::vector<size_t>& values) {
+    this->tree.assign(values.size() + 1, 0);
+    std::copy(values.begin(), values.end(), this->tree.begin() + 1);
+    for (size_t i = 1; i < this->tree.size(); ++i) { //every node adds itself to its parent, O(n)
+        const size_t parent = i + (i & (~i + 1));
+        if (parent < this->tree.size()) {
+            this->tree[parent] += this->tree[i];
+        }
+    }
+}
+
+void TextBuffer::Sums::Add(size_t index, size_t delta) {
+    for (size_t i = index + 1; i < this->tree.size(); i += i & (~i + 1)) {
+        this->tree[i] += delta;
+    }
+}
+
+size_t TextBuffer::Sums::Prefix(size_t count) const {
+    size_t sum = 0;
+    for (size_t i = count; i > 0; i -= i & (~i + 1)) {
+        sum += this->tree[i];
+    }
+    return sum;
+}
+
+size_t TextBuffer::Sums::Find(size_t target) const {
+    size_t step = 1;
+    while (step * 2 < this->tree.size()) {
+        step *= 2;
+    }
+
+    size_t count = 0;
+    for (; step > 0; step /= 2) {
+        if (count + step < this->tree.size() && this->tree[count + step] <= target) {
+            count += step;
+            target -= this->tree[count];
+        }
+    }
+    return count;
+}
+
+void TextBuffer::Assign(std::string_view text) {
+    const size_t capacity = std::max<size_t>(text.size() + text.size() / 2, 64);
+    this->data_.assign(capacity, '\0');
+    std::copy(text.begin(), text.end(), this->data_.begin());
+    this->gap_start_ = text.size();
+    this->gap_end_ = capacity;
+
+    this->lengths_.assign(1, 0);
+    for (char c : text) {
+        if (c == '\n') {
+            this->lengths_.push_back(0);
+        } else {
+            this->lengths_.back()++;
+        }
+    }
+    this->line_ = this->lengths_.size() - 1;
+    this->offset_ = this->lengths_.back();
+    this->Reindex();
+}
+
+std::string TextBuffer::String() const {
+    std::string text(this->data_.begin(), this->data_.begin() + this->gap_start_);
+    text.append(this->data_.begin() + this->gap_end_, this->data_.end());
+    return text;
+}
+
+void TextBuffer::Reindex() {
+    std::vector<size_t> starts(this->lengths_.size());
+    std::vector<size_t> rows(this->lengths_.size());
+    for (size_t line = 0; line < this->lengths_.size(); ++line) {
+        starts[line] = this->lengths_[line] + 1;
+        rows[line] = this->RowsOf(line);
+    }
+    this->starts_.Assign(starts);
+    this->rows_.Assign(rows);
+}
+
+void TextBuffer::Resize(size_t line, size_t length) {
+    const size_t old_length = this->lengths_[line];
+    const size_t old_rows = this->RowsOf(line);
+    this->lengths_[line] = length;
+    this->starts_.Add(line, length - old_length);
+    this->rows_.Add(line, this->RowsOf(line) - old_rows);
+}
+
+void TextBuffer::Layout(size_t width, size_t indent) {
+    width = std::max<size_t>(width, 1);
+    if (width == this->width_ && indent == this->indent_) {
+        return;
+    }
+    this->width_ = width;
+    this->indent_ = indent;
+    this->Reindex();
+}
+
+void TextBuffer::MoveGap(size_t position) {
+    if (position < this->gap_start_) {
+        const size_t count = this->gap_start_ - position;
+        std::memmove(this->data_.data() + this->gap_end_ - count, this->data_.data() + position, count);
+        this->gap_start_ -= count;
+        this->gap_end_ -= count;
+    } else if (position > this->gap_start_) {
+        const size_t count = position - this->gap_start_;
+        std::memmove(this->data_.data() + this->gap_start_, this->data_.data() + this->gap_end_, count);
+        this->gap_start_ += count;
+        this->gap_end_ += count;
+    }
+}
+
+void TextBuffer::MoveTo(size_t line, size_t offset) {
+    this->line_ = line;
+    this->offset_ = offset;
+    this->MoveGap(this->starts_.Prefix(line) + offset);
+}
+
+void TextBuffer::Insert(char c) {
+    if (this->gap_start_ == this->gap_end_) { //grows by half, typing stays amortized O(1)
+        const size_t tail = this->data_.size() - this->gap_end_;
+        const size_t capacity = std::max<size_t>(this->data_.size() + this->data_.size() / 2, 64);
+        this->data_.resize(capacity);
+        std::memmove(this->data_.data() + capacity - tail, this->data_.data() + this->gap_end_, tail);
+        this->gap_end_ = capacity - tail;
+    }
+    this->data_[this->gap_start_++] = c;
+
+    if (c == '\n') { //the rest of the line becomes a line of its own
+        const size_t rest = this->lengths_[this->line_] - this->offset_;
+        this->lengths_[this->line_] = this->offset_;
+        this->lengths_.insert(this->lengths_.begin() + this->line_ + 1, rest);
+        this->line_++;
+        this->offset_ = 0;
+        this->Reindex();
+    } else {
+        this->Resize(this->line_, this->lengths_[this->line_] + 1);
+        this->offset_++;
+    }
+}
+
+bool TextBuffer::Backspace() {
+    if (this->gap_start_ == 0) {
+        return false;
+    }
+
+    if (this->data_[--this->gap_start_] == '\n') { //joins the line with the previous one
+        this->line_--;
+        this->offset_ = this->lengths_[this->line_];
+        this->lengths_[this->line_] += this->lengths_[this->line_ + 1];
+        this->lengths_.erase(this->lengths_.begin() + this->line_ + 1);
+        this->Reindex();
+    } else {
+        this->Resize(this->line_, this->lengths_[this->line_] - 1);
+        this->offset_--;
+    }
+    return true;
+}
+
+bool TextBuffer::Delete() {
+    if (this->gap_end_ == this->data_.size()) {
+        return false;
+    }
+
+    if (this->data_[this->gap_end_++] == '\n') { //joins the next line with this one
+        this->lengths_[this->line_] += this->lengths_[this->line_ + 1];
+        this->lengths_.erase(this->lengths_.begin() + this->line_ + 1);
+        this->Reindex();
+    } else {
+        this->Resize(this->line_, this->lengths_[this->line_] - 1);
+    }
+    return true;
+}
+
+void TextBuffer::Left() {
+    if (this->gap_start_ == 0) {
+        return;
+    }
+    if (this->offset_ > 0) {
+        this->offset_--;
+    } else {
+        this->line_--;
+        this->offset_ = this->lengths_[this->line_];
+    }
+    this->MoveGap(this->gap_start_ - 1);
+}
+
+void TextBuffer::Right() {
+    if (this->gap_end_ == this->data_.size()) {
+        return;
+    }
+    if (this->offset_ < this->lengths_[this->line_]) {
+        this->offset_++;
+    } else {
+        this->line_++;
+        this->offset_ = 0;
+    }
+    this->MoveGap(this->gap_start_ + 1);
+}
+
+size_t TextBuffer::CursorRow() const {
+    return this->rows_.Prefix(this->line_) + (this->Indent(this->line_) + this->offset_) / this->width_;
+}
+
+size_t TextBuffer::CursorColumn() const {
+    return (this->Indent(this->line_) + this->offset_) % this->width_;
+}
+
+void TextBuffer::MoveToRow(size_t row, size_t column) {
+    const size_t line = this->rows_.Find(row);
+    const size_t line_row = row - this->rows_.Prefix(line);
+    const size_t indent = this->Indent(line);
+
+    const size_t cell = line_row * this->width_ + column; //cells of the line, counting the indent
+    size_t offset = cell > indent ? cell - indent : 0;
+    if (line_row + 1 < this->RowsOf(line)) { //stays on the row, its last cell belongs to the next one
+        const size_t row_end = (line_row + 1) * this->width_;
+        offset = std::min(offset, row_end > indent + 1 ? row_end - indent - 1 : 0);
+    }
+    this->MoveTo(line, std::min(offset, this->lengths_[line]));
+}
+
+void TextBuffer::Up() {
+    const size_t row = this->CursorRow();
+    if (row == 0) {
+        this->MoveTo(0, 0);
+    } else {
+        this->MoveToRow(row - 1, this->CursorColumn());
+    }
+}
+
+void TextBuffer::Down() {
+    const size_t row = this->CursorRow();
+    if (row + 1 >= this->Rows()) {
+        this->MoveTo(this->lengths_.size() - 1, this->lengths_.back());
+    } else {
+        this->MoveToRow(row + 1, this->CursorColumn());
+    }
+}
+
+void TextBuffer::Home() {
+    this->MoveToRow(this->CursorRow(), 0);
+}
+
+void TextBuffer::End() {
+    this->MoveToRow(this->CursorRow(), this->width_ - 1);
+}
+
+TextBuffer::Span TextBuffer::RowSpan(size_t row) const {
+    const size_t line = this->rows_.Find(row);
+    const size_t line_row = row - this->rows_.Prefix(line);
+    const size_t indent = this->Indent(line);
+
+    const size_t row_start = line_row * this->width_;
+    const size_t first = std::max(row_start, indent); //the first cell with text, the indent is the key's
+    const size_t offset = first - indent;
+    const size_t length = offset < this->lengths_[line] ? std::min(this->lengths_[line] - offset, row_start + this->width_ - std::min(first, row_start + this->width_)) : 0;
+    return {this->starts_.Prefix(line) + offset, length, first - row_start};
+}
@@ -0,0 +1,121 @@
+#include <metoxid/thread_pool.hpp>
+
+ThreadPool::ThreadPool(size_t threads, size_t max_queued) {
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    this->max_queued_ = max_queued != 0 ? max_queued : threads * 4;
+
+    for (size_t i = 0; i < threads; ++i) {
+        this->workers_.emplace_back([this] { this->WorkerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->stopping_ = true;
+    }
+    this->task_ready_.notify_all();
+
+    for (auto& worker : this->workers_) {
+        worker.join();
+    }
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    this->slot_free_.wait(lock, [this] { return this->queue_.size() < this->max_queued_; });
+    this->queue_.push_back(std::move(task));
+    lock.unlock();
+
+    this->task_ready_.notify_one();
+}
+
+bool ThreadPool::TrySubmit(std::function<void()> task) {
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    if (this->queue_.size() >= this->max_queued_) {
+        return false;
+    }
+    this->queue_.push_back(std::move(task));
+    lock.unlock();
+
+    this->task_ready_.notify_one();
+    return true;
+}
+
+void ThreadPool::Wait() {
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    this->idle_.wait(lock, [this] { return this->queue_.empty() && this->running_ == 0; });
+}
+
+void ThreadPool::WorkerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex_);
+            this->task_ready_.wait(lock, [this] { return this->stopping_ || !this->queue_.empty(); });
+
+            if (this->queue_.empty()) {
+                return; // stopping and nothing left to do
+            }
+
+            task = std::move(this->queue_.front());
+            this->queue_.pop_front();
+            this->running_++;
+        }
+        this->slot_free_.notify_one();
+
+        try {
+            task();
+        } catch (...) {
+            // tasks report their own errors, an escaped exception must not take the pool down
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->running_--;
+            if (this->queue_.empty() && this->running_ == 0) {
+                this->idle_.notify_all();
+            }
+        }
+    }
+}
+
+TaskGroup::~TaskGroup() {
+    this->Wait();
+}
+
+void TaskGroup::Submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->pending_++;
+    }
+
+    this->pool_.Submit([this, task = std::move(task)] {
+        struct Finished { // also when the task throws
+            TaskGroup& group;
+            ~Finished() {
+                group.Finish();
+            }
+        } finished{*this};
+        task();
+    });
+}
+
+void TaskGroup::Wait() {
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    this->idle_.wait(lock, [this] { return this->pending_ == 0; });
+}
+
+void TaskGroup::Finish() {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->pending_--;
+    if (this->pending_ == 0) {
+        this->idle_.notify_all(); // under the lock, the group may be gone as soon as it's released
+    }
+}
@@ -0,0 +1,167 @@
+#include <metoxid/trace.hpp>
+#include <metoxid/utils.hpp>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <vector>
+
+std::atomic<bool> tracingOn{false};
+
+namespace {
+
+struct Event {
+    const char* name;
+    int64_t start_ns;
+    int64_t duration_ns;
+    uint64_t bytes;
+    std::string detail;
+};
+
+// Only its own thread appends, the lock is only ever contended while the trace is written
+struct ThreadBuffer {
+    std::mutex mutex;
+    size_t tid;
+    std::string name;
+    std::vector<Event> events;
+};
+
+struct Tracer {
+    std::mutex mutex;
+    std::filesystem::path path;
+    std::FILE* out = nullptr;
+    std::chrono::steady_clock::time_point epoch;
+    std::vector<std::shared_ptr<ThreadBuffer>> threads; // outlive the threads, which may exit before the trace is written
+};
+
+Tracer& tracer() {
+    static Tracer instance;
+    return instance;
+}
+
+int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tracer().epoch).count();
+}
+
+ThreadBuffer& threadBuffer() {
+    thread_local std::shared_ptr<ThreadBuffer> buffer;
+    if (!buffer) {
+        buffer = std::make_shared<ThreadBuffer>();
+        std::lock_guard<std::mutex> lock(tracer().mutex);
+        buffer->tid = tracer().threads.size() + 1;
+        buffer->name = "thread " + std::to_string(buffer->tid);
+        tracer().threads.push_back(buffer);
+    }
+    return *buffer;
+}
+
+void writeTrace() {
+    stopTracing();
+}
+
+} // namespace
+
+void startTracing(const std::filesystem::path& path) {
+    Tracer& state = tracer(); // constructed before the atexit handler is registered, so it's destroyed after it runs
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (state.out != nullptr) {
+        return;
+    }
+
+    state.out = std::fopen(path.string().c_str(), "w"); // opened now, a bad path shouldn't surface only at exit
+    if (state.out == nullptr) {
+        throw std::system_error(errno, std::generic_category(), "failed to create " + path.string());
+    }
+    state.path = path;
+    state.epoch = std::chrono::steady_clock::now();
+
+    static bool registered = false;
+    if (!registered) {
+        std::atexit(writeTrace);
+        registered = true;
+    }
+    tracingOn = true;
+}
+
+void stopTracing() {
+    Tracer& state = tracer();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (state.out == nullptr) {
+        return;
+    }
+    tracingOn = false;
+
+    std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    auto separate = [&] {
+        json += first ? "\n" : ",\n";
+        first = false;
+    };
+    char number[96];
+
+    for (const auto& thread : state.threads) {
+        std::lock_guard<std::mutex> thread_lock(thread->mutex);
+
+        separate();
+        std::snprintf(number, sizeof(number), "{\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"name\":\"thread_name\",\"args\":{\"name\":", thread->tid);
+        json += number;
+        appendJsonString(json, thread->name);
+        json += "}}";
+
+        for (const auto& event : thread->events) {
+            separate();
+            // timestamps are in microseconds, with the nanoseconds as the fraction
+            std::snprintf(number, sizeof(number), "{\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f,\"name\":",
+                          thread->tid, event.start_ns / 1000.0, event.duration_ns / 1000.0);
+            json += number;
+            appendJsonString(json, event.name);
+
+            if (event.bytes != UINT64_MAX || !event.detail.empty()) {
+                json += ",\"args\":{";
+                if (event.bytes != UINT64_MAX) {
+                    json += "\"bytes\":" + std::to_string(event.bytes);
+                }
+                if (!event.detail.empty()) {
+                    json += event.bytes != UINT64_MAX ? ",\"detail\":" : "\"detail\":";
+                    appendJsonString(json, event.detail);
+                }
+                json += "}";
+            }
+            json += "}";
+        }
+        thread->events.clear();
+    }
+    json += "\n]}\n";
+
+    std::fwrite(json.data(), 1, json.size(), state.out);
+    std::fclose(state.out);
+    state.out = nullptr;
+}
+
+void setTraceThreadName(const char* name) {
+    if (!tracingEnabled()) {
+        return;
+    }
+    ThreadBuffer& buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.name = name;
+}
+
+void TraceSpan::Begin(const char* name) {
+    this->name_ = name;
+    this->start_ns_ = nowNs();
+}
+
+void TraceSpan::End() {
+    const int64_t end_ns = nowNs();
+    if (!tracingEnabled()) {
+        return; // stopped in the meantime
+    }
+
+    ThreadBuffer& buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events.push_back({this->name_, this->start_ns_, end_ns - this->start_ns_, this->bytes_, std::move(this->detail_)});
+}
@@ -36,16 +36,116 @@ void sigintHandler(int dummy) {
     exit(1);
 }
 
-std::vector<std::filesystem::path> listDirectory(const std::filesystem::path& dir) {
-    std::vector<std::filesystem::path> contents;
+void walkFiles(const std::vector<std::filesystem::path>& inputs,
+               const std::function<void(const std::filesystem::path&)>& visit,
+               const std::function<void(const std::filesystem::path&, const std::string&)>& error) {
+	for (const auto& input : inputs) {
+		std::error_code ec;
+		const auto status = std::filesystem::status(input, ec);
 
-	if (dir.has_parent_path()) {
-		contents.push_back(dir / "..");
+		if (ec) {
+			error(input, ec.message());
+		} else if (std::filesystem::is_regular_file(status)) {
+			visit(input);
+		} else if (std::filesystem::is_directory(status)) {
+			// One iterator per level instead of a recursive_directory_iterator, which ends the
+			// whole walk at the first directory it can't read (or, with skip_permission_denied,
+			// skips it without a word). This way the directory is reported and the walk goes on.
+			std::vector<std::filesystem::directory_iterator> levels;
+			levels.emplace_back(input, ec);
+			if (ec) {
+				error(input, ec.message());
+				continue;
+			}
+
+			while (!levels.empty()) {
+				if (levels.back() == std::filesystem::directory_iterator()) {
+					levels.pop_back();
+					continue;
+				}
+
+				const std::filesystem::directory_entry entry = *levels.back();
+				levels.back().increment(ec);
+				if (ec) { // the rest of this directory can't be read, its parents can
+					error(entry.path().parent_path(), ec.message());
+					levels.back() = std::filesystem::directory_iterator();
+					ec.clear();
+				}
+
+				if (entry.is_symlink(ec)) { // like recursive_directory_iterator, never follow links to directories
+					if (entry.is_regular_file(ec)) {
+						visit(entry.path());
+					}
+				} else if (entry.is_directory(ec)) {
+					std::filesystem::directory_iterator below(entry.path(), ec);
+					if (ec) {
+						error(entry.path(), ec.message());
+					} else {
+						levels.push_back(std::move(below));
+					}
+				} else if (entry.is_regular_file(ec)) { // uses the cached d_type where the platform has one
+					visit(entry.path());
+				}
+				ec.clear();
+			}
+		} else {
+			error(input, "not a file or a directory");
+		}
 	}
+}
+
+void appendJsonString(std::string& out, std::string_view value) {
+	static const char hex[] = "0123456789abcdef";
+
+	out.push_back('"');
+
+	for (size_t i = 0; i < value.size(); ) {
+		const unsigned char c = value[i];
+
+		if (c == '"' || c == '\\') {
+			out.push_back('\\');
+			out.push_back(c);
+			i++;
+		} else if (c < 0x20) {
+			switch (c) {
+				case '\n': out += "\\n"; break;
+				case '\r': out += "\\r"; break;
+				case '\t': out += "\\t"; break;
+				default:
+					out += "\\u00";
+					out.push_back(hex[c >> 4]);
+					out.push_back(hex[c & 0xf]);
+			}
+			i++;
+		} else if (c < 0x80) {
+			out.push_back(c);
+			i++;
+		} else {
+			// length of the UTF-8 sequence starting here, 0 if c can't start one
+			size_t length = (c & 0xe0) == 0xc0 ? 2 : (c & 0xf0) == 0xe0 ? 3 : (c & 0xf8) == 0xf0 ? 4 : 0;
+
+			if (length != 0 && i + length <= value.size()) {
+				for (size_t j = 1; j < length; ++j) {
+					if ((static_cast<unsigned char>(value[i + j]) & 0xc0) != 0x80) {
+						length = 0;
+						break;
+					}
+				}
+			} else {
+				length = 0;
+			}
 
-	for (const auto& entry : std::filesystem::directory_iterator(dir)) {
-		contents.push_back(entry.path());
+			if (length != 0) {
+				out.append(value.data() + i, length);
+				i += length;
+			} else {
+				out += "\\u00";
+				out.push_back(hex[c >> 4]);
+				out.push_back(hex[c & 0xf]);
+				i++;
+			}
+		}
 	}
 
-	return contents;
+	out.push_back('"');
 }
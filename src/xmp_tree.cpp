@@ -0,0 +1,340 @@
+#include <metoxid/xmp_tree.hpp>
+#include <metoxid/trace.hpp>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace {
+
+// One piece of markup, or a run of text, starting at begin
+struct Token {
+    enum Kind { Start, Empty, End, Text, Other }; // Empty is <name/>, Other is <?...?>, <!--...--> and <!...>
+    Kind kind;
+    size_t begin;
+    size_t end;
+    std::string_view name;
+    size_t attributes_begin; // between the name and the closing > or />
+    size_t attributes_end;
+};
+
+bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Where a terminator ends, or limit when it's missing (a truncated packet)
+size_t skipPast(std::string_view xml, size_t position, size_t limit, std::string_view terminator) {
+    const size_t found = xml.substr(0, limit).find(terminator, position);
+    return found == std::string_view::npos ? limit : found + terminator.size();
+}
+
+Token nextToken(std::string_view xml, size_t position, size_t limit) {
+    Token token{Token::Other, position, limit, {}, 0, 0};
+
+    if (xml[position] != '<') {
+        const size_t next = xml.substr(0, limit).find('<', position);
+        token.kind = Token::Text;
+        token.end = next == std::string_view::npos ? limit : next;
+        return token;
+    }
+
+    const std::string_view rest = xml.substr(position, limit - position);
+    if (rest.rfind("<?", 0) == 0) {
+        token.end = skipPast(xml, position, limit, "?>");
+    } else if (rest.rfind("<!--", 0) == 0) {
+        token.end = skipPast(xml, position, limit, "-->");
+    } else if (rest.rfind("<![CDATA[", 0) == 0) {
+        token.kind = Token::Text;
+        token.end = skipPast(xml, position, limit, "]]>");
+    } else if (rest.rfind("<!", 0) == 0) {
+        token.end = skipPast(xml, position, limit, ">");
+    } else if (rest.rfind("</", 0) == 0) {
+        token.kind = Token::End;
+        token.end = skipPast(xml, position, limit, ">");
+    } else {
+        size_t name_end = position + 1;
+        while (name_end < limit && !isSpace(xml[name_end]) && xml[name_end] != '/' && xml[name_end] != '>') {
+            name_end++;
+        }
+        token.name = xml.substr(position + 1, name_end - position - 1);
+
+        size_t end = name_end; // the closing >, outside of quoted attribute values
+        char quote = '\0';
+        for (; end < limit && (quote != '\0' || xml[end] != '>'); ++end) {
+            if (quote == '\0' && (xml[end] == '"' || xml[end] == '\'')) {
+                quote = xml[end];
+            } else if (xml[end] == quote) {
+                quote = '\0';
+            }
+        }
+        if (end >= limit) {
+            token.end = limit; // truncated, nothing after it can be trusted
+            return token;
+        }
+
+        token.kind = xml[end - 1] == '/' ? Token::Empty : Token::Start;
+        token.attributes_begin = name_end;
+        token.attributes_end = token.kind == Token::Empty ? end - 1 : end;
+        token.end = end + 1;
+    }
+    return token;
+}
+
+struct Attribute {
+    std::string_view name;
+    size_t value_begin;
+    size_t value_end;
+};
+
+// name="value" pairs, namespace declarations are left out
+std::vector<Attribute> parseAttributes(std::string_view xml, size_t position, size_t limit) {
+    std::vector<Attribute> attributes;
+    while (true) {
+        while (position < limit && isSpace(xml[position])) {
+            position++;
+        }
+        const size_t name_begin = position;
+        while (position < limit && !isSpace(xml[position]) && xml[position] != '=') {
+            position++;
+        }
+        const std::string_view name = xml.substr(name_begin, position - name_begin);
+        while (position < limit && (isSpace(xml[position]) || xml[position] == '=')) {
+            position++;
+        }
+        if (name.empty() || position >= limit || (xml[position] != '"' && xml[position] != '\'')) {
+            return attributes;
+        }
+
+        const size_t value_begin = position + 1;
+        const size_t value_end = xml.substr(0, limit).find(xml[position], value_begin);
+        if (value_end == std::string_view::npos) {
+            return attributes;
+        }
+        if (name != "xmlns" && name.rfind("xmlns:", 0) != 0) {
+            attributes.push_back({name, value_begin, value_end});
+        }
+        position = value_end + 1;
+    }
+}
+
+std::string_view trim(std::string_view text) {
+    while (!text.empty() && isSpace(text.front())) {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && isSpace(text.back())) {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+void appendUtf8(std::string& out, unsigned long code) {
+    if (code < 0x80) {
+        out.push_back((char)code);
+    } else if (code < 0x800) {
+        out.push_back((char)(0xC0 | (code >> 6)));
+        out.push_back((char)(0x80 | (code & 0x3F)));
+    } else if (code < 0x10000) {
+        out.push_back((char)(0xE0 | (code >> 12)));
+        out.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+        out.push_back((char)(0x80 | (code & 0x3F)));
+    } else {
+        out.push_back((char)(0xF0 | (code >> 18)));
+        out.push_back((char)(0x80 | ((code >> 12) & 0x3F)));
+        out.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+        out.push_back((char)(0x80 | (code & 0x3F)));
+    }
+}
+
+std::string decode(std::string_view text) {
+    std::string out;
+    out.reserve(text.size());
+    for (size_t i = 0; i < text.size();) {
+        if (text.compare(i, 9, "<![CDATA[") == 0) {
+            const size_t end = text.find("]]>", i + 9);
+            out.append(text.substr(i + 9, end == std::string_view::npos ? std::string_view::npos : end - i - 9));
+            i = end == std::string_view::npos ? text.size() : end + 3;
+        } else if (text.compare(i, 4, "<!--") == 0) {
+            const size_t end = text.find("-->", i + 4);
+            i = end == std::string_view::npos ? text.size() : end + 3;
+        } else if (text[i] == '&') {
+            const size_t semicolon = text.find(';', i);
+            const std::string_view entity = semicolon == std::string_view::npos ? std::string_view() : text.substr(i + 1, semicolon - i - 1);
+            if (entity == "amp" || entity == "lt" || entity == "gt" || entity == "quot" || entity == "apos") {
+                out.push_back(entity == "amp" ? '&' : entity == "lt" ? '<' : entity == "gt" ? '>' : entity == "quot" ? '"' : '\'');
+            } else if (entity.size() > 1 && entity[0] == '#') {
+                const std::string digits(entity.substr(entity[1] == 'x' ? 2 : 1));
+                appendUtf8(out, std::strtoul(digits.c_str(), nullptr, entity[1] == 'x' ? 16 : 10));
+            } else {
+                out.push_back('&'); // not an entity, kept as written
+                i++;
+                continue;
+            }
+            i = semicolon + 1;
+        } else {
+            out.push_back(text[i++]);
+        }
+    }
+    return out;
+}
+
+std::string escape(std::string_view text, bool attribute) {
+    std::string out;
+    out.reserve(text.size());
+    for (char c : text) {
+        switch (c) {
+        case '&': out += "&amp;"; break;
+        case '<': out += "&lt;"; break;
+        case '>': out += attribute ? ">" : "&gt;"; break;
+        case '"': out += attribute ? "&quot;" : "\""; break;
+        case '\'': out += attribute ? "&apos;" : "'"; break;
+        default: out.push_back(c);
+        }
+    }
+    return out;
+}
+
+} // namespace
+
+XmpTree::XmpTree(std::string packet) : packet_(std::move(packet)) {
+    Node root;
+    root.parent = kRoot;
+    root.depth = 0;
+    root.begin = 0;
+    root.end = this->packet_.size();
+    root.content_begin = 0;
+    root.content_end = this->packet_.size();
+    root.attribute = false;
+    root.leaf = false;
+    root.self_closing = false;
+    this->nodes_.push_back(std::move(root));
+}
+
+std::vector<size_t> XmpTree::Children(size_t node) {
+    if (!this->nodes_[node].scanned) {
+        this->Scan(node);
+    }
+    return this->nodes_[node].children;
+}
+
+void XmpTree::Scan(size_t node) {
+    TraceSpan span("xmp tree scan");
+    const std::string_view xml = this->packet_;
+    this->nodes_[node].scanned = true;
+    const size_t depth = this->nodes_[node].depth + 1;
+
+    auto add = [&](Node child) {
+        child.parent = node;
+        child.depth = depth;
+        this->nodes_.push_back(std::move(child));
+        this->nodes_[node].children.push_back(this->nodes_.size() - 1);
+    };
+
+    if (node != kRoot) { //a container's attributes are its first children
+        const Token start = nextToken(xml, this->nodes_[node].begin, this->nodes_[node].end);
+        for (const Attribute& attribute : parseAttributes(xml, start.attributes_begin, start.attributes_end)) {
+            add({std::string(attribute.name), "", 0, 0, attribute.value_begin, attribute.value_end, attribute.value_begin, attribute.value_end, true, true, false, false, false, {}});
+        }
+    }
+
+    // child elements, everything inside them is only skipped over
+    const size_t limit = this->nodes_[node].content_end;
+    size_t position = this->nodes_[node].content_begin;
+    size_t level = 0;
+    Node child;
+    bool child_has_elements = false;
+    bool child_has_text = false;
+    bool child_has_attributes = false;
+
+    auto finish = [&](size_t content_end, size_t end) {
+        child.content_end = content_end;
+        child.end = end;
+        // <rdf:Description a="1"/> holds properties, <rdf:li xml:lang="x-default">text</rdf:li> a value
+        child.leaf = !child_has_elements && !(child_has_attributes && !child_has_text);
+        if (child.leaf) {
+            const Token start = nextToken(xml, child.begin, end);
+            child.attributes = trim(xml.substr(start.attributes_begin, start.attributes_end - start.attributes_begin));
+        }
+        add(std::move(child));
+    };
+
+    while (position < limit) {
+        const Token token = nextToken(xml, position, limit);
+        position = token.end;
+
+        if (token.kind == Token::Start || token.kind == Token::Empty) {
+            if (level == 0) {
+                child = Node{std::string(token.name), "", 0, 0, token.begin, token.end, token.end, token.end, false, false, token.kind == Token::Empty, false, false, {}};
+                child_has_elements = false;
+                child_has_text = false;
+                child_has_attributes = !parseAttributes(xml, token.attributes_begin, token.attributes_end).empty();
+                if (token.kind == Token::Empty) {
+                    child.content_begin = token.end - 2; //an empty value sits before the />
+                    finish(token.end - 2, token.end);
+                    continue;
+                }
+            } else if (level == 1) {
+                child_has_elements = true;
+            }
+            if (token.kind == Token::Start) {
+                level++;
+            }
+        } else if (token.kind == Token::End) {
+            if (level == 0) {
+                break; //more end tags than start tags, the rest isn't ours
+            }
+            if (--level == 0) {
+                finish(token.begin, token.end);
+            }
+        } else if (token.kind == Token::Text && level == 1 && !trim(xml.substr(token.begin, token.end - token.begin)).empty()) {
+            child_has_text = true;
+        }
+    }
+    if (level > 0) { //never closed
+        finish(limit, limit);
+    }
+    span.Bytes(limit - this->nodes_[node].content_begin);
+}
+
+std::string XmpTree::Value(size_t node) const {
+    const Node& entry = this->nodes_[node];
+    if (!entry.leaf) {
+        return "";
+    }
+    return decode(std::string_view(this->packet_).substr(entry.content_begin, entry.content_end - entry.content_begin));
+}
+
+void XmpTree::Splice(size_t begin, size_t end, const std::string& replacement) {
+    this->packet_.replace(begin, end - begin, replacement);
+
+    // only ranges at or after the replaced bytes move, nothing materialised is inside them
+    const size_t delta = replacement.size() - (end - begin); // wraps around when shrinking
+    for (Node& entry : this->nodes_) {
+        for (size_t* offset : {&entry.begin, &entry.end, &entry.content_begin, &entry.content_end}) {
+            if (*offset >= end && *offset > begin) {
+                *offset += delta;
+            }
+        }
+    }
+}
+
+void XmpTree::Set(size_t node, std::string_view text) {
+    Node& entry = this->nodes_[node];
+    if (!entry.leaf) {
+        throw std::logic_error("XMP node " + entry.name + " has no value of its own");
+    }
+
+    const std::string value = escape(text, entry.attribute);
+    if (entry.self_closing) { // <name/> becomes <name>value</name>
+        const size_t content_begin = entry.content_begin + 1;
+        this->Splice(entry.content_begin, entry.end, ">" + value + "</" + entry.name + ">");
+        entry.self_closing = false;
+        entry.content_begin = content_begin;
+        entry.content_end = content_begin + value.size();
+        return;
+    }
+
+    const size_t content_begin = entry.content_begin;
+    this->Splice(entry.content_begin, entry.content_end, value);
+    entry.content_end = content_begin + value.size(); // an empty old value didn't move with the rest
+    if (entry.attribute) {
+        entry.end = entry.content_end;
+    }
+}